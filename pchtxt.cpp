@@ -21,48 +21,22 @@
 #include "pchtxt.hpp"
 
 #include <algorithm>
+#include <array>
 #include <cstring>
 #include <iomanip>
-#include <set>
 #include <unordered_map>
 
+#include "pchtxt_trace.hpp"
+#include "pchtxt_utils.hpp"
+
 namespace pchtxt {
 
 // CONSTANTS
 
-constexpr auto COMMENT_IDENTIFIER = "/";
-constexpr auto ECHO_IDENTIFIER = "#";
-constexpr auto AUTHOR_IDENTIFIER_OPEN = "[";
-constexpr auto AUTHOR_IDENTIFIER_CLOSE = "]";
-constexpr auto AMS_CHEAT_IDENTIFIER_OPEN = "[";
-constexpr auto AMS_CHEAT_IDENTIFIER_CLOSE = "]";
-// meta tags
-constexpr auto TITLE_TAG = "@title";
-constexpr auto PROGRAM_ID_TAG = "@program";
-constexpr auto URL_TAG = "@url";
-constexpr auto NSOBID_TAG = "@nsobid";  // legacy
-const auto META_TAGS = std::set<std::string_view>{TITLE_TAG, PROGRAM_ID_TAG, URL_TAG, NSOBID_TAG};
-// parsing tags
-constexpr auto ENABLED_TAG = "@enabled";
-constexpr auto DISABLED_TAG = "@disabled";
-constexpr auto STOP_PARSING_TAG = "@stop";
-constexpr auto FLAG_TAG = "@flag";
-// patch type strings
-constexpr auto PATCH_TYPE_BIN = "bin";
-constexpr auto PATCH_TYPE_HEAP = "heap";
-constexpr auto PATCH_TYPE_AMS = "ams";
-// flags
-constexpr auto BIG_ENDIAN_FLAG = "be";
-constexpr auto LITTLE_ENDIAN_FLAG = "le";
-constexpr auto NSOBID_FLAG = "nsobid";
-constexpr auto NROBID_FLAG = "nrobid";
-constexpr auto OFFSET_SHIFT_FLAG = "offset_shift";
-constexpr auto DEBUG_INFO_FLAG = "debug_info";
-constexpr auto ALT_DEBUG_INFO_FLAG = "print_values";  // legacy
-
 // IPS
 constexpr auto IPS32_HEADER_MAGIC = "IPS32";
 constexpr auto IPS32_FOOTER_MAGIC = "EEOF";
+constexpr auto IPS32_MAX_RECORD_SIZE = size_t{0xFFFF};
 
 // utils
 
@@ -71,11 +45,11 @@ inline auto isStartsWith(std::string& checkedStr, std::string_view targetStr) {
 }
 
 inline void ltrim(std::string& str) {
-    str.erase(begin(str), std::find_if(begin(str), end(str), [](char ch) { return not std::isspace(ch); }));
+    str.erase(begin(str), std::find_if(begin(str), end(str), [](char ch) { return not isAsciiSpace(ch); }));
 }
 
 inline void rtrim(std::string& str) {
-    str.erase(std::find_if(rbegin(str), rend(str), [](char ch) { return !std::isspace(ch); }).base(), end(str));
+    str.erase(std::find_if(rbegin(str), rend(str), [](char ch) { return not isAsciiSpace(ch); }).base(), end(str));
 }
 
 inline void trim(std::string& str) {
@@ -84,46 +58,31 @@ inline void trim(std::string& str) {
 }
 
 inline auto firstToken(std::string& str) {
-    return std::string(begin(str), std::find_if(begin(str), end(str), [](char ch) { return std::isspace(ch); }));
-}
-
-inline auto commentPos(std::string& str) {
-    auto pos = 0;
-    auto isInString = false;
-    for (auto ch : str) {
-        if (ch == COMMENT_IDENTIFIER[0] and not isInString) {
-            break;
-        }
-        if (ch == '"') {
-            isInString = !isInString;
-        }
-        pos++;
-    }
-    return pos;
+    return std::string(begin(str), std::find_if(begin(str), end(str), [](char ch) { return isAsciiSpace(ch); }));
 }
 
 inline auto getLineCommentContent(std::string& str) {
-    auto commentContentStart = std::find_if(begin(str) + commentPos(str), end(str), [](char ch) {
-        return not(std::isspace(ch) or ch == COMMENT_IDENTIFIER[0]);
+    auto commentContentStart = std::find_if(begin(str) + getCommentPos(str), end(str), [](char ch) {
+        return not(isAsciiSpace(ch) or ch == COMMENT_IDENTIFIER[0]);
     });
     auto result = std::string(commentContentStart, end(str));
     return result;
 }
 
 inline auto getLineNoComment(std::string& lineStr) {
-    auto result = lineStr.substr(0, commentPos(lineStr));
+    auto result = lineStr.substr(0, getCommentPos(lineStr));
     rtrim(result);
     return result;
 }
 
 inline auto getStringToLowerCase(std::string& str) {
     auto result = std::string(str);
-    std::transform(begin(result), end(result), begin(result), [](char ch) { return std::tolower(ch); });
+    std::transform(begin(result), end(result), begin(result), toAsciiLower);
     return result;
 }
 
 inline auto stringIsHex(std::string& str) {
-    return std::find_if(begin(str), end(str), [](char ch) { return not std::isxdigit(ch); }) == end(str);
+    return std::find_if(begin(str), end(str), [](char ch) { return not isAsciiHexDigit(ch); }) == end(str);
 }
 
 inline void trimZeros(std::string& str) { str.erase(0, std::min(str.find_first_not_of('0'), str.size() - 1)); }
@@ -171,427 +130,1111 @@ inline void escapeString(std::string& str) {
     if (targetPos != end(str)) str.erase(targetPos, end(str));
 }
 
-inline auto getHexCharNibble(char ch) -> uint8_t {
-    if (ch >= 'A' and ch <= 'F') return ch - 'A' + 10;
-    if (ch >= 'a' and ch <= 'f') return ch - 'a' + 10;
-    return ch - '0';  // this is okay because we already check the string is hex
-}
-
 inline auto getHexByte(std::string::iterator& strIter) -> uint8_t {
     return (getHexCharNibble(*strIter) << 4) + getHexCharNibble(*(strIter + 1));
 }
 
-// not utils
+inline auto getHexString(const std::vector<uint8_t>& bytes) {
+    constexpr auto HEX_DIGITS = "0123456789abcdef";
+    auto result = std::string{};
+    result.reserve(bytes.size() * 2);
+    for (auto byte : bytes) {
+        result.push_back(HEX_DIGITS[byte >> 4]);
+        result.push_back(HEX_DIGITS[byte & 0xF]);
+    }
+    return result;
+}
 
-auto parsePchtxt(std::istream& input) -> PatchTextOutput {
-    auto throwAwaySs = std::stringstream{};
-    return parsePchtxt(input, throwAwaySs);
+inline auto getOffsetString(uint32_t offset) {
+    auto offsetBytes = std::vector<uint8_t>{};
+    for (auto rightShift : {3, 2, 1, 0}) offsetBytes.push_back((offset >> rightShift * 8) & 0xFF);
+    return getHexString(offsetBytes);
 }
 
-auto parsePchtxt(std::istream& input, std::ostream& logOs) -> PatchTextOutput {
-    auto result = PatchTextOutput{};
-
-    // parse meta
-    auto curPos = input.tellg();
-    result.meta = getPchtxtMeta(input, logOs);
-    input.seekg(curPos);
-
-    // parsing status
-    auto curLineNum = 1;
-    auto lastCommentLine = std::string{};
-    auto curPatch = Patch{};
-    auto curPatchCollection = PatchCollection{};
-    auto curOffsetShift = 0;
-    auto curIsBigEndian = false;
-    auto isAcceptingPatch = false;
-    auto stopParsing = false;
-    auto logDebugInfo = false;
+// patch content value
 
-    auto line = std::string{};
-    while (true) {
-        if (stopParsing) break;
+PatchContentValue::PatchContentValue(PatchContentValue&& other) noexcept { takeBytes(other); }
 
-        if (not std::getline(input, line)) {
-            logOs << "done parsing patches" << std::endl;
-            break;
+PatchContentValue::~PatchContentValue() {
+    if (not isInline()) resource->deallocate(heapBytes, capacity, 1);
+}
+
+auto PatchContentValue::operator=(const PatchContentValue& other) -> PatchContentValue& {
+    if (this != &other) assign(other.begin(), other.end());
+    return *this;
+}
+
+auto PatchContentValue::operator=(PatchContentValue&& other) noexcept -> PatchContentValue& {
+    if (this != &other) {
+        if (not isInline()) resource->deallocate(heapBytes, capacity, 1);
+        capacity = INLINE_CAPACITY;
+        takeBytes(other);
+    }
+    return *this;
+}
+
+void PatchContentValue::assign(const uint8_t* first, const uint8_t* last) {
+    valueSize = 0;
+    append(first, last);
+}
+
+void PatchContentValue::append(const uint8_t* first, const uint8_t* last) {
+    auto appendSize = static_cast<size_t>(last - first);
+    if (appendSize == 0) return;
+    if (valueSize + appendSize > capacity) reserve(std::max(valueSize + appendSize, size_t{capacity} * 2));
+    std::memcpy(data() + valueSize, first, appendSize);
+    valueSize += static_cast<uint32_t>(appendSize);
+}
+
+void PatchContentValue::takeBytes(PatchContentValue& other) {
+    // heap bytes change owner, inline bytes have to be copied
+    if (other.isInline()) {
+        std::memcpy(inlineBytes, other.inlineBytes, other.valueSize);
+    } else {
+        heapBytes = other.heapBytes;
+        capacity = other.capacity;
+        other.capacity = INLINE_CAPACITY;
+    }
+    valueSize = other.valueSize;
+    other.valueSize = 0;
+    resource = other.resource;
+}
+
+void PatchContentValue::reserve(size_t newCapacity) {
+    auto newBytes = static_cast<uint8_t*>(resource->allocate(newCapacity, 1));
+    std::memcpy(newBytes, data(), valueSize);
+    if (not isInline()) resource->deallocate(heapBytes, capacity, 1);
+    heapBytes = newBytes;
+    capacity = static_cast<uint32_t>(newCapacity);
+}
+
+// interned string
+
+InternedString::InternedString(std::string_view str) {
+    if (str.size() <= INLINE_CAPACITY) {
+        std::memcpy(bytes, str.data(), str.size());
+        bytes[TAG_POS] = static_cast<char>(str.size());
+        return;
+    }
+
+    auto* shared = new (::operator new(sizeof(SharedChars) + str.size() + 1)) SharedChars{{1}, str.size()};
+    auto* chars = const_cast<char*>(shared->data());
+    std::memcpy(chars, str.data(), str.size());
+    chars[str.size()] = '\0';
+    std::memcpy(bytes, &shared, sizeof(shared));
+    bytes[TAG_POS] = SHARED_TAG;
+}
+
+InternedString::InternedString(const InternedString& other) {
+    std::memcpy(bytes, other.bytes, sizeof(bytes));
+    if (isShared()) getShared()->handleCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+InternedString::InternedString(InternedString&& other) noexcept {
+    std::memcpy(bytes, other.bytes, sizeof(bytes));
+    std::memset(other.bytes, 0, sizeof(other.bytes));
+}
+
+auto InternedString::operator=(InternedString other) noexcept -> InternedString& {
+    std::swap(bytes, other.bytes);
+    return *this;
+}
+
+InternedString::~InternedString() {
+    if (not isShared()) return;
+    auto* shared = getShared();
+    if (shared->handleCount.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+    shared->~SharedChars();
+    ::operator delete(shared);
+}
+
+auto StringPool::intern(std::string_view str) -> InternedString {
+    if (str.size() <= InternedString::INLINE_CAPACITY) return InternedString{str};
+
+    // look up before allocating, since most strings interned are already in the pool
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    auto existingStr = strings.find(str);
+    if (existingStr != end(strings)) return existingStr->second;
+
+    auto internedStr = InternedString{str};
+    strings.emplace(internedStr.str(), internedStr);
+    return internedStr;
+}
+
+auto StringPool::adopt(const InternedString& str) -> InternedString {
+    if (not str.isShared()) return str;
+
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    auto existingStr = strings.find(str.str());
+    if (existingStr != end(strings)) return existingStr->second;
+
+    strings.emplace(str.str(), str);
+    return str;
+}
+
+auto StringPool::size() const -> size_t {
+    auto lock = std::lock_guard<std::mutex>{mutex};
+    return strings.size();
+}
+
+// build id
+
+auto BuildId::fromHex(std::string_view hexStr) -> std::optional<BuildId> {
+    if (hexStr.empty() or hexStr.size() > SIZE * 2) return {};
+
+    auto result = BuildId{};
+    for (auto digitIdx = size_t{0}; digitIdx < hexStr.size(); digitIdx++) {
+        if (not isAsciiHexDigit(hexStr[digitIdx])) return {};
+        auto nibble = getHexCharNibble(hexStr[digitIdx]);
+        result.bytes[digitIdx / 2] |= digitIdx % 2 == 0 ? nibble << 4 : nibble;
+    }
+    result.hexLength = static_cast<uint8_t>(hexStr.size());
+    result.updateHash();
+    return result;
+}
+
+auto BuildId::fromBytes(const uint8_t* bytes, size_t size) -> BuildId {
+    auto result = BuildId{};
+    size = std::min(size, SIZE);
+    std::copy(bytes, bytes + size, begin(result.bytes));
+
+    // trailing zeros are only padding
+    while (size > 1 and result.bytes[size - 1] == 0) size--;
+    result.hexLength = static_cast<uint8_t>(size * 2);
+    result.updateHash();
+    return result;
+}
+
+auto BuildId::toString() const -> std::string {
+    constexpr auto HEX_DIGITS = "0123456789ABCDEF";
+    auto result = std::string(hexLength, '0');
+    for (auto digitIdx = size_t{0}; digitIdx < hexLength; digitIdx++) {
+        auto byte = bytes[digitIdx / 2];
+        result[digitIdx] = HEX_DIGITS[digitIdx % 2 == 0 ? byte >> 4 : byte & 0xF];
+    }
+    return result;
+}
+
+auto BuildId::toCanonical() const -> BuildId {
+    auto result = *this;
+    auto isLong = std::any_of(begin(bytes) + CANONICAL_SIZE, end(bytes), [](uint8_t byte) { return byte != 0; });
+    result.hexLength = static_cast<uint8_t>((isLong ? SIZE : CANONICAL_SIZE) * 2);
+    return result;
+}
+
+void BuildId::updateHash() {
+    // the bytes are already a hash of the binary, so mixing the words is enough
+    hash = 0;
+    for (auto wordIdx = size_t{0}; wordIdx < SIZE / sizeof(uint64_t); wordIdx++) {
+        hash = (hash ^ static_cast<size_t>(getWord(wordIdx))) * 0x100000001B3ull;
+    }
+}
+
+// enabled overlay
+
+PatchEnabledSet::PatchEnabledSet(const PatchCollection& patchCollection) {
+    auto patchIdx = size_t{0};
+    for (auto& patch : patchCollection.patches) setEnabled(patchIdx++, patch.enabled);
+}
+
+auto PatchEnabledSet::isEnabled(size_t patchIdx) const -> bool {
+    if (patchIdx < WORD_BITS) return (inlineWord >> patchIdx) & 1u;
+    auto wordIdx = patchIdx / WORD_BITS - 1;
+    return wordIdx < moreWords.size() and (moreWords[wordIdx] >> patchIdx % WORD_BITS) & 1u;
+}
+
+void PatchEnabledSet::setEnabled(size_t patchIdx, bool enabled) {
+    auto* word = &inlineWord;
+    if (patchIdx >= WORD_BITS) {
+        auto wordIdx = patchIdx / WORD_BITS - 1;
+        if (wordIdx >= moreWords.size()) {
+            if (not enabled) return;  // already disabled
+            moreWords.resize(wordIdx + 1);
         }
-        trim(line);
-        auto lineNoComment = getLineNoComment(line);
-        auto lineNoCommentLower = getStringToLowerCase(lineNoComment);
+        word = &moreWords[wordIdx];
+    }
+    auto bit = uint64_t{1} << patchIdx % WORD_BITS;
+    *word = enabled ? *word | bit : *word & ~bit;
+}
 
-        switch (line[0]) {
-            case '@': {  // tags
-                auto curTag = firstToken(lineNoCommentLower);
+auto PatchEnabledSet::operator==(const PatchEnabledSet& other) const -> bool {
+    if (inlineWord != other.inlineWord) return false;
+    // words past the end of the shorter set are equal when they are all disabled
+    auto& shorterWords = moreWords.size() < other.moreWords.size() ? moreWords : other.moreWords;
+    auto& longerWords = moreWords.size() < other.moreWords.size() ? other.moreWords : moreWords;
+    return std::equal(begin(shorterWords), end(shorterWords), begin(longerWords)) and
+           std::all_of(begin(longerWords) + shorterWords.size(), end(longerWords),
+                       [](uint64_t word) { return word == 0; });
+}
 
-                if (curTag == STOP_PARSING_TAG) {  // stop parsing
-                    logOs << "L" << curLineNum << ": done parsing patches (reached tag @stop)" << std::endl;
-                    stopParsing = true;
-                    break;
+PatchEnabledOverlay::PatchEnabledOverlay(const PatchTextOutput& patchTextOutput) {
+    collections.reserve(patchTextOutput.collections.size());
+    for (auto& patchCollection : patchTextOutput.collections) collections.emplace_back(patchCollection);
+}
 
-                } else if (curTag == ENABLED_TAG or curTag == DISABLED_TAG) {  // start of a new patch
-                    // store current
-                    if (curPatchCollection.buildId.empty()) {
-                        logOs << "L" << curLineNum << ": ERROR: missing build id, abort parsing" << std::endl;
-                        return {};
-                    }
-
-                    if (not curPatch.contents.empty()) {
-                        curPatchCollection.patches.push_back(curPatch);
-                        logOs << "L" << curLineNum << ": patch read: " << curPatch.name << std::endl;
-                        // start new patch
-                        curPatch = Patch{};
-                    }
-
-                    if (curTag == ENABLED_TAG) {
-                        curPatch.enabled = true;
-                    } else {
-                        curPatch.enabled = false;
-                    }
-
-                    curPatch.lineNum = curLineNum;
-
-                    if (curPatch.type != AMS) {  // don't use last comment on AMS style patch titles
-                        // extract name and author from last comment
-                        auto authorStartPos = lastCommentLine.rfind(AUTHOR_IDENTIFIER_OPEN);
-                        auto authorEndPos = lastCommentLine.rfind(AUTHOR_IDENTIFIER_CLOSE);
-                        auto patchName = lastCommentLine.substr(0, authorStartPos);
-                        rtrim(patchName);
-                        auto author =
-                            authorStartPos != std::string::npos
-                                ? lastCommentLine.substr(authorStartPos + 1, authorEndPos - authorStartPos - 1)
-                                : std::string{};
-                        trim(author);
-                        curPatch.name = patchName;
-                        curPatch.author = author;
-                    }
-
-                    // check patch type
-                    auto lineAfterTag = lineNoCommentLower.substr(curTag.size());
-                    ltrim(lineAfterTag);
-                    auto patchType = firstToken(lineAfterTag);
-                    if (patchType == PATCH_TYPE_HEAP) {
-                        curPatch.type = HEAP;
-                    } else if (patchType == PATCH_TYPE_AMS) {
-                        curPatch.type = AMS;
-                    }
-
-                    isAcceptingPatch = true;
-
-                    if (logDebugInfo) logOs << "L" << curLineNum << ": parsing patch: " << curPatch.name << std::endl;
-
-                } else if (curTag == FLAG_TAG) {  // parse flag
-                    auto flagContent = lineNoComment.substr(curTag.size());
-                    ltrim(flagContent);
-                    auto flagType = firstToken(flagContent);
-                    ltrim(flagType);
-                    auto flagValue = flagContent.substr(flagType.size());
-                    ltrim(flagValue);
-                    flagType = getStringToLowerCase(flagType);
-
-                    if (flagType == BIG_ENDIAN_FLAG) {
-                        curIsBigEndian = true;
-
-                    } else if (flagType == LITTLE_ENDIAN_FLAG) {
-                        curIsBigEndian = false;
-
-                    } else if (flagType == NSOBID_FLAG or flagType == NROBID_FLAG) {
-                        // wrap up last bid collection
-                        if (not curPatch.contents.empty()) {
-                            curPatchCollection.patches.push_back(curPatch);
-                            logOs << "L" << curLineNum << ": patch read: " << curPatch.name << std::endl;
-                        }
-                        curPatch = Patch{};
-                        if (not curPatchCollection.patches.empty()) {
-                            result.collections.push_back(curPatchCollection);
-                            if (logDebugInfo)
-                                logOs << "L" << curLineNum << ": parsing stopped for " << curPatchCollection.buildId
-                                      << std::endl;
-                            curPatchCollection = PatchCollection{};
-                        }
-
-                        // check if new bid exist
-                        auto existingCollection = std::find_if(
-                            begin(result.collections), end(result.collections),
-                            [flagValue](PatchCollection& collection) { return collection.buildId == flagValue; });
-
-                        if (existingCollection != end(result.collections)) {  // bid already exist
-                            curPatchCollection = *existingCollection;
-                            result.collections.erase(existingCollection);
-                        } else {
-                            // set up patch collection for new bid
-                            curPatchCollection.buildId = flagValue;
-                            if (flagType == NROBID_FLAG) {
-                                curPatchCollection.targetType = NRO;
-                            } else {
-                                curPatchCollection.targetType = NSO;
-                            }
-                        }
-
-                        isAcceptingPatch = false;  // don't accept anymore patches since we just started new bid
-
-                        if (logDebugInfo)
-                            logOs << "L" << curLineNum << ": parsing started for " << curPatchCollection.buildId
-                                  << std::endl;
-
-                    } else if (flagType == OFFSET_SHIFT_FLAG) {
-                        curOffsetShift = std::stoi(flagValue, nullptr, 0);
-                        if (logDebugInfo)
-                            logOs << "L" << curLineNum << ": offset shift is now " << curOffsetShift << std::endl;
-
-                    } else if (flagType == DEBUG_INFO_FLAG or flagType == ALT_DEBUG_INFO_FLAG) {
-                        logDebugInfo = true;
-                        logOs << "L" << curLineNum << ": additional debug info enabled" << std::endl;
-
-                    } else {
-                        logOs << "L" << curLineNum << ": WARNING ignored unrecognized flag type: " << flagType
-                              << std::endl;
-                    }
-
-                } else if (isStartsWith(lineNoCommentLower, NSOBID_TAG)) {  // legacy style nsobid
-                    if (not(lineNoCommentLower.size() > std::string_view(NSOBID_TAG).size() + 1)) {
-                        logOs << "L" << curLineNum << ": ERROR: legacy nsobid tag missing value" << std::endl;
-                        return {};
-                    }
-                    curPatchCollection.targetType = NSO;
-                    curPatchCollection.buildId = lineNoComment.substr(std::string_view(NSOBID_TAG).size() + 1);
-                    ltrim(curPatchCollection.buildId);
-
-                    if (logDebugInfo)
-                        logOs << "L" << curLineNum << ": parsing started for " << curPatchCollection.buildId
-                              << " (legacy style bid)" << std::endl;
-
-                } else if (META_TAGS.find(curTag) == end(META_TAGS)) {  // check if tag is bad
-                    logOs << "L" << curLineNum << ": WARNING ignored unrecognized tag: " << curTag << std::endl;
-                }
-                break;
-            }
+auto PatchEnabledOverlay::getCollection(size_t collectionIdx) const -> const PatchEnabledSet& {
+    static const auto EMPTY_SET = PatchEnabledSet{};
+    return collectionIdx < collections.size() ? collections[collectionIdx] : EMPTY_SET;
+}
 
-            case '#': {  // echo identifier
-                logOs << "L" << curLineNum << ": " << line << std::endl;
-                break;
-            }
+auto PatchEnabledOverlay::getCollection(size_t collectionIdx) -> PatchEnabledSet& {
+    if (collectionIdx >= collections.size()) collections.resize(collectionIdx + 1);
+    return collections[collectionIdx];
+}
 
-            case AMS_CHEAT_IDENTIFIER_OPEN[0]: {  // AMS cheat
-                // store current
-                if (curPatchCollection.buildId.empty()) {
-                    logOs << "L" << curLineNum << ": ERROR: missing build id, abort parsing" << std::endl;
-                    return {};
-                }
+auto PatchEnabledOverlay::isEnabled(size_t collectionIdx, size_t patchIdx) const -> bool {
+    return getCollection(collectionIdx).isEnabled(patchIdx);
+}
 
-                if (not curPatch.contents.empty()) {
-                    curPatchCollection.patches.push_back(curPatch);
-                    logOs << "L" << curLineNum << ": patch read: " << curPatch.name << std::endl;
-                }
+void PatchEnabledOverlay::setEnabled(size_t collectionIdx, size_t patchIdx, bool enabled) {
+    if (not enabled and collectionIdx >= collections.size()) return;  // already disabled
+    getCollection(collectionIdx).setEnabled(patchIdx, enabled);
+}
 
-                // start new patch
-                auto amsCheatName = lineNoComment.substr(1, lineNoComment.rfind(AMS_CHEAT_IDENTIFIER_CLOSE) - 1);
-                trim(amsCheatName);
-                curPatch = Patch{amsCheatName, {}, AMS, true, curLineNum, {}};
+// visitors
 
-                if (logDebugInfo) logOs << "L" << curLineNum << ": parsing AMS cheat: " << curPatch.name << std::endl;
+inline void writeLog(std::ostream* logOs, int lineNum, const std::string& message) {
+    if (logOs == nullptr) return;
+    if (lineNum > 0) *logOs << "L" << lineNum << ": ";
+    *logOs << message << std::endl;
+}
 
-                break;
-            }
+class LoggingVisitor : public PatchTextVisitor {
+   public:
+    explicit LoggingVisitor(std::ostream* logOs) : logOs(logOs) {}
 
-            case '/': {  // comment identifier
-                lastCommentLine = getLineCommentContent(line);
-                break;
-            }
+    void onDiagnostic(DiagnosticLevel, int lineNum, const std::string& message) override {
+        writeLog(logOs, lineNum, message);
+    }
 
-            default: {
-                if (not isAcceptingPatch) break;
+   private:
+    std::ostream* logOs;
+};
 
-                // skip empty lines
-                if (line.empty()) {
-                    break;
-                }
+class PatchTextMetaReader : public LoggingVisitor {
+   public:
+    using LoggingVisitor::LoggingVisitor;
 
-                // parse patch contents
-                if (curPatch.type == AMS) {  // for AMS cheats, just add line as plain text
-                    curPatch.contents.push_back({0, {begin(lineNoComment), end(lineNoComment)}});
+    void onMeta(const PatchTextMeta& meta) override { result = meta; }
 
-                    if (logDebugInfo) logOs << "L" << curLineNum << ": AMS cheat: " << lineNoComment << std::endl;
-                    break;
-                }
+    PatchTextMeta result{};
+};
 
-                // parse values
-                auto offsetStr = firstToken(lineNoCommentLower);
-                auto valueStr = lineNoCommentLower.substr(offsetStr.size());
+// output builder
 
-                // check offset
-                if (not stringIsHex(offsetStr)) {
-                    if (logDebugInfo)
-                        logOs << "L" << curLineNum << ": line ignored: invalid offset: " << line << std::endl;
-                    break;
-                }
-                trimZeros(offsetStr);
-                if (offsetStr.size() > 8) {
-                    logOs << "L" << curLineNum << ": ERROR: offset: " << offsetStr << " out of range" << std::endl;
-                    return {};
-                }
+void PatchTextOutputBuilder::onMeta(const PatchTextMeta& meta) { output.meta = meta; }
 
-                auto offset = static_cast<uint32_t>(std::stoul(offsetStr, nullptr, 16)) + curOffsetShift;
-                auto patchContent = PatchContent{offset, {}};
-
-                // parse value
-                ltrim(valueStr);
-                if (valueStr[0] == '"') {  // string patch
-                    auto closingPosSearch = begin(valueStr);
-                    while (true) {  // find string closing pos
-                        closingPosSearch++;
-
-                        if ((closingPosSearch = std::find(closingPosSearch, end(valueStr), '"')) == end(valueStr)) {
-                            logOs << "L" << curLineNum << ": ERROR: cannot find string closing: " << valueStr
-                                  << std::endl;
-                            return {};
-                        }
-
-                        if (*(closingPosSearch - 1) != '\\') {
-                            break;
-                        }
-                    }
-
-                    // escape chars
-                    auto stringValueStr = std::string{begin(valueStr) + 1, closingPosSearch};
-                    escapeString(stringValueStr);
-
-                    patchContent.value = {begin(stringValueStr), end(stringValueStr)};
-                    patchContent.value.push_back('\0');
-
-                } else {            // hex values patch
-                    while (true) {  // parse value token by token
-                        // get next token
-                        auto valueTokenStr = firstToken(valueStr);
-                        valueStr = valueStr.substr(valueTokenStr.size());
-                        ltrim(valueStr);
-                        if (valueTokenStr.empty()) {
-                            break;
-                        }
-
-                        // check token
-                        if (valueTokenStr.size() % 2 != 0) {
-                            logOs << "L" << curLineNum << ": ERROR: bad length for hex values: " << valueTokenStr
-                                  << std::endl;
-                            return {};
-                        }
-                        if (not stringIsHex(valueTokenStr)) {
-                            logOs << "L" << curLineNum << ": ERROR: not valid hex values: " << valueTokenStr
-                                  << std::endl;
-                            return {};
-                        }
-
-                        // parse token value
-                        if (curIsBigEndian) {
-                            auto curBytePos = end(valueTokenStr);
-                            while (curBytePos != begin(valueTokenStr)) {
-                                curBytePos -= 2;
-                                patchContent.value.push_back(getHexByte(curBytePos));
-                            }
-                        } else {
-                            for (auto curBytePos = begin(valueTokenStr); curBytePos != end(valueTokenStr);
-                                 curBytePos += 2) {
-                                patchContent.value.push_back(getHexByte(curBytePos));
-                            }
-                        }
-                    }
-                }
+void PatchTextOutputBuilder::onCollectionBegin(const BuildId& buildId, TargetType targetType) {
+    // patches for a bid that already exist are merged into its collection, which is moved to the end
+    auto existingCollection =
+        std::find_if(begin(output.collections), end(output.collections),
+                     [&buildId](PatchCollection& collection) { return collection.buildId == buildId; });
 
-                curPatch.contents.push_back(patchContent);
-                if (logDebugInfo) {
-                    logOs << "L" << curLineNum << ": offset: " << std::hex << std::setfill('0') << std::setw(8)
-                          << patchContent.offset << " value: ";
-                    for (auto byte : patchContent.value) logOs << std::setw(2) << static_cast<int>(byte);
-                    logOs << std::dec << " len: " << patchContent.value.size() << std::endl;
-                }
-            }
+    if (existingCollection != end(output.collections)) {
+        output.collections.splice(end(output.collections), output.collections, existingCollection);
+    } else {
+        output.collections.push_back({buildId, targetType, std::pmr::list<Patch>{resource}});
+    }
+}
+
+void PatchTextOutputBuilder::onCollectionEnd() {
+    if (output.collections.back().patches.empty()) output.collections.pop_back();
+}
+
+void PatchTextOutputBuilder::onCollectionBuildIdChange(const BuildId& buildId, TargetType targetType) {
+    auto curCollection = std::prev(end(output.collections));
+    auto existingCollection =
+        std::find_if(begin(output.collections), curCollection,
+                     [&buildId](PatchCollection& collection) { return collection.buildId == buildId; });
+
+    // an earlier collection for the bid takes the patches, so each bid still has one collection
+    if (existingCollection != curCollection) {
+        existingCollection->patches.splice(end(existingCollection->patches), curCollection->patches);
+        output.collections.erase(curCollection);
+        output.collections.splice(end(output.collections), output.collections, existingCollection);
+    }
+    output.collections.back().buildId = buildId;
+    output.collections.back().targetType = targetType;
+}
+
+void PatchTextOutputBuilder::onPatchBegin(const Patch& patch) {
+    auto contents = std::pmr::list<PatchContent>{resource};
+    auto& addedPatch = output.collections.back().patches.emplace_back(
+        Patch{patch.name, patch.author, patch.type, patch.enabled, patch.lineNum, std::move(contents)});
+    if (stringPool != nullptr) {
+        addedPatch.name = stringPool->adopt(patch.name);
+        addedPatch.author = stringPool->adopt(patch.author);
+    }
+}
+
+void PatchTextOutputBuilder::onContent(uint32_t offset, const std::vector<uint8_t>& value) {
+    output.collections.back().patches.back().contents.push_back(
+        {offset, PatchContentValue{value.data(), value.data() + value.size(), resource}});
+}
+
+void PatchTextOutputBuilder::onDiagnostic(DiagnosticLevel, int lineNum, const std::string& message) {
+    writeLog(logOs, lineNum, message);
+}
+
+// parser
+
+// counts the time it is in scope to a phase, then goes back to the phase it was nested in
+class PatchTextParser::PhaseScope {
+   public:
+    PhaseScope(PatchTextParser& parser, std::chrono::nanoseconds ParseStats::*phaseTime)
+        : parser(parser), outerPhaseTime(parser.enterPhase(phaseTime)) {}
+    PhaseScope(const PhaseScope&) = delete;
+    auto operator=(const PhaseScope&) -> PhaseScope& = delete;
+    ~PhaseScope() { parser.enterPhase(outerPhaseTime); }
+
+   private:
+    PatchTextParser& parser;
+    std::chrono::nanoseconds ParseStats::*outerPhaseTime;
+};
+
+PatchTextParser::PatchTextParser(PatchTextVisitor& visitor, bool isMetaOnly)
+    : visitor(visitor), isMetaOnly(isMetaOnly) {
+    if (Tracer::isEnabled()) metaTraceBeginTime = Tracer::now();
+}
+
+PatchTextParser::PatchTextParser(PatchTextVisitor& visitor, ParseStats& stats, bool isMetaOnly)
+    : visitor(visitor), isMetaOnly(isMetaOnly), stats(&stats) {
+    if (Tracer::isEnabled()) metaTraceBeginTime = Tracer::now();
+}
+
+auto PatchTextParser::parseLine(std::string& line) -> bool {
+    if (isDone) return false;
+
+    auto tokenizeScope = PhaseScope{*this, &ParseStats::tokenizeTime};
+    if (stats != nullptr) {
+        stats->bytesRead += line.size() + 1;
+        stats->linesRead++;
+    }
+
+    trim(line);
+    if (isParsingMeta) {
+        auto metaScope = PhaseScope{*this, &ParseStats::metaTime};
+        parseMetaLine(line);
+    }
+    if (not isMetaOnly) parsePatchLine(line);
+
+    curLineNum++;
+    return not isDone;
+}
+
+auto PatchTextParser::feed(std::string_view chunk) -> bool {
+    while (not isDone) {
+        auto lineEndPos = chunk.find('\n');
+        if (lineEndPos == std::string_view::npos) {
+            pendingLine.append(chunk);
+            break;
         }
 
-        curLineNum++;
+        pendingLine.append(chunk.substr(0, lineEndPos));
+        chunk.remove_prefix(lineEndPos + 1);
+        parseLine(pendingLine);
+        pendingLine.clear();
     }
+    return not isDone;
+}
 
-    // add last patch and collection
-    if (not curPatch.contents.empty()) {
-        curPatchCollection.patches.push_back(curPatch);
-        logOs << "L" << curLineNum << ": patch read: " << curPatch.name << std::endl;
+auto PatchTextParser::finish() -> bool {
+    // the last line may not have a line break
+    if (not pendingLine.empty()) {
+        parseLine(pendingLine);
+        pendingLine.clear();
     }
-    if (not curPatchCollection.patches.empty()) {
-        result.collections.push_back(curPatchCollection);
-        if (logDebugInfo)
-            logOs << "L" << curLineNum << ": parsing completed for " << curPatchCollection.buildId << std::endl;
+
+    if (not isDone) {
+        if (isParsingMeta) {
+            auto metaScope = PhaseScope{*this, &ParseStats::metaTime};
+            log(DIAGNOSTIC_INFO, 0, "meta parsing reached end of file");
+            endMeta();
+        }
+        if (not isMetaOnly) {
+            log(DIAGNOSTIC_INFO, 0, "done parsing patches");
+            complete();
+        }
+        isDone = true;
     }
+    return not hasError;
+}
 
-    return result;
+void PatchTextParser::parseMetaLine(std::string& line) {
+    // meta should stop at an empty line
+    if (line.empty()) {
+        log(DIAGNOSTIC_INFO, curLineNum, "done parsing meta");
+        endMeta();
+        return;
+    }
+
+    auto lineNoComment = getLineNoComment(line);
+    auto lineLower = getStringToLowerCase(lineNoComment);
+
+    if (lineNoComment[0] == '@') {
+        auto curTag = firstToken(lineLower);
+        auto tagType = TAG_TYPES.find(curTag);
+        if (tagType == TAG_STOP) {
+            log(DIAGNOSTIC_INFO, 0, "done parsing meta (reached tag @stop)");
+            endMeta();
+            return;
+        }
+
+        auto* curTagValueTarget = tagType == TAG_TITLE        ? &meta.title
+                                  : tagType == TAG_PROGRAM_ID ? &meta.programId
+                                  : tagType == TAG_URL        ? &meta.url
+                                                              : nullptr;
+        if (curTagValueTarget != nullptr) {
+            auto curTagValue = lineNoComment.substr(curTag.size());
+            ltrim(curTagValue);
+            // strip quatation marks if necessary
+            if (curTagValue[0] == '"' and curTagValue[curTagValue.size() - 1] == '"') {
+                curTagValue = curTagValue.substr(1, curTagValue.size() - 2);
+            }
+            *curTagValueTarget = curTagValue;
+            log(DIAGNOSTIC_INFO, curLineNum, "meta: " + curTag + "=" + curTagValue);
+        }
+    } else if (lineNoComment[0] == '#') {  // echo identifier
+        log(DIAGNOSTIC_INFO, curLineNum, lineNoComment);
+        legacyTitle = lineNoComment.substr(1);
+        ltrim(legacyTitle);
+    }
 }
 
-auto getPchtxtMeta(std::istream& input) -> PatchTextMeta {
-    auto throwAwaySs = std::stringstream{};
-    return getPchtxtMeta(input, throwAwaySs);
+void PatchTextParser::endMeta() {
+    if (meta.title.empty()) {
+        meta.title = legacyTitle;
+        log(DIAGNOSTIC_INFO, 0, "using \"" + legacyTitle + "\" as legacy style title");
+    }
+
+    isParsingMeta = false;
+    if (isMetaOnly) isDone = true;
+    visitor.onMeta(meta);
+    Tracer::addSpan("meta", metaTraceBeginTime);
 }
 
-auto getPchtxtMeta(std::istream& input, std::ostream& logOs) -> PatchTextMeta {
-    auto result = PatchTextMeta{};
-    auto tagToValueMap = std::unordered_map<std::string_view, std::string&>{
-        {TITLE_TAG, result.title}, {PROGRAM_ID_TAG, result.programId}, {URL_TAG, result.url}};
+void PatchTextParser::parsePatchLine(std::string& line) {
+    auto lineNoComment = getLineNoComment(line);
+    auto lineNoCommentLower = getStringToLowerCase(lineNoComment);
 
-    auto legacyTitle = std::string{};
+    switch (line[0]) {
+        case '@': {  // tags
+            parseTag(lineNoComment, lineNoCommentLower);
+            break;
+        }
+
+        case '#': {  // echo identifier
+            if (not isParsingMeta) log(DIAGNOSTIC_INFO, curLineNum, line);  // meta already echoed it
+            break;
+        }
+
+        case AMS_CHEAT_IDENTIFIER_OPEN[0]: {  // AMS cheat
+            // store current
+            if (curBuildId.isEmpty()) {
+                fail("ERROR: missing build id, abort parsing");
+                return;
+            }
+
+            if (curPatchHasContents) endPatch();
+
+            // start new patch
+            auto amsCheatName = lineNoComment.substr(1, lineNoComment.rfind(AMS_CHEAT_IDENTIFIER_CLOSE) - 1);
+            trim(amsCheatName);
+            curPatch = Patch{amsCheatName, {}, AMS, true, curLineNum, {}};
+
+            if (logDebugInfo) log(DIAGNOSTIC_DEBUG, curLineNum, "parsing AMS cheat: " + std::string(curPatch.name));
 
-    auto curLineNum = 1;
-    auto line = std::string{};
-    while (true) {
-        if (not std::getline(input, line)) {
-            logOs << "meta parsing reached end of file" << std::endl;
             break;
         }
-        trim(line);
 
-        // meta should stop at an empty line
-        if (line.empty()) {
-            logOs << "L" << curLineNum << ": done parsing meta" << std::endl;
+        case '/': {  // comment identifier
+            lastCommentLine = getLineCommentContent(line);
             break;
         }
 
-        line = getLineNoComment(line);
-        auto lineLower = getStringToLowerCase(line);
+        default: {
+            if (not isAcceptingPatch) break;
 
-        if (line[0] == '@') {
-            auto curTag = firstToken(lineLower);
-            if (curTag == STOP_PARSING_TAG) {
-                logOs << "done parsing meta (reached tag @stop)" << std::endl;
+            // skip empty lines
+            if (line.empty()) {
                 break;
             }
 
-            auto curTagFound = tagToValueMap.find(curTag);
-            if (curTagFound != end(tagToValueMap)) {
-                auto curTagValue = line.substr(curTag.size());
-                ltrim(curTagValue);
-                // strip quatation marks if necessary
-                if (curTagValue[0] == '"' and curTagValue[curTagValue.size() - 1] == '"') {
-                    curTagValue = curTagValue.substr(1, curTagValue.size() - 2);
+            parseContent(line, lineNoComment, lineNoCommentLower);
+        }
+    }
+}
+
+void PatchTextParser::parseTag(std::string& lineNoComment, std::string& lineNoCommentLower) {
+    auto curTag = firstToken(lineNoCommentLower);
+    auto tagType = TAG_TYPES.find(curTag);
+
+    if (tagType == TAG_STOP) {  // stop parsing
+        log(DIAGNOSTIC_INFO, curLineNum, "done parsing patches (reached tag @stop)");
+        complete();
+        isDone = true;
+
+    } else if (tagType == TAG_ENABLED or tagType == TAG_DISABLED) {  // start of a new patch
+        // store current
+        if (curBuildId.isEmpty()) {
+            fail("ERROR: missing build id, abort parsing");
+            return;
+        }
+
+        if (curPatchHasContents) {
+            endPatch();
+            // start new patch
+            curPatch = Patch{};
+        }
+
+        if (tagType == TAG_ENABLED) {
+            curPatch.enabled = true;
+        } else {
+            curPatch.enabled = false;
+        }
+
+        curPatch.lineNum = curLineNum;
+
+        if (curPatch.type != AMS) {  // don't use last comment on AMS style patch titles
+            // extract name and author from last comment
+            auto authorStartPos = lastCommentLine.rfind(AUTHOR_IDENTIFIER_OPEN);
+            auto authorEndPos = lastCommentLine.rfind(AUTHOR_IDENTIFIER_CLOSE);
+            auto patchName = lastCommentLine.substr(0, authorStartPos);
+            rtrim(patchName);
+            auto author = authorStartPos != std::string::npos
+                              ? lastCommentLine.substr(authorStartPos + 1, authorEndPos - authorStartPos - 1)
+                              : std::string{};
+            trim(author);
+            curPatch.name = patchName;
+            curPatch.author = author;
+        }
+
+        // check patch type
+        auto lineAfterTag = lineNoCommentLower.substr(curTag.size());
+        ltrim(lineAfterTag);
+        auto patchType = PATCH_TYPES.find(firstToken(lineAfterTag));
+        if (patchType) curPatch.type = *patchType;
+
+        isAcceptingPatch = true;
+
+        if (logDebugInfo) log(DIAGNOSTIC_DEBUG, curLineNum, "parsing patch: " + std::string(curPatch.name));
+
+    } else if (tagType == TAG_FLAG) {  // parse flag
+        auto flagContent = lineNoComment.substr(curTag.size());
+        ltrim(flagContent);
+        auto flagType = firstToken(flagContent);
+        ltrim(flagType);
+        auto flagValue = flagContent.substr(flagType.size());
+        ltrim(flagValue);
+        flagType = getStringToLowerCase(flagType);
+        auto flag = FLAG_TYPES.find(flagType);
+
+        if (flag == FLAG_BIG_ENDIAN) {
+            curIsBigEndian = true;
+
+        } else if (flag == FLAG_LITTLE_ENDIAN) {
+            curIsBigEndian = false;
+
+        } else if (flag == FLAG_NSOBID or flag == FLAG_NROBID) {
+            // wrap up last bid collection
+            if (curPatchHasContents) endPatch();
+            curPatch = Patch{};
+            endCollection();
+
+            auto buildId = BuildId::fromHex(flagValue);
+            if (not buildId) {
+                fail("ERROR: invalid build id: " + flagValue);
+                return;
+            }
+
+            beginCollection(*buildId, flag == FLAG_NROBID ? NRO : NSO);
+            isAcceptingPatch = false;  // don't accept anymore patches since we just started new bid
+
+            if (logDebugInfo) log(DIAGNOSTIC_DEBUG, curLineNum, "parsing started for " + curBuildId.toString());
+
+        } else if (flag == FLAG_OFFSET_SHIFT) {
+            curOffsetShift = std::stoi(flagValue, nullptr, 0);
+            if (logDebugInfo)
+                log(DIAGNOSTIC_DEBUG, curLineNum, "offset shift is now " + std::to_string(curOffsetShift));
+
+        } else if (flag == FLAG_DEBUG_INFO) {
+            logDebugInfo = true;
+            log(DIAGNOSTIC_INFO, curLineNum, "additional debug info enabled");
+
+        } else {
+            log(DIAGNOSTIC_WARNING, curLineNum, "WARNING ignored unrecognized flag type: " + flagType);
+        }
+
+    } else if (isStartsWith(lineNoCommentLower, NSOBID_TAG)) {  // legacy style nsobid
+        if (not(lineNoCommentLower.size() > std::string_view(NSOBID_TAG).size() + 1)) {
+            fail("ERROR: legacy nsobid tag missing value");
+            return;
+        }
+        auto buildIdStr = lineNoComment.substr(std::string_view(NSOBID_TAG).size() + 1);
+        ltrim(buildIdStr);
+        auto buildId = BuildId::fromHex(buildIdStr);
+        if (not buildId) {
+            fail("ERROR: invalid build id: " + buildIdStr);
+            return;
+        }
+
+        // legacy style relabels the collection being read, with the patches already in it and the one being read
+        if (isCollectionOpen) {
+            curBuildId = *buildId;
+            auto collectionMergeScope = PhaseScope{*this, &ParseStats::collectionMergeTime};
+            visitor.onCollectionBuildIdChange(curBuildId, NSO);
+        } else {
+            beginCollection(*buildId, NSO);
+        }
+
+        if (logDebugInfo)
+            log(DIAGNOSTIC_DEBUG, curLineNum, "parsing started for " + curBuildId.toString() + " (legacy style bid)");
+
+    } else if (not tagType) {  // check if tag is bad
+        log(DIAGNOSTIC_WARNING, curLineNum, "WARNING ignored unrecognized tag: " + curTag);
+    }
+}
+
+void PatchTextParser::parseContent(std::string& line, std::string& lineNoComment, std::string& lineNoCommentLower) {
+    curValue.clear();
+
+    // parse patch contents
+    if (curPatch.type == AMS) {  // for AMS cheats, just add line as plain text
+        curValue.assign(begin(lineNoComment), end(lineNoComment));
+        addContent(0);
+
+        if (logDebugInfo) log(DIAGNOSTIC_DEBUG, curLineNum, "AMS cheat: " + lineNoComment);
+        return;
+    }
+
+    // parse values
+    auto offsetStr = firstToken(lineNoCommentLower);
+    auto valueStr = lineNoCommentLower.substr(offsetStr.size());
+
+    // check offset
+    if (not stringIsHex(offsetStr)) {
+        if (logDebugInfo) log(DIAGNOSTIC_DEBUG, curLineNum, "line ignored: invalid offset: " + line);
+        return;
+    }
+    trimZeros(offsetStr);
+    if (offsetStr.size() > 8) {
+        fail("ERROR: offset: " + offsetStr + " out of range");
+        return;
+    }
+
+    auto offset = static_cast<uint32_t>(std::stoul(offsetStr, nullptr, 16)) + curOffsetShift;
+
+    // parse value
+    ltrim(valueStr);
+    if (valueStr[0] == '"') {  // string patch
+        auto stringEscapeScope = PhaseScope{*this, &ParseStats::stringEscapeTime};
+        auto closingPosSearch = begin(valueStr);
+        while (true) {  // find string closing pos
+            closingPosSearch++;
+
+            if ((closingPosSearch = std::find(closingPosSearch, end(valueStr), '"')) == end(valueStr)) {
+                fail("ERROR: cannot find string closing: " + valueStr);
+                return;
+            }
+
+            if (*(closingPosSearch - 1) != '\\') {
+                break;
+            }
+        }
+
+        // escape chars
+        auto stringValueStr = std::string{begin(valueStr) + 1, closingPosSearch};
+        escapeString(stringValueStr);
+
+        curValue.assign(begin(stringValueStr), end(stringValueStr));
+        curValue.push_back('\0');
+
+    } else {  // hex values patch
+        auto hexDecodeScope = PhaseScope{*this, &ParseStats::hexDecodeTime};
+        while (true) {  // parse value token by token
+            // get next token
+            auto valueTokenStr = firstToken(valueStr);
+            valueStr = valueStr.substr(valueTokenStr.size());
+            ltrim(valueStr);
+            if (valueTokenStr.empty()) {
+                break;
+            }
+
+            // check token
+            if (valueTokenStr.size() % 2 != 0) {
+                fail("ERROR: bad length for hex values: " + valueTokenStr);
+                return;
+            }
+            if (not stringIsHex(valueTokenStr)) {
+                fail("ERROR: not valid hex values: " + valueTokenStr);
+                return;
+            }
+
+            // parse token value
+            if (curIsBigEndian) {
+                auto curBytePos = end(valueTokenStr);
+                while (curBytePos != begin(valueTokenStr)) {
+                    curBytePos -= 2;
+                    curValue.push_back(getHexByte(curBytePos));
+                }
+            } else {
+                for (auto curBytePos = begin(valueTokenStr); curBytePos != end(valueTokenStr); curBytePos += 2) {
+                    curValue.push_back(getHexByte(curBytePos));
                 }
-                curTagFound->second = curTagValue;
-                logOs << "L" << curLineNum << ": meta: " << curTag << "=" << curTagValue << std::endl;
             }
-        } else if (line[0] == '#') {  // echo identifier
-            logOs << "L" << curLineNum << ": " << line << std::endl;
-            legacyTitle = line.substr(1);
-            ltrim(legacyTitle);
         }
+    }
+
+    addContent(offset);
+
+    if (logDebugInfo) {
+        log(DIAGNOSTIC_DEBUG, curLineNum,
+            "offset: " + getOffsetString(offset) + " value: " + getHexString(curValue) +
+                " len: " + std::to_string(curValue.size()));
+    }
+}
+
+void PatchTextParser::beginCollection(const BuildId& buildId, TargetType targetType) {
+    curBuildId = buildId;
+    isCollectionOpen = true;
+    curCollectionHasPatches = false;
+    if (Tracer::isEnabled()) collectionTraceBeginTime = Tracer::now();
+
+    if (stats != nullptr) {
+        stats->collectionCount++;
+        if (std::find(begin(seenBuildIds), end(seenBuildIds), buildId) != end(seenBuildIds)) {
+            stats->mergedCollectionCount++;
+        } else {
+            seenBuildIds.push_back(buildId);
+        }
+    }
+    auto collectionMergeScope = PhaseScope{*this, &ParseStats::collectionMergeTime};
+    visitor.onCollectionBegin(curBuildId, targetType);
+}
+
+void PatchTextParser::endCollection() {
+    if (not isCollectionOpen) return;
 
-        curLineNum++;
+    {
+        auto collectionMergeScope = PhaseScope{*this, &ParseStats::collectionMergeTime};
+        visitor.onCollectionEnd();
     }
+    isCollectionOpen = false;
+    if (Tracer::isEnabled()) Tracer::addSpan("build id section", collectionTraceBeginTime, curBuildId.toString());
+
+    if (logDebugInfo and curCollectionHasPatches)
+        log(DIAGNOSTIC_DEBUG, curLineNum, "parsing stopped for " + curBuildId.toString());
+}
 
-    if (result.title.empty()) {
-        result.title = legacyTitle;
-        logOs << "using \"" << legacyTitle << "\" as legacy style title" << std::endl;
+void PatchTextParser::addContent(uint32_t offset) {
+    auto visitorScope = PhaseScope{*this, &ParseStats::visitorTime};
+    if (not curPatchHasContents) {
+        visitor.onPatchBegin(curPatch);
+        curPatchHasContents = true;
+        curCollectionHasPatches = true;
+        if (stats != nullptr) stats->patchCount++;
     }
+    visitor.onContent(offset, curValue);
+    if (stats != nullptr) stats->contentCount++;
+}
 
-    return result;
+void PatchTextParser::endPatch() {
+    {
+        auto visitorScope = PhaseScope{*this, &ParseStats::visitorTime};
+        visitor.onPatchEnd();
+    }
+    curPatchHasContents = false;
+    log(DIAGNOSTIC_INFO, curLineNum, "patch read: " + std::string(curPatch.name));
 }
 
-void writeIps(PatchCollection& patchCollection, std::ostream& ostream) {
+void PatchTextParser::complete() {
+    // add last patch and collection
+    if (curPatchHasContents) endPatch();
+    if (isCollectionOpen) {
+        {
+            auto collectionMergeScope = PhaseScope{*this, &ParseStats::collectionMergeTime};
+            visitor.onCollectionEnd();
+        }
+        isCollectionOpen = false;
+        if (Tracer::isEnabled()) Tracer::addSpan("build id section", collectionTraceBeginTime, curBuildId.toString());
+
+        if (logDebugInfo and curCollectionHasPatches)
+            log(DIAGNOSTIC_DEBUG, curLineNum, "parsing completed for " + curBuildId.toString());
+    }
+}
+
+void PatchTextParser::log(DiagnosticLevel level, int lineNum, const std::string& message) {
+    auto visitorScope = PhaseScope{*this, &ParseStats::visitorTime};
+    visitor.onDiagnostic(level, lineNum, message);
+}
+
+auto PatchTextParser::enterPhase(std::chrono::nanoseconds ParseStats::*phaseTime)
+    -> std::chrono::nanoseconds ParseStats::* {
+    if (stats == nullptr) return nullptr;  // the clock is never read without stats
+
+    auto now = std::chrono::steady_clock::now();
+    if (curPhaseTime != nullptr) stats->*curPhaseTime += now - curPhaseStartTime;
+    auto outerPhaseTime = curPhaseTime;
+    curPhaseTime = phaseTime;
+    curPhaseStartTime = now;
+    return outerPhaseTime;
+}
+
+void PatchTextParser::fail(const std::string& message) {
+    hasError = true;
+    isDone = true;
+    log(DIAGNOSTIC_ERROR, curLineNum, message);
+}
+
+// not utils
+
+auto parsePchtxt(std::istream& input) -> PatchTextOutput {
+    auto builder = PatchTextOutputBuilder{};
+    if (not parsePchtxt(input, builder)) return {};
+    return std::move(builder.output);
+}
+
+auto parsePchtxt(std::istream& input, std::ostream& logOs) -> PatchTextOutput {
+    auto builder = PatchTextOutputBuilder{logOs};
+    if (not parsePchtxt(input, builder)) return {};
+    return std::move(builder.output);
+}
+
+auto parsePchtxt(std::istream& input, StringPool& stringPool) -> PatchTextOutput {
+    auto builder = PatchTextOutputBuilder{stringPool};
+    if (not parsePchtxt(input, builder)) return {};
+    return std::move(builder.output);
+}
+
+auto parsePchtxt(std::istream& input, std::ostream& logOs, StringPool& stringPool) -> PatchTextOutput {
+    auto builder = PatchTextOutputBuilder{logOs, stringPool};
+    if (not parsePchtxt(input, builder)) return {};
+    return std::move(builder.output);
+}
+
+auto parsePchtxt(std::istream& input, std::pmr::memory_resource* resource) -> PatchTextOutput {
+    auto builder = PatchTextOutputBuilder{resource};
+    if (not parsePchtxt(input, builder)) return PatchTextOutput{{}, std::pmr::list<PatchCollection>{resource}};
+    return std::move(builder.output);
+}
+
+auto parsePchtxt(std::istream& input, std::ostream& logOs, std::pmr::memory_resource* resource) -> PatchTextOutput {
+    auto builder = PatchTextOutputBuilder{logOs, resource};
+    if (not parsePchtxt(input, builder)) return PatchTextOutput{{}, std::pmr::list<PatchCollection>{resource}};
+    return std::move(builder.output);
+}
+
+// counts what this thread allocates, so a parse can be measured while others run. Never destroyed, outputs may
+// outlive every static
+class AllocationCountingResource : public std::pmr::memory_resource {
+   public:
+    static auto get() -> AllocationCountingResource& {
+        static auto* instance = new AllocationCountingResource{};
+        return *instance;
+    }
+
+    static thread_local uint64_t threadAllocationCount;
+    static thread_local uint64_t threadAllocatedBytes;
+
+   private:
+    auto do_allocate(size_t bytes, size_t alignment) -> void* override {
+        threadAllocationCount++;
+        threadAllocatedBytes += bytes;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* ptr, size_t bytes, size_t alignment) override {
+        std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+    }
+
+    auto do_is_equal(const std::pmr::memory_resource& other) const noexcept -> bool override { return this == &other; }
+};
+
+thread_local uint64_t AllocationCountingResource::threadAllocationCount = 0;
+thread_local uint64_t AllocationCountingResource::threadAllocatedBytes = 0;
+
+auto parsePchtxt(std::istream& input, ParseStats& stats) -> PatchTextOutput {
+    auto throwAwaySs = std::stringstream{};
+    return parsePchtxt(input, throwAwaySs, stats);
+}
+
+auto parsePchtxt(std::istream& input, std::ostream& logOs, ParseStats& stats) -> PatchTextOutput {
+    auto allocationCountBefore = AllocationCountingResource::threadAllocationCount;
+    auto allocatedBytesBefore = AllocationCountingResource::threadAllocatedBytes;
+
+    auto builder = PatchTextOutputBuilder{logOs, &AllocationCountingResource::get()};
+    auto isParsedOk = parsePchtxt(input, builder, stats);
+
+    stats.resourceAllocationCount += AllocationCountingResource::threadAllocationCount - allocationCountBefore;
+    stats.resourceAllocatedBytes += AllocationCountingResource::threadAllocatedBytes - allocatedBytesBefore;
+    if (not isParsedOk) return {};
+    return std::move(builder.output);
+}
+
+auto parsePchtxt(std::istream& input, PatchTextVisitor& visitor) -> bool {
+    auto traceSpan = TraceSpan{"parse pchtxt"};
+    auto parser = PatchTextParser{visitor};
+    auto line = std::string{};
+    while (std::getline(input, line)) {
+        if (not parser.parseLine(line)) break;
+    }
+    return parser.finish();
+}
+
+auto parsePchtxt(std::istream& input, PatchTextVisitor& visitor, ParseStats& stats) -> bool {
+    auto traceSpan = TraceSpan{"parse pchtxt"};
+    auto parser = PatchTextParser{visitor, stats};
+    auto line = std::string{};
+    while (std::getline(input, line)) {
+        if (not parser.parseLine(line)) break;
+    }
+    return parser.finish();
+}
+
+// stats
+
+auto ParseStats::operator+=(const ParseStats& other) -> ParseStats& {
+    bytesRead += other.bytesRead;
+    linesRead += other.linesRead;
+    metaTime += other.metaTime;
+    tokenizeTime += other.tokenizeTime;
+    hexDecodeTime += other.hexDecodeTime;
+    stringEscapeTime += other.stringEscapeTime;
+    collectionMergeTime += other.collectionMergeTime;
+    visitorTime += other.visitorTime;
+    patchCount += other.patchCount;
+    contentCount += other.contentCount;
+    collectionCount += other.collectionCount;
+    mergedCollectionCount += other.mergedCollectionCount;
+    resourceAllocationCount += other.resourceAllocationCount;
+    resourceAllocatedBytes += other.resourceAllocatedBytes;
+    return *this;
+}
+
+inline void writePrometheusHeader(std::ostream& ostream, const std::string& metricName, const char* help) {
+    ostream << "# HELP " << metricName << ' ' << help << "\n# TYPE " << metricName << " counter\n";
+}
+
+void writePrometheus(const ParseStats& stats, std::ostream& ostream, std::string_view metricPrefix) {
+    auto prefix = std::string(metricPrefix) + '_';
+    auto writeCounter = [&](const char* name, const char* help, uint64_t value) {
+        auto metricName = prefix + name;
+        writePrometheusHeader(ostream, metricName, help);
+        ostream << metricName << ' ' << value << '\n';
+    };
+
+    writeCounter("bytes_total", "Bytes of Patch Text read.", stats.bytesRead);
+    writeCounter("lines_total", "Lines of Patch Text read.", stats.linesRead);
+
+    auto phaseMetricName = prefix + "phase_seconds_total";
+    writePrometheusHeader(ostream, phaseMetricName, "Time spent in each parsing phase.");
+    for (auto [phase, phaseTime] : {std::make_pair("meta", stats.metaTime),
+                                    std::make_pair("tokenize", stats.tokenizeTime),
+                                    std::make_pair("hex_decode", stats.hexDecodeTime),
+                                    std::make_pair("string_escape", stats.stringEscapeTime),
+                                    std::make_pair("collection_merge", stats.collectionMergeTime),
+                                    std::make_pair("visitor", stats.visitorTime)}) {
+        ostream << phaseMetricName << "{phase=\"" << phase << "\"} "
+                << std::chrono::duration<double>(phaseTime).count() << '\n';
+    }
+
+    writeCounter("patches_total", "Patches read.", stats.patchCount);
+    writeCounter("contents_total", "Patch contents read.", stats.contentCount);
+    writeCounter("collections_total", "Build id sections read.", stats.collectionCount);
+    writeCounter("merged_collections_total", "Build id sections merged into an earlier one.",
+                 stats.mergedCollectionCount);
+    writeCounter("resource_allocations_total", "Allocations made through the memory resource of parsed outputs.",
+                 stats.resourceAllocationCount);
+    writeCounter("resource_allocated_bytes_total", "Bytes allocated through the memory resource of parsed outputs.",
+                 stats.resourceAllocatedBytes);
+}
+
+// patch reader
+
+void PatchReader::EntryCollector::onMeta(const PatchTextMeta& meta) {
+    this->meta = meta;
+    isMetaRead = true;
+}
+
+void PatchReader::EntryCollector::onCollectionBegin(const BuildId& buildId, TargetType targetType) {
+    curEntry.buildId = buildId;
+    curEntry.targetType = targetType;
+}
+
+void PatchReader::EntryCollector::onCollectionBuildIdChange(const BuildId& buildId, TargetType targetType) {
+    onCollectionBegin(buildId, targetType);  // entries already read were handed out with the old bid
+}
+
+void PatchReader::EntryCollector::onPatchBegin(const Patch& patch) { curEntry.patch = patch; }
+
+void PatchReader::EntryCollector::onContent(uint32_t offset, const std::vector<uint8_t>& value) {
+    curEntry.patch.contents.push_back({offset, value});
+}
+
+void PatchReader::EntryCollector::onPatchEnd() {
+    readyEntries.push_back(curEntry);
+    curEntry.patch = Patch{};
+}
+
+void PatchReader::EntryCollector::onDiagnostic(DiagnosticLevel, int lineNum, const std::string& message) {
+    writeLog(logOs, lineNum, message);
+}
+
+PatchReader::PatchReader(std::istream& input) : input(input), parser(collector) {}
+
+PatchReader::PatchReader(std::istream& input, std::ostream& logOs) : input(input), parser(collector) {
+    collector.logOs = &logOs;
+}
+
+auto PatchReader::begin() -> iterator {
+    if (not readUntilEntry()) return end();
+    return iterator{this};
+}
+
+auto PatchReader::readUntilEntry() -> bool {
+    // patches can be read before a meta section that is not ended by an empty line, which getMeta has to wait for
+    while ((collector.readyEntries.empty() or not collector.isMetaRead) and not isInputDone) {
+        if (not std::getline(input, line) or not parser.parseLine(line)) {
+            isParsedOk = parser.finish();
+            isInputDone = true;
+        }
+    }
+    return not collector.readyEntries.empty();
+}
+
+auto PatchReader::next() -> bool {
+    collector.readyEntries.pop_front();
+    return readUntilEntry();
+}
+
+auto patches(std::istream& input) -> PatchReader { return PatchReader{input}; }
+
+auto patches(std::istream& input, std::ostream& logOs) -> PatchReader { return PatchReader{input, logOs}; }
+
+auto getPchtxtMeta(std::istream& input) -> PatchTextMeta {
+    auto throwAwaySs = std::stringstream{};
+    return getPchtxtMeta(input, throwAwaySs);
+}
+
+auto getPchtxtMeta(std::istream& input, std::ostream& logOs) -> PatchTextMeta {
+    auto metaReader = PatchTextMetaReader{&logOs};
+    auto parser = PatchTextParser{metaReader, true};
+    auto line = std::string{};
+    while (std::getline(input, line)) {
+        if (not parser.parseLine(line)) break;
+    }
+    parser.finish();
+    return metaReader.result;
+}
+
+template <typename IsEnabled>
+void writeIpsPatches(const PatchCollection& patchCollection, IsEnabled isEnabled, std::ostream& ostream) {
+    auto traceSpan = TraceSpan{"write IPS"};
+    if (traceSpan.isRecording()) traceSpan.setDetail(patchCollection.buildId.toString());
     ostream.write(IPS32_HEADER_MAGIC, std::strlen(IPS32_HEADER_MAGIC));
+    auto patchIdx = size_t{0};
     for (auto& patch : patchCollection.patches) {
-        if (patch.type != BIN or patch.enabled == false) continue;
+        if (not isEnabled(patch, patchIdx++) or patch.type != BIN) continue;
         for (auto& patchContent : patch.contents) {
             for (auto rightShift : {3, 2, 1, 0}) {
                 auto byteToWrite = static_cast<char>((patchContent.offset >> rightShift * 8) & 0xFF);
@@ -601,10 +1244,406 @@ void writeIps(PatchCollection& patchCollection, std::ostream& ostream) {
                 auto byteToWrite = static_cast<char>((patchContent.value.size() >> rightShift * 8) & 0xFF);
                 ostream.write(&byteToWrite, 1);
             }
-            ostream.write(reinterpret_cast<char*>(patchContent.value.data()), patchContent.value.size());
+            ostream.write(reinterpret_cast<const char*>(patchContent.value.data()), patchContent.value.size());
         }
     }
     ostream.write(IPS32_FOOTER_MAGIC, std::strlen(IPS32_FOOTER_MAGIC));
 }
 
+void writeIps(PatchCollection& patchCollection, std::ostream& ostream) {
+    writeIpsPatches(
+        patchCollection, [](const Patch& patch, size_t) { return patch.enabled; }, ostream);
+}
+
+void writeIps(const PatchCollection& patchCollection, const PatchEnabledSet& enabledSet, std::ostream& ostream) {
+    writeIpsPatches(
+        patchCollection, [&enabledSet](const Patch&, size_t patchIdx) { return enabledSet.isEnabled(patchIdx); },
+        ostream);
+}
+
+// pchtxt writing
+
+constexpr auto HEX_BYTE_TABLE = [] {
+    constexpr auto HEX_DIGITS = "0123456789ABCDEF";
+    auto table = std::array<char, 0x200>{};
+    for (auto byte = 0; byte < 0x100; byte++) {
+        table[byte * 2] = HEX_DIGITS[byte >> 4];
+        table[byte * 2 + 1] = HEX_DIGITS[byte & 0xF];
+    }
+    return table;
+}();
+
+// string patches are lowercased when parsed, and a backslash can not come right before the closing quote
+inline auto isStringValue(const PatchContentValue& value) {
+    if (value.size() < 2 or value.back() != '\0' or value[value.size() - 2] == '\\') return false;
+    return std::all_of(value.begin(), value.end() - 1, [](uint8_t byte) {
+        return (byte >= 0x20 and byte < 0x7F and not(byte >= 'A' and byte <= 'Z')) or
+               (byte >= '\a' and byte <= '\r');  // escapable control characters
+    });
+}
+
+inline auto getEscapeChar(uint8_t byte) -> char {
+    switch (byte) {
+        case '\a':
+            return 'a';
+        case '\b':
+            return 'b';
+        case '\f':
+            return 'f';
+        case '\n':
+            return 'n';
+        case '\r':
+            return 'r';
+        case '\t':
+            return 't';
+        case '\v':
+            return 'v';
+        case '"':
+        case '\\':
+            return static_cast<char>(byte);
+        default:
+            return '\0';
+    }
+}
+
+/**
+ * Formats Patch Text into a Writer, which is either a size counter or a pre-sized buffer, so the exact size can be
+ * computed with the same code that writes
+ */
+template <typename Writer>
+class PchtxtFormatter {
+   public:
+    explicit PchtxtFormatter(Writer& writer) : writer(writer) {}
+
+    void formatMeta(const PatchTextMeta& meta) {
+        formatMetaTag(TITLE_TAG, meta.title);
+        formatMetaTag(PROGRAM_ID_TAG, meta.programId);
+        formatMetaTag(URL_TAG, meta.url);
+        writer.put('\n');  // an empty line ends the meta
+    }
+
+    // enabled flags are taken from the patches without an enabled set
+    void formatCollection(const PatchCollection& patchCollection, const PatchEnabledSet* enabledSet = nullptr) {
+        if (hasCollection) writer.put('\n');
+        hasCollection = true;
+
+        writer.put(FLAG_TAG);
+        writer.put(' ');
+        writer.put(patchCollection.targetType == NRO ? NROBID_FLAG : NSOBID_FLAG);
+        writer.put(' ');
+        writer.put(patchCollection.buildId.toString());
+        writer.put('\n');
+
+        auto patchIdx = size_t{0};
+        for (auto& patch : patchCollection.patches) {
+            formatPatch(patch, enabledSet ? enabledSet->isEnabled(patchIdx++) : patch.enabled);
+        }
+    }
+
+   private:
+    void formatMetaTag(const char* tag, const std::string& value) {
+        if (value.empty()) return;
+        // quoted, so slashes in urls are not taken as comments
+        writer.put(tag);
+        writer.put(" \"");
+        writer.put(value);
+        writer.put("\"\n");
+    }
+
+    void formatPatch(const Patch& patch, bool isEnabled) {
+        writer.put('\n');
+        if (patch.type == AMS) {
+            writer.put(AMS_CHEAT_IDENTIFIER_OPEN);
+            writer.put(patch.name);
+            writer.put(AMS_CHEAT_IDENTIFIER_CLOSE);
+        } else {
+            // always written, otherwise the patch would take the name of the comment before it
+            writer.put(COMMENT_IDENTIFIER);
+            writer.put(COMMENT_IDENTIFIER);
+            writer.put(' ');
+            writer.put(patch.name);
+            if (not patch.author.empty() or patch.name.str().find(AUTHOR_IDENTIFIER_OPEN) != std::string::npos) {
+                writer.put(' ');
+                writer.put(AUTHOR_IDENTIFIER_OPEN);
+                writer.put(patch.author);
+                writer.put(AUTHOR_IDENTIFIER_CLOSE);
+            }
+        }
+        writer.put('\n');
+
+        writer.put(isEnabled ? ENABLED_TAG : DISABLED_TAG);
+        if (patch.type == HEAP) {
+            writer.put(' ');
+            writer.put(PATCH_TYPE_HEAP);
+        } else if (patch.type == AMS) {
+            writer.put(' ');
+            writer.put(PATCH_TYPE_AMS);
+        }
+        writer.put('\n');
+
+        for (auto& patchContent : patch.contents) {
+            if (patch.type == AMS) {
+                writer.put(patchContent.value.data(), patchContent.value.size());
+            } else {
+                formatOffset(patchContent.offset);
+                writer.put(' ');
+                if (isStringValue(patchContent.value)) {
+                    formatString(patchContent.value);
+                } else {
+                    formatHex(patchContent.value.data(), patchContent.value.size());
+                }
+            }
+            writer.put('\n');
+        }
+    }
+
+    void formatOffset(uint32_t offset) {
+        uint8_t offsetBytes[] = {static_cast<uint8_t>(offset >> 24), static_cast<uint8_t>(offset >> 16),
+                                 static_cast<uint8_t>(offset >> 8), static_cast<uint8_t>(offset)};
+        formatHex(offsetBytes, sizeof(offsetBytes));
+    }
+
+    void formatHex(const uint8_t* bytes, size_t size) {
+        auto hexChars = writer.reserve(size * 2);
+        if (hexChars == nullptr) return;  // only counting
+        for (auto byteIdx = size_t{0}; byteIdx < size; byteIdx++) {
+            std::memcpy(hexChars + byteIdx * 2, &HEX_BYTE_TABLE[bytes[byteIdx] * 2], 2);
+        }
+    }
+
+    void formatString(const PatchContentValue& value) {
+        writer.put('"');
+        for (auto byteIter = value.begin(); byteIter != value.end() - 1; byteIter++) {  // without the null terminator
+            auto escapeChar = getEscapeChar(*byteIter);
+            if (escapeChar != '\0') {
+                writer.put('\\');
+                writer.put(escapeChar);
+            } else {
+                writer.put(static_cast<char>(*byteIter));
+            }
+        }
+        writer.put('"');
+    }
+
+    Writer& writer;
+    bool hasCollection = false;
+};
+
+class SizeCountingWriter {
+   public:
+    void put(char) { size++; }
+    void put(const char* str) { size += std::strlen(str); }
+    void put(std::string_view str) { size += str.size(); }
+    void put(const uint8_t*, size_t dataSize) { size += dataSize; }
+    auto reserve(size_t reservedSize) -> char* {
+        size += reservedSize;
+        return nullptr;
+    }
+
+    size_t size = 0;
+};
+
+class BufferWriter {
+   public:
+    explicit BufferWriter(char* buffer) : curPos(buffer) {}
+
+    void put(char ch) { *curPos++ = ch; }
+    void put(const char* str) { put(reinterpret_cast<const uint8_t*>(str), std::strlen(str)); }
+    void put(std::string_view str) { put(reinterpret_cast<const uint8_t*>(str.data()), str.size()); }
+    void put(const uint8_t* data, size_t dataSize) {
+        std::memcpy(curPos, data, dataSize);
+        curPos += dataSize;
+    }
+    auto reserve(size_t reservedSize) -> char* {
+        auto reservedPos = curPos;
+        curPos += reservedSize;
+        return reservedPos;
+    }
+
+   private:
+    char* curPos;
+};
+
+template <typename Format>
+auto formatIntoBuffer(Format format) {
+    auto sizeCounter = SizeCountingWriter{};
+    auto countingFormatter = PchtxtFormatter<SizeCountingWriter>{sizeCounter};
+    format(countingFormatter);
+
+    auto result = std::string(sizeCounter.size, '\0');
+    auto bufferWriter = BufferWriter{result.data()};
+    auto bufferFormatter = PchtxtFormatter<BufferWriter>{bufferWriter};
+    format(bufferFormatter);
+    return result;
+}
+
+auto formatPchtxt(const PatchTextOutput& patchTextOutput) -> std::string {
+    return formatIntoBuffer([&patchTextOutput](auto& formatter) {
+        formatter.formatMeta(patchTextOutput.meta);
+        for (auto& patchCollection : patchTextOutput.collections) formatter.formatCollection(patchCollection);
+    });
+}
+
+auto formatPchtxt(const PatchTextOutput& patchTextOutput, const PatchEnabledOverlay& enabledOverlay) -> std::string {
+    return formatIntoBuffer([&patchTextOutput, &enabledOverlay](auto& formatter) {
+        formatter.formatMeta(patchTextOutput.meta);
+        auto collectionIdx = size_t{0};
+        for (auto& patchCollection : patchTextOutput.collections) {
+            formatter.formatCollection(patchCollection, &enabledOverlay.getCollection(collectionIdx++));
+        }
+    });
+}
+
+auto formatPchtxt(const PatchCollection& patchCollection) -> std::string {
+    return formatIntoBuffer([&patchCollection](auto& formatter) { formatter.formatCollection(patchCollection); });
+}
+
+auto formatPchtxt(const PatchCollection& patchCollection, const PatchEnabledSet& enabledSet) -> std::string {
+    return formatIntoBuffer(
+        [&patchCollection, &enabledSet](auto& formatter) { formatter.formatCollection(patchCollection, &enabledSet); });
+}
+
+void writePchtxt(const PatchTextOutput& patchTextOutput, std::ostream& ostream) {
+    auto pchtxtStr = formatPchtxt(patchTextOutput);
+    ostream.write(pchtxtStr.data(), pchtxtStr.size());
+}
+
+void writePchtxt(const PatchTextOutput& patchTextOutput, const PatchEnabledOverlay& enabledOverlay,
+                 std::ostream& ostream) {
+    auto pchtxtStr = formatPchtxt(patchTextOutput, enabledOverlay);
+    ostream.write(pchtxtStr.data(), pchtxtStr.size());
+}
+
+void writePchtxt(const PatchCollection& patchCollection, std::ostream& ostream) {
+    auto pchtxtStr = formatPchtxt(patchCollection);
+    ostream.write(pchtxtStr.data(), pchtxtStr.size());
+}
+
+void writePchtxt(const PatchCollection& patchCollection, const PatchEnabledSet& enabledSet, std::ostream& ostream) {
+    auto pchtxtStr = formatPchtxt(patchCollection, enabledSet);
+    ostream.write(pchtxtStr.data(), pchtxtStr.size());
+}
+
+auto findPatchCollection(PatchTextOutput& patchTextOutput, const BuildId& buildId) -> PatchCollection* {
+    for (auto& patchCollection : patchTextOutput.collections) {
+        if (patchCollection.buildId == buildId) return &patchCollection;
+    }
+    return nullptr;
+}
+
+auto findPatchCollection(const PatchTextOutput& patchTextOutput, const BuildId& buildId) -> const PatchCollection* {
+    for (auto& patchCollection : patchTextOutput.collections) {
+        if (patchCollection.buildId == buildId) return &patchCollection;
+    }
+    return nullptr;
+}
+
+// normalizing
+
+void normalizePchtxt(PatchTextOutput& patchTextOutput) {
+    for (auto& patchCollection : patchTextOutput.collections) {
+        patchCollection.buildId = patchCollection.buildId.toCanonical();
+        for (auto& patch : patchCollection.patches) {
+            if (patch.type == AMS) continue;  // AMS contents are lines of text
+
+            auto curContent = begin(patch.contents);
+            while (curContent != end(patch.contents)) {
+                auto nextContent = std::next(curContent);
+                if (nextContent != end(patch.contents) and
+                    uint64_t{curContent->offset} + curContent->value.size() == nextContent->offset and
+                    curContent->value.size() + nextContent->value.size() <= IPS32_MAX_RECORD_SIZE) {
+                    curContent->value.append(nextContent->value.begin(), nextContent->value.end());
+                    patch.contents.erase(nextContent);
+                } else {
+                    curContent = nextContent;
+                }
+            }
+        }
+    }
+
+    // each collection is for a different binary, so their order does not matter
+    patchTextOutput.collections.sort([](const PatchCollection& lhs, const PatchCollection& rhs) {
+        return lhs.buildId < rhs.buildId or (lhs.buildId == rhs.buildId and lhs.targetType < rhs.targetType);
+    });
+}
+
+auto getCanonicalPchtxt(std::istream& input) -> std::string {
+    auto throwAwaySs = std::stringstream{};
+    return getCanonicalPchtxt(input, throwAwaySs);
+}
+
+auto getCanonicalPchtxt(std::istream& input, std::ostream& logOs) -> std::string {
+    auto builder = PatchTextOutputBuilder{logOs};
+    if (not parsePchtxt(input, builder)) return {};
+
+    normalizePchtxt(builder.output);
+    return formatPchtxt(builder.output);
+}
+
+// memory usage
+
+template <typename T>
+auto getListHeapSize(const std::pmr::list<T>& list) -> size_t {
+    auto result = list.size() * (getListNodeSize<T>() - sizeof(T));
+    for (auto& element : list) result += getMemoryUsage(element);
+    return result;
+}
+
+auto getMemoryUsage(const PatchContentValue& value) -> size_t {
+    return sizeof(value) + (value.isInline() ? 0 : value.capacity);
+}
+
+auto getMemoryUsage(const PatchContent& patchContent) -> size_t {
+    return sizeof(patchContent) - sizeof(patchContent.value) + getMemoryUsage(patchContent.value);
+}
+
+auto getMemoryUsage(const InternedString& internedString) -> size_t {
+    if (not internedString.isShared()) return sizeof(internedString);
+    auto* shared = internedString.getShared();
+    auto sharedSize = sizeof(InternedString::SharedChars) + shared->size + 1;
+    return sizeof(internedString) + sharedSize / shared->handleCount.load(std::memory_order_relaxed);
+}
+
+auto getMemoryUsage(const StringPool& stringPool) -> size_t {
+    constexpr auto MAP_NODE_SIZE = getMapNodeSize<decltype(stringPool.strings)>();
+
+    auto lock = std::lock_guard<std::mutex>{stringPool.mutex};
+    auto result = sizeof(stringPool) + stringPool.strings.bucket_count() * sizeof(void*) +
+                  stringPool.strings.size() * MAP_NODE_SIZE;
+    for (auto& [strView, internedStr] : stringPool.strings) {
+        result += getMemoryUsage(internedStr) - sizeof(internedStr);
+    }
+    return result;
+}
+
+auto getMemoryUsage(const Patch& patch) -> size_t {
+    return sizeof(patch) - sizeof(patch.name) - sizeof(patch.author) + getMemoryUsage(patch.name) +
+           getMemoryUsage(patch.author) + getListHeapSize(patch.contents);
+}
+
+auto getMemoryUsage(const PatchCollection& patchCollection) -> size_t {
+    return sizeof(patchCollection) + getListHeapSize(patchCollection.patches);
+}
+
+auto getMemoryUsage(const PatchTextMeta& meta) -> size_t {
+    return sizeof(meta) + getStringHeapSize(meta.title) + getStringHeapSize(meta.programId) +
+           getStringHeapSize(meta.url);
+}
+
+auto getMemoryUsage(const PatchTextOutput& patchTextOutput) -> size_t {
+    return sizeof(patchTextOutput) - sizeof(patchTextOutput.meta) + getMemoryUsage(patchTextOutput.meta) +
+           getListHeapSize(patchTextOutput.collections);
+}
+
+auto getMemoryUsage(const PatchEnabledSet& enabledSet) -> size_t {
+    return sizeof(enabledSet) + enabledSet.moreWords.capacity() * sizeof(uint64_t);
+}
+
+auto getMemoryUsage(const PatchEnabledOverlay& enabledOverlay) -> size_t {
+    auto result = sizeof(enabledOverlay) +
+                  (enabledOverlay.collections.capacity() - enabledOverlay.collections.size()) * sizeof(PatchEnabledSet);
+    for (auto& enabledSet : enabledOverlay.collections) result += getMemoryUsage(enabledSet);
+    return result;
+}
+
 }  // namespace pchtxt
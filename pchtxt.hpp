@@ -20,19 +20,104 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <initializer_list>
 #include <iostream>
+#include <iterator>
 #include <list>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 namespace pchtxt {
 
+/**
+ * Bytes of a patch content. Values up to INLINE_CAPACITY bytes, which covers one or two instructions, are stored
+ * inline without a heap allocation. Longer values are allocated from the memory resource given at construction.
+ * Copies use the default resource and moves take the resource along, like std::pmr containers
+ */
+class PatchContentValue {
+   public:
+    static constexpr auto INLINE_CAPACITY = size_t{16}; /*!< Largest size stored without a heap allocation */
+
+    PatchContentValue() = default;
+    explicit PatchContentValue(std::pmr::memory_resource* resource) : resource(resource) {}
+    PatchContentValue(const uint8_t* first, const uint8_t* last) { assign(first, last); }
+    PatchContentValue(const uint8_t* first, const uint8_t* last, std::pmr::memory_resource* resource)
+        : resource(resource) {
+        assign(first, last);
+    }
+    PatchContentValue(std::initializer_list<uint8_t> bytes) { assign(bytes.begin(), bytes.end()); }
+    PatchContentValue(const std::vector<uint8_t>& bytes) { assign(bytes.data(), bytes.data() + bytes.size()); }
+    PatchContentValue(const PatchContentValue& other) { assign(other.begin(), other.end()); }
+    PatchContentValue(PatchContentValue&& other) noexcept;
+    ~PatchContentValue();
+
+    auto operator=(const PatchContentValue& other) -> PatchContentValue&;
+    auto operator=(PatchContentValue&& other) noexcept -> PatchContentValue&;
+
+    /**
+     * Replaces the value with the bytes in [first, last)
+     */
+    void assign(const uint8_t* first, const uint8_t* last);
+
+    /**
+     * Adds the bytes in [first, last) to the end of the value
+     */
+    void append(const uint8_t* first, const uint8_t* last);
+
+    void clear() { valueSize = 0; }
+
+    auto data() -> uint8_t* { return isInline() ? inlineBytes : heapBytes; }
+    auto data() const -> const uint8_t* { return isInline() ? inlineBytes : heapBytes; }
+    auto size() const -> size_t { return valueSize; }
+    auto empty() const -> bool { return valueSize == 0; }
+    auto isInline() const -> bool { return capacity == INLINE_CAPACITY; }
+    auto getResource() const -> std::pmr::memory_resource* { return resource; }
+
+    auto begin() -> uint8_t* { return data(); }
+    auto begin() const -> const uint8_t* { return data(); }
+    auto end() -> uint8_t* { return data() + valueSize; }
+    auto end() const -> const uint8_t* { return data() + valueSize; }
+    auto back() const -> uint8_t { return data()[valueSize - 1]; }
+    auto operator[](size_t idx) -> uint8_t& { return data()[idx]; }
+    auto operator[](size_t idx) const -> uint8_t { return data()[idx]; }
+
+    auto operator==(const PatchContentValue& other) const -> bool {
+        return valueSize == other.valueSize and std::memcmp(data(), other.data(), valueSize) == 0;
+    }
+    auto operator!=(const PatchContentValue& other) const -> bool { return not(*this == other); }
+
+   private:
+    friend auto getMemoryUsage(const PatchContentValue& value) -> size_t;
+
+    void takeBytes(PatchContentValue& other);
+    void reserve(size_t newCapacity);
+
+    union {
+        uint8_t inlineBytes[INLINE_CAPACITY];
+        uint8_t* heapBytes;
+    };
+    uint32_t valueSize = 0;
+    uint32_t capacity = INLINE_CAPACITY;
+    std::pmr::memory_resource* resource = std::pmr::get_default_resource();
+};
+
 /**
  * The content patches
  */
 struct PatchContent {
-    uint32_t offset;            /*!< The offset to patch at. AMS cheats will have this be 0 */
-    std::vector<uint8_t> value; /*!< The value to be patched, in bytes, or plain text for AMS cheats */
+    uint32_t offset;         /*!< The offset to patch at. AMS cheats will have this be 0 */
+    PatchContentValue value; /*!< The value to be patched, in bytes, or plain text for AMS cheats */
 };
 
 /**
@@ -41,15 +126,111 @@ struct PatchContent {
 enum PatchType { BIN, HEAP, AMS };
 
 /**
- * One patch in the output
+ * Immutable string handle for text that repeats across many patches, such as author names. Half the size of a
+ * std::string: strings up to INLINE_CAPACITY are kept in the handle without an allocation, and longer ones are one
+ * shared, counted allocation. Strings interned by the same StringPool share that allocation, so copies of the handle
+ * and equality checks between them are pointer operations
+ */
+class InternedString {
+   public:
+    static constexpr auto INLINE_CAPACITY = size_t{14}; /*!< Longest string kept in the handle itself */
+
+    InternedString() = default;
+    InternedString(std::string_view str);
+    InternedString(const std::string& str) : InternedString(std::string_view(str)) {}
+    InternedString(const char* str) : InternedString(std::string_view(str)) {}
+    InternedString(const InternedString& other);
+    InternedString(InternedString&& other) noexcept;
+    auto operator=(InternedString other) noexcept -> InternedString&;
+    ~InternedString();
+
+    auto str() const -> std::string_view {
+        return isShared() ? std::string_view{getShared()->data(), getShared()->size}
+                          : std::string_view{bytes, static_cast<size_t>(bytes[TAG_POS])};
+    }
+    operator std::string_view() const { return str(); }
+    auto c_str() const -> const char* { return isShared() ? getShared()->data() : bytes; }
+    auto size() const -> size_t { return str().size(); }
+    auto empty() const -> bool { return size() == 0; }
+
+    // inline strings are zero padded, so equal handles of either kind have equal bytes
+    auto operator==(const InternedString& other) const -> bool {
+        return std::memcmp(bytes, other.bytes, sizeof(bytes)) == 0 or str() == other.str();
+    }
+    auto operator!=(const InternedString& other) const -> bool { return not(*this == other); }
+    auto operator<(const InternedString& other) const -> bool { return str() < other.str(); }
+
+   private:
+    friend class StringPool;
+    friend auto getMemoryUsage(const InternedString& internedString) -> size_t;
+
+    // a long string and how many handles hold it, with its characters right after
+    struct SharedChars {
+        std::atomic<uint32_t> handleCount;
+        size_t size;
+
+        auto data() const -> const char* { return reinterpret_cast<const char*>(this + 1); }
+    };
+
+    // the last byte tells the size of an inline string, or marks the handle as holding a SharedChars pointer
+    static constexpr auto TAG_POS = size_t{15};
+    static constexpr auto SHARED_TAG = char{-1};
+
+    auto isShared() const -> bool { return bytes[TAG_POS] == SHARED_TAG; }
+    auto getShared() const -> SharedChars* {
+        auto* shared = static_cast<SharedChars*>(nullptr);
+        std::memcpy(&shared, bytes, sizeof(shared));
+        return shared;
+    }
+
+    alignas(SharedChars*) char bytes[TAG_POS + 1]{};
+};
+
+inline auto operator<<(std::ostream& os, const InternedString& str) -> std::ostream& { return os << str.str(); }
+
+/**
+ * Pool of interned strings, meant to be shared across parses. Thread safe. Interned strings stay valid after the pool
+ * is destroyed. Strings short enough to be kept in the handle are not pooled, they cost nothing to copy or compare
+ */
+class StringPool {
+   public:
+    /**
+     * @param str the string to intern
+     * @return The pooled copy of str, shared with every other handle interned from the same text
+     */
+    auto intern(std::string_view str) -> InternedString;
+
+    /**
+     * Intern a string that is already held by a handle. If the pool does not have its text yet, it takes the handle's
+     * copy instead of allocating another
+     * @param str the string to intern
+     * @return The pooled copy of str, shared with every other handle interned from the same text
+     */
+    auto adopt(const InternedString& str) -> InternedString;
+
+    /**
+     * @return How many distinct strings are in the pool
+     */
+    auto size() const -> size_t;
+
+   private:
+    friend auto getMemoryUsage(const StringPool& stringPool) -> size_t;
+
+    mutable std::mutex mutex;
+    std::unordered_map<std::string_view, InternedString> strings;  // keys view the values
+};
+
+/**
+ * One patch in the output. Patch is not allocator-aware: a list of patches does not pass its memory resource on, so
+ * the contents list keeps the resource it was made with, and name and author are allocated apart from it
  */
 struct Patch {
-    std::string name;                 /*!< Name of the patch */
-    std::string author;               /*!< Author of the patch */
-    PatchType type;                   /*!< Type of the patch */
-    bool enabled;                     /*!< The patch is currently enabled or not */
-    int lineNum;                      /*!< Line number the patch was read from */
-    std::list<PatchContent> contents; /*!< List of contents for the patch */
+    InternedString name;                   /*!< Name of the patch */
+    InternedString author;                 /*!< Author of the patch */
+    PatchType type;                        /*!< Type of the patch */
+    bool enabled;                          /*!< The patch is currently enabled or not */
+    int lineNum;                           /*!< Line number the patch was read from */
+    std::pmr::list<PatchContent> contents; /*!< List of contents for the patch */
 };
 
 /**
@@ -58,12 +239,77 @@ struct Patch {
 enum TargetType { NSO, NRO };
 
 /**
- * Collection of patches for one binary file
+ * Build ID of a binary, held as the 32 bytes loaders compare against the module id. Shorter build ids are zero padded,
+ * the way loaders treat them, so "ABCD" and "ABCD0000" are the same build id
+ */
+class BuildId {
+   public:
+    static constexpr auto SIZE = size_t{0x20};           /*!< Size of a build id in bytes */
+    static constexpr auto CANONICAL_SIZE = size_t{0x14}; /*!< Size written in canonical form, unless it is longer */
+
+    BuildId() = default;
+
+    /**
+     * @param hexStr the build id in hex, with up to 64 digits in any case
+     * @return The build id, or nothing if hexStr is empty, too long or not hex
+     */
+    static auto fromHex(std::string_view hexStr) -> std::optional<BuildId>;
+
+    /**
+     * @param bytes the build id bytes, such as the module id from a binary's header
+     * @param size how many bytes to take, at most SIZE. The rest are zero
+     * @return The build id
+     */
+    static auto fromBytes(const uint8_t* bytes, size_t size) -> BuildId;
+
+    /**
+     * @return The build id in uppercase hex, with as many digits as it was given with. Build ids from bytes leave out
+     * trailing zero bytes
+     */
+    auto toString() const -> std::string;
+
+    /**
+     * @return The same build id written with a fixed number of digits: 40, the size of the build ids binaries are
+     * built with, or all 64 if it has more bytes. Spellings that only differ in zero padding then write the same
+     */
+    auto toCanonical() const -> BuildId;
+
+    auto getBytes() const -> const std::array<uint8_t, SIZE>& { return bytes; }
+    auto getHash() const -> size_t { return hash; }
+    auto isEmpty() const -> bool { return hexLength == 0; }
+
+    // compare as words, which compilers turn into one or two vector compares
+    auto operator==(const BuildId& other) const -> bool {
+        auto difference = uint64_t{0};
+        for (auto wordIdx = size_t{0}; wordIdx < SIZE / sizeof(uint64_t); wordIdx++) {
+            difference |= getWord(wordIdx) ^ other.getWord(wordIdx);
+        }
+        return difference == 0;
+    }
+    auto operator!=(const BuildId& other) const -> bool { return not(*this == other); }
+    auto operator<(const BuildId& other) const -> bool { return bytes < other.bytes; }
+
+   private:
+    auto getWord(size_t wordIdx) const -> uint64_t {
+        auto word = uint64_t{};
+        std::memcpy(&word, bytes.data() + wordIdx * sizeof(uint64_t), sizeof(uint64_t));
+        return word;
+    }
+    void updateHash();
+
+    std::array<uint8_t, SIZE> bytes{};
+    size_t hash = 0;
+    uint8_t hexLength = 0;
+};
+
+/**
+ * Collection of patches for one binary file. Like Patch, it is not allocator-aware, so the patches list keeps the
+ * resource it was made with
  */
 struct PatchCollection {
-    std::string buildId;      /*!< Build ID of the target binary */
-    TargetType targetType;    /*!< Type of the target binary */
-    std::list<Patch> patches; /*!< List of patches to be applied */
+    BuildId buildId;               /*!< Build ID of the target binary */
+    TargetType targetType;         /*!< Type of the target binary */
+    std::pmr::list<Patch> patches; /*!< List of patches to be applied */
 };
 
 struct PatchTextMeta {
@@ -76,8 +322,306 @@ struct PatchTextMeta {
  * Compiled output for one Patch Text. Can contain outputs for multiple binaries
  */
 struct PatchTextOutput {
-    PatchTextMeta meta;                     /*!< Meta data for the Patch Text file */
-    std::list<PatchCollection> collections; /*!< Patch collections, each collection is intended for one binary */
+    PatchTextMeta meta;                          /*!< Meta data for the Patch Text file */
+    std::pmr::list<PatchCollection> collections; /*!< Patch collections, each intended for one binary */
+};
+
+/**
+ * Enabled state of the patches of one PatchCollection, one bit per patch position. Lets every user have their own
+ * choice of enabled patches over one shared parsed output, without copying it. The first 64 patches are stored inline
+ * without a heap allocation. Patches past the end are disabled
+ */
+class PatchEnabledSet {
+   public:
+    PatchEnabledSet() = default;
+
+    /**
+     * @param patchCollection the PatchCollection to take the enabled flags of
+     */
+    explicit PatchEnabledSet(const PatchCollection& patchCollection);
+
+    auto isEnabled(size_t patchIdx) const -> bool;
+    void setEnabled(size_t patchIdx, bool enabled);
+
+    auto operator==(const PatchEnabledSet& other) const -> bool;
+    auto operator!=(const PatchEnabledSet& other) const -> bool { return not(*this == other); }
+
+   private:
+    friend auto getMemoryUsage(const PatchEnabledSet& enabledSet) -> size_t;
+
+    static constexpr auto WORD_BITS = size_t{64};
+
+    uint64_t inlineWord = 0;
+    std::vector<uint64_t> moreWords{};  // patches from 64 on
+};
+
+/**
+ * Enabled state of every PatchCollection of a PatchTextOutput, one PatchEnabledSet per collection in collection order
+ */
+class PatchEnabledOverlay {
+   public:
+    PatchEnabledOverlay() = default;
+
+    /**
+     * @param patchTextOutput the PatchTextOutput to take the enabled flags of
+     */
+    explicit PatchEnabledOverlay(const PatchTextOutput& patchTextOutput);
+
+    /**
+     * @param collectionIdx position of the collection in the PatchTextOutput
+     * @return The enabled state of the collection. An empty set, with every patch disabled, if there is none
+     */
+    auto getCollection(size_t collectionIdx) const -> const PatchEnabledSet&;
+
+    /**
+     * @param collectionIdx position of the collection in the PatchTextOutput
+     * @return The enabled state of the collection to change, added if there is none yet
+     */
+    auto getCollection(size_t collectionIdx) -> PatchEnabledSet&;
+
+    auto isEnabled(size_t collectionIdx, size_t patchIdx) const -> bool;
+    void setEnabled(size_t collectionIdx, size_t patchIdx, bool enabled);
+
+   private:
+    friend auto getMemoryUsage(const PatchEnabledOverlay& enabledOverlay) -> size_t;
+
+    std::vector<PatchEnabledSet> collections{};
+};
+
+/**
+ * Severity of a parsing diagnostic
+ */
+enum DiagnosticLevel { DIAGNOSTIC_DEBUG, DIAGNOSTIC_INFO, DIAGNOSTIC_WARNING, DIAGNOSTIC_ERROR };
+
+/**
+ * Receiver of the events produced while parsing a Patch Text. Every callback does nothing by default, so a visitor
+ * only needs to override what it is interested in. No more events are produced after an error diagnostic
+ */
+class PatchTextVisitor {
+   public:
+    virtual ~PatchTextVisitor() = default;
+
+    /**
+     * Called once the meta data section has been read. The section ends at the first empty line, so when there is none
+     * it ends with the Patch Text and this is called after the events of the patches
+     * @param meta the meta data of the Patch Text
+     */
+    virtual void onMeta(const PatchTextMeta& /*meta*/) {}
+
+    /**
+     * Called when a build id section starts. A build id can have multiple sections in one Patch Text
+     * @param buildId build id of the target binary
+     * @param targetType type of the target binary
+     */
+    virtual void onCollectionBegin(const BuildId& /*buildId*/, TargetType /*targetType*/) {}
+
+    /**
+     * Called when the current build id section ends
+     */
+    virtual void onCollectionEnd() {}
+
+    /**
+     * Called when a legacy style @nsobid tag changes the build id of the current section. The section keeps the
+     * patches already read, and the patch being read carries on in it
+     * @param buildId the new build id of the target binary
+     * @param targetType the new type of the target binary
+     */
+    virtual void onCollectionBuildIdChange(const BuildId& /*buildId*/, TargetType /*targetType*/) {}
+
+    /**
+     * Called before the first content of a patch
+     * @param patch the patch being read. Its contents are always empty, they are passed to onContent instead
+     */
+    virtual void onPatchBegin(const Patch& /*patch*/) {}
+
+    /**
+     * Called for every content of the current patch
+     * @param offset the offset to patch at, with offset shift already applied
+     * @param value the value to be patched. Only valid for the duration of the call
+     */
+    virtual void onContent(uint32_t /*offset*/, const std::vector<uint8_t>& /*value*/) {}
+
+    /**
+     * Called after the last content of the current patch
+     */
+    virtual void onPatchEnd() {}
+
+    /**
+     * Called for every log message produced while parsing
+     * @param level severity of the message. DIAGNOSTIC_ERROR means parsing was aborted
+     * @param lineNum line number the message is about, or 0 if it is not about a specific line
+     * @param message the log message
+     */
+    virtual void onDiagnostic(DiagnosticLevel /*level*/, int /*lineNum*/, const std::string& /*message*/) {}
+};
+
+/**
+ * Counters and per phase timings of parsing. Phase times are exclusive, a phase nested in another is only counted in
+ * the nested one, so they add up to the time spent parsing lines. Stats of many parses can be added together.
+ * Resource allocations are only the ones made through the output's memory resource: names, authors and meta strings
+ * are allocated outside of it and not counted
+ */
+struct ParseStats {
+    uint64_t bytesRead = 0;                         /*!< Bytes of the lines read, one line break each */
+    uint64_t linesRead = 0;                         /*!< Lines read */
+    std::chrono::nanoseconds metaTime{};            /*!< Time spent parsing the meta data */
+    std::chrono::nanoseconds tokenizeTime{};        /*!< Time spent splitting lines into comments and tokens */
+    std::chrono::nanoseconds hexDecodeTime{};       /*!< Time spent decoding hex values */
+    std::chrono::nanoseconds stringEscapeTime{};    /*!< Time spent reading and escaping string values */
+    std::chrono::nanoseconds collectionMergeTime{}; /*!< Time the visitor spent merging collections */
+    std::chrono::nanoseconds visitorTime{};         /*!< Time the visitor spent on patches, contents and logs */
+    uint64_t patchCount = 0;                        /*!< Patches read */
+    uint64_t contentCount = 0;                      /*!< Patch contents read */
+    uint64_t collectionCount = 0;                   /*!< Build id sections read */
+    uint64_t mergedCollectionCount = 0;             /*!< Sections for a build id that already had a section */
+    uint64_t resourceAllocationCount = 0;           /*!< Allocations of patch list nodes and long contents */
+    uint64_t resourceAllocatedBytes = 0;            /*!< Bytes of patch list nodes and long contents */
+
+    auto operator+=(const ParseStats& other) -> ParseStats&;
+};
+
+/**
+ * Line by line Patch Text parser which reports what it reads to a PatchTextVisitor. It only keeps the state of the
+ * patch being read, so its memory use does not grow with the size of the input
+ */
+class PatchTextParser {
+   public:
+    /**
+     * @param visitor the visitor to report parsing events to. Must outlive the parser
+     * @param isMetaOnly only parse the meta data section, and stop right after it
+     */
+    explicit PatchTextParser(PatchTextVisitor& visitor, bool isMetaOnly = false);
+
+    /**
+     * @param visitor the visitor to report parsing events to. Must outlive the parser
+     * @param stats stats to add the counters and phase timings of this parse to. Must outlive the parser
+     * @param isMetaOnly only parse the meta data section, and stop right after it
+     */
+    PatchTextParser(PatchTextVisitor& visitor, ParseStats& stats, bool isMetaOnly = false);
+
+    /**
+     * Parse the next line of the Patch Text
+     * @param line the line without its line break. It may be modified by the parser
+     * @return If the parser is expecting more lines. false after the @stop tag or an error
+     */
+    auto parseLine(std::string& line) -> bool;
+
+    /**
+     * Parse the next chunk of the Patch Text. Chunks can be split anywhere, the incomplete line at the end of a chunk
+     * is kept until the rest of it is fed. Never blocks, so it can be driven by asynchronous I/O
+     * @param chunk the next chunk of the pchtxt content
+     * @return If the parser is expecting more input. false after the @stop tag or an error
+     */
+    auto feed(std::string_view chunk) -> bool;
+
+    /**
+     * Finish parsing after the last line or chunk, reporting the patch and collection still being read
+     * @return If the Patch Text was parsed without errors
+     */
+    auto finish() -> bool;
+
+   private:
+    class PhaseScope;
+
+    void parseMetaLine(std::string& line);
+    void endMeta();
+    void parsePatchLine(std::string& line);
+    void parseTag(std::string& lineNoComment, std::string& lineNoCommentLower);
+    void parseContent(std::string& line, std::string& lineNoComment, std::string& lineNoCommentLower);
+    void beginCollection(const BuildId& buildId, TargetType targetType);
+    void endCollection();
+    void addContent(uint32_t offset);
+    void endPatch();
+    void complete();
+    void log(DiagnosticLevel level, int lineNum, const std::string& message);
+    void fail(const std::string& message);
+    auto enterPhase(std::chrono::nanoseconds ParseStats::*phaseTime) -> std::chrono::nanoseconds ParseStats::*;
+
+    PatchTextVisitor& visitor;
+    bool isMetaOnly;
+
+    // stats, only kept when there are stats to add to
+    ParseStats* stats = nullptr;
+    std::chrono::nanoseconds ParseStats::*curPhaseTime = nullptr;
+    std::chrono::steady_clock::time_point curPhaseStartTime{};
+    std::vector<BuildId> seenBuildIds{};
+
+    // trace spans, only timed while tracing
+    std::chrono::steady_clock::time_point metaTraceBeginTime{};
+    std::chrono::steady_clock::time_point collectionTraceBeginTime{};
+
+    // parsing status
+    int curLineNum = 1;
+    PatchTextMeta meta{};
+    std::string legacyTitle{};
+    bool isParsingMeta = true;
+    std::string lastCommentLine{};
+    Patch curPatch{};
+    bool curPatchHasContents = false;
+    BuildId curBuildId{};
+    bool isCollectionOpen = false;
+    bool curCollectionHasPatches = false;
+    int curOffsetShift = 0;
+    bool curIsBigEndian = false;
+    bool isAcceptingPatch = false;
+    bool logDebugInfo = false;
+    bool isDone = false;
+    bool hasError = false;
+    std::vector<uint8_t> curValue{};
+    std::string pendingLine{};
+};
+
+/**
+ * Visitor that compiles a PatchTextOutput from the parsing events, the way parsePchtxt does. Use with
+ * PatchTextParser::feed to get a complete output from a pchtxt that arrives in chunks
+ */
+class PatchTextOutputBuilder : public PatchTextVisitor {
+   public:
+    PatchTextOutputBuilder() = default;
+
+    /**
+     * @param logOs an ostream to capture parsing logs. Must outlive the builder
+     */
+    explicit PatchTextOutputBuilder(std::ostream& logOs) : logOs(&logOs) {}
+
+    /**
+     * @param stringPool a pool to intern patch names and authors with. Must outlive the builder
+     */
+    explicit PatchTextOutputBuilder(StringPool& stringPool) : stringPool(&stringPool) {}
+    PatchTextOutputBuilder(std::ostream& logOs, StringPool& stringPool) : logOs(&logOs), stringPool(&stringPool) {}
+
+    /**
+     * @param resource the memory resource to allocate every list node and long content value of the output from. Must
+     * outlive the output. With a std::pmr::monotonic_buffer_resource, destroying the output frees no list node or
+     * content one by one. Meta strings and names and authors too long to be kept inline are not in the resource: they
+     * are allocated with new, or come from the string pool
+     * @param stringPool [optional] a pool to intern patch names and authors with. Must outlive the builder
+     */
+    explicit PatchTextOutputBuilder(std::pmr::memory_resource* resource, StringPool* stringPool = nullptr)
+        : output{{}, std::pmr::list<PatchCollection>{resource}}, stringPool(stringPool), resource(resource) {}
+    PatchTextOutputBuilder(std::ostream& logOs, std::pmr::memory_resource* resource, StringPool* stringPool = nullptr)
+        : output{{}, std::pmr::list<PatchCollection>{resource}},
+          logOs(&logOs),
+          stringPool(stringPool),
+          resource(resource) {}
+
+    void onMeta(const PatchTextMeta& meta) override;
+    void onCollectionBegin(const BuildId& buildId, TargetType targetType) override;
+    void onCollectionEnd() override;
+    void onCollectionBuildIdChange(const BuildId& buildId, TargetType targetType) override;
+    void onPatchBegin(const Patch& patch) override;
+    void onContent(uint32_t offset, const std::vector<uint8_t>& value) override;
+    void onDiagnostic(DiagnosticLevel level, int lineNum, const std::string& message) override;
+
+    /**
+     * The compiled output. Incomplete if parsing was aborted by an error
+     */
+    PatchTextOutput output{};
+
+   private:
+    std::ostream* logOs = nullptr;
+    StringPool* stringPool = nullptr;
+    std::pmr::memory_resource* resource = std::pmr::get_default_resource();
 };
 
 /**
@@ -86,9 +630,168 @@ struct PatchTextOutput {
  * @param logOs [optional] an ostream to capture parsing logs
  * @return The PatchTextOutput struct containing all the parsed information from the Patch Text
  */
-inline auto parsePchtxt(std::istream& input) -> PatchTextOutput;
+auto parsePchtxt(std::istream& input) -> PatchTextOutput;
 auto parsePchtxt(std::istream& input, std::ostream& logOs) -> PatchTextOutput;
 
+/**
+ * Compile a complete output from one Patch Text, interning patch names and authors. Use the same pool for every parse
+ * to share the strings across outputs
+ * @param input an istream from the pchtxt file
+ * @param logOs [optional] an ostream to capture parsing logs
+ * @param stringPool the pool to intern strings with
+ * @return The PatchTextOutput struct containing all the parsed information from the Patch Text
+ */
+auto parsePchtxt(std::istream& input, StringPool& stringPool) -> PatchTextOutput;
+auto parsePchtxt(std::istream& input, std::ostream& logOs, StringPool& stringPool) -> PatchTextOutput;
+
+/**
+ * Compile a complete output from one Patch Text into a memory resource, such as a
+ * std::pmr::monotonic_buffer_resource on the stack, so its lists and content values are released with the resource.
+ * Meta strings and long patch names and authors are still allocated with new
+ * @param input an istream from the pchtxt file
+ * @param logOs [optional] an ostream to capture parsing logs
+ * @param resource the memory resource to allocate the output's lists and long content values from. Must outlive the
+ * output
+ * @return The PatchTextOutput struct containing all the parsed information from the Patch Text
+ */
+auto parsePchtxt(std::istream& input, std::pmr::memory_resource* resource) -> PatchTextOutput;
+auto parsePchtxt(std::istream& input, std::ostream& logOs, std::pmr::memory_resource* resource) -> PatchTextOutput;
+
+/**
+ * Compile a complete output from one Patch Text, measuring where the time goes. The output is allocated from a global
+ * counting resource backed by new and delete instead of the default resource, so its patch lists and long contents
+ * can be counted. That resource is never destroyed, so the output can be kept for as long as needed
+ * @param input an istream from the pchtxt file
+ * @param logOs [optional] an ostream to capture parsing logs
+ * @param stats stats to add the counters, phase timings and resource allocations of this parse to
+ * @return The PatchTextOutput struct containing all the parsed information from the Patch Text
+ */
+auto parsePchtxt(std::istream& input, ParseStats& stats) -> PatchTextOutput;
+auto parsePchtxt(std::istream& input, std::ostream& logOs, ParseStats& stats) -> PatchTextOutput;
+
+/**
+ * Parse one Patch Text, reporting everything read to a visitor instead of compiling an output
+ * @param input an istream from the pchtxt file
+ * @param visitor the visitor to report parsing events to
+ * @param stats [optional] stats to add the counters and phase timings of this parse to
+ * @return If the Patch Text was parsed without errors
+ */
+auto parsePchtxt(std::istream& input, PatchTextVisitor& visitor) -> bool;
+auto parsePchtxt(std::istream& input, PatchTextVisitor& visitor, ParseStats& stats) -> bool;
+
+/**
+ * Write parse stats in the Prometheus text exposition format, as counters with the phase times in seconds
+ * @param stats the stats to write
+ * @param ostream the ostream to write the metrics to
+ * @param metricPrefix [optional] prefix of the metric names
+ */
+void writePrometheus(const ParseStats& stats, std::ostream& ostream, std::string_view metricPrefix = "pchtxt_parse");
+
+/**
+ * One patch read by PatchReader, along with the binary it is for
+ */
+struct PatchEntry {
+    BuildId buildId;       /*!< Build ID of the target binary */
+    TargetType targetType; /*!< Type of the target binary */
+    Patch patch;           /*!< The patch */
+};
+
+/**
+ * Lazily reads the patches of one Patch Text as a range of PatchEntry. The input is only read as far as needed to
+ * complete the next patch, so the first patches are available before the whole input is read, and stopping the
+ * iteration early skips reading the rest. Repeated build ids are not merged
+ */
+class PatchReader {
+   public:
+    class iterator {
+       public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = PatchEntry;
+        using difference_type = std::ptrdiff_t;
+        using pointer = PatchEntry*;
+        using reference = PatchEntry&;
+
+        iterator() = default;
+        explicit iterator(PatchReader* reader) : reader(reader) {}
+
+        auto operator*() const -> PatchEntry& { return reader->collector.readyEntries.front(); }
+        auto operator->() const -> PatchEntry* { return &reader->collector.readyEntries.front(); }
+        auto operator++() -> iterator& {
+            if (not reader->next()) reader = nullptr;
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+        auto operator==(const iterator& other) const { return reader == other.reader; }
+        auto operator!=(const iterator& other) const { return reader != other.reader; }
+
+       private:
+        PatchReader* reader = nullptr;
+    };
+
+    /**
+     * @param input an istream from the pchtxt file. Must outlive the reader
+     * @param logOs [optional] an ostream to capture parsing logs. Must outlive the reader
+     */
+    explicit PatchReader(std::istream& input);
+    PatchReader(std::istream& input, std::ostream& logOs);
+    PatchReader(const PatchReader&) = delete;
+    auto operator=(const PatchReader&) -> PatchReader& = delete;
+
+    /**
+     * Read up to the first patch. Can only be iterated once
+     */
+    auto begin() -> iterator;
+    auto end() -> iterator { return {}; }
+
+    /**
+     * @return The meta data of the Patch Text. Available once iteration has started, the first patch is only read
+     * along with the whole meta data section
+     */
+    auto getMeta() const -> const PatchTextMeta& { return collector.meta; }
+
+    /**
+     * @return If parsing was aborted by an error. The patches before the error have already been read
+     */
+    auto hasError() const -> bool { return isInputDone and not isParsedOk; }
+
+   private:
+    class EntryCollector : public PatchTextVisitor {
+       public:
+        void onMeta(const PatchTextMeta& meta) override;
+        void onCollectionBegin(const BuildId& buildId, TargetType targetType) override;
+        void onCollectionBuildIdChange(const BuildId& buildId, TargetType targetType) override;
+        void onPatchBegin(const Patch& patch) override;
+        void onContent(uint32_t offset, const std::vector<uint8_t>& value) override;
+        void onPatchEnd() override;
+        void onDiagnostic(DiagnosticLevel level, int lineNum, const std::string& message) override;
+
+        std::ostream* logOs = nullptr;
+        PatchTextMeta meta{};
+        bool isMetaRead = false;
+        PatchEntry curEntry{};
+        std::deque<PatchEntry> readyEntries{};
+    };
+
+    auto readUntilEntry() -> bool;
+    auto next() -> bool;
+
+    std::istream& input;
+    EntryCollector collector{};
+    PatchTextParser parser;
+    std::string line{};
+    bool isInputDone = false;
+    bool isParsedOk = true;
+};
+
+/**
+ * Lazily read the patches of one Patch Text
+ * @param input an istream from the pchtxt file. Must outlive the returned reader
+ * @param logOs [optional] an ostream to capture parsing logs. Must outlive the returned reader
+ * @return A PatchReader to iterate the patches with
+ */
+auto patches(std::istream& input) -> PatchReader;
+auto patches(std::istream& input, std::ostream& logOs) -> PatchReader;
+
 /**
  * Parse the meta data for the Patch Text
  * @param input an istream from the pchtxt file
@@ -120,8 +823,95 @@ auto convertPatchToAms(Patch& patchToConvert) -> bool;
 /**
  * Write an IPS file with BIN patches to an ostream
  * @param patchCollection the PatchCollection for one binary file
+ * @param enabledSet [optional] which patches are enabled, instead of their enabled flags
  * @param ostream the ostream to write the IPS file to
  */
 void writeIps(PatchCollection& patchCollection, std::ostream& ostream);
+void writeIps(const PatchCollection& patchCollection, const PatchEnabledSet& enabledSet, std::ostream& ostream);
+
+/**
+ * Format a PatchTextOutput, or the patches of one PatchCollection, as Patch Text. The text is formatted into one buffer
+ * sized up front. Values that parse from a string patch are written as escaped strings, others as hex
+ * @param patchTextOutput the PatchTextOutput to format, including its meta data
+ * @param patchCollection the PatchCollection for one binary file to format
+ * @param enabledOverlay [optional] which patches are enabled, instead of their enabled flags
+ * @param enabledSet [optional] which patches of the collection are enabled, instead of their enabled flags
+ * @return The Patch Text
+ */
+auto formatPchtxt(const PatchTextOutput& patchTextOutput) -> std::string;
+auto formatPchtxt(const PatchTextOutput& patchTextOutput, const PatchEnabledOverlay& enabledOverlay) -> std::string;
+auto formatPchtxt(const PatchCollection& patchCollection) -> std::string;
+auto formatPchtxt(const PatchCollection& patchCollection, const PatchEnabledSet& enabledSet) -> std::string;
+
+/**
+ * Write a PatchTextOutput, or the patches of one PatchCollection, as Patch Text to an ostream
+ * @param patchTextOutput the PatchTextOutput to write, including its meta data
+ * @param patchCollection the PatchCollection for one binary file to write
+ * @param enabledOverlay [optional] which patches are enabled, instead of their enabled flags
+ * @param enabledSet [optional] which patches of the collection are enabled, instead of their enabled flags
+ * @param ostream the ostream to write the Patch Text to
+ */
+void writePchtxt(const PatchTextOutput& patchTextOutput, std::ostream& ostream);
+void writePchtxt(const PatchTextOutput& patchTextOutput, const PatchEnabledOverlay& enabledOverlay,
+                 std::ostream& ostream);
+void writePchtxt(const PatchCollection& patchCollection, std::ostream& ostream);
+void writePchtxt(const PatchCollection& patchCollection, const PatchEnabledSet& enabledSet, std::ostream& ostream);
+
+/**
+ * Bring a PatchTextOutput to a canonical form: build ids are written at a fixed width, collections are sorted by
+ * build id, and contiguous contents of a BIN or HEAP patch are merged. Patches keep their order, since later patches
+ * win where they overlap
+ * @param patchTextOutput the PatchTextOutput to normalize in place
+ */
+void normalizePchtxt(PatchTextOutput& patchTextOutput);
+
+/**
+ * Parse a Patch Text and write it back in canonical form. Patch Texts that only differ in formatting, such as tag case,
+ * whitespace, comments, line breaks, endianness flags or offset shifts, give the same canonical text, so it can be
+ * hashed for deduplication and caching
+ * @param input an istream from the pchtxt file
+ * @param logOs [optional] an ostream to capture parsing logs
+ * @return The canonical Patch Text, or an empty string if the pchtxt could not be parsed
+ */
+auto getCanonicalPchtxt(std::istream& input) -> std::string;
+auto getCanonicalPchtxt(std::istream& input, std::ostream& logOs) -> std::string;
+
+/**
+ * Find the collection for a binary
+ * @param patchTextOutput the PatchTextOutput to search
+ * @param buildId build id of the binary
+ * @return The collection for the binary, or nullptr if there is none
+ */
+auto findPatchCollection(PatchTextOutput& patchTextOutput, const BuildId& buildId) -> PatchCollection*;
+auto findPatchCollection(const PatchTextOutput& patchTextOutput, const BuildId& buildId) -> const PatchCollection*;
+
+/**
+ * Estimate how many bytes an object occupies, counting the object itself and the heap memory it owns: list nodes,
+ * vector capacity, string buffers and long content values. A string interned with a StringPool is shared, so each of
+ * its holders, the pool included, counts an equal share of it. Allocator bookkeeping is not counted, and container
+ * nodes are sized after the libstdc++ and libc++ layouts, so other standard libraries may differ
+ * @param value, patchContent, internedString, stringPool, patch, patchCollection, meta, patchTextOutput, enabledSet,
+ * enabledOverlay the object to measure
+ * @return The estimated size in bytes
+ */
+auto getMemoryUsage(const PatchContentValue& value) -> size_t;
+auto getMemoryUsage(const PatchContent& patchContent) -> size_t;
+auto getMemoryUsage(const InternedString& internedString) -> size_t;
+auto getMemoryUsage(const StringPool& stringPool) -> size_t;
+auto getMemoryUsage(const Patch& patch) -> size_t;
+auto getMemoryUsage(const PatchCollection& patchCollection) -> size_t;
+auto getMemoryUsage(const PatchTextMeta& meta) -> size_t;
+auto getMemoryUsage(const PatchTextOutput& patchTextOutput) -> size_t;
+auto getMemoryUsage(const PatchEnabledSet& enabledSet) -> size_t;
+auto getMemoryUsage(const PatchEnabledOverlay& enabledOverlay) -> size_t;
 
 }  // namespace pchtxt
+
+namespace std {
+
+template <>
+struct hash<pchtxt::BuildId> {
+    auto operator()(const pchtxt::BuildId& buildId) const noexcept -> size_t { return buildId.getHash(); }
+};
+
+}  // namespace std
@@ -0,0 +1,357 @@
+/**
+ * @file pchtxt_atmosphere.cpp
+ * @brief Exporting patches to the Atmosphere SD card layout
+ * @author 3096
+ *
+ * Copyright (c) 2020 3096
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pchtxt_atmosphere.hpp"
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <filesystem>
+#include <set>
+#include <sstream>
+
+#if defined(_WIN32)
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "pchtxt_trace.hpp"
+#include "pchtxt_utils.hpp"
+
+namespace pchtxt {
+
+// CONSTANTS
+
+constexpr auto ATMOSPHERE_DIR = "atmosphere";
+constexpr auto EXEFS_PATCHES_DIR = "exefs_patches";
+constexpr auto NRO_PATCHES_DIR = "nro_patches";
+constexpr auto CONTENTS_DIR = "contents";
+constexpr auto CHEATS_DIR = "cheats";
+constexpr auto IPS_EXTENSION = ".ips";
+constexpr auto CHEATS_EXTENSION = ".txt";
+constexpr auto TEMP_EXTENSION = ".tmp";
+constexpr auto BACKUP_EXTENSION = ".bak";
+constexpr auto IPS_NAME_DIGITS = size_t{40};     // build ids are usually 20 bytes, shorter ones are padded with zeros
+constexpr auto CHEATS_NAME_DIGITS = size_t{16};  // cheats are named after the first 8 bytes of the build id
+constexpr auto PROGRAM_ID_DIGITS = size_t{16};
+constexpr auto RESERVED_PATH_CHARS = std::string_view("<>:\"/\\|?*");  // not allowed on FAT32 and Windows
+
+// utils
+
+struct ExportFile {
+    std::filesystem::path path;
+    const PatchCollection* patchCollection;
+    PatchType patchType;      // BIN for an IPS file, AMS for a cheat file
+    std::string error;        // set by the worker writing the file
+    bool hasBackup = false;   // the file being replaced was copied, so it can be restored
+    bool isReplaced = false;  // the new file was renamed into place
+};
+
+inline auto hasEnabledPatches(const PatchCollection& patchCollection, PatchType patchType) {
+    return std::any_of(begin(patchCollection.patches), end(patchCollection.patches),
+                       [patchType](const Patch& patch) { return patch.enabled and patch.type == patchType; });
+}
+
+inline auto getBuildIdName(const BuildId& buildId, size_t digitCount) {
+    auto result = buildId.toString();
+    result.resize(digitCount, '0');
+    return result;
+}
+
+// a name that can be used as a folder on the SD card, empty if nothing is left of it
+inline auto getFolderName(std::string name) {
+    for (auto& ch : name) {
+        if (static_cast<uint8_t>(ch) < 0x20 or RESERVED_PATH_CHARS.find(ch) != std::string_view::npos) ch = '_';
+    }
+    name.erase(std::find_if(rbegin(name), rend(name), [](char ch) { return ch != ' ' and ch != '.'; }).base(),
+               end(name));
+    name.erase(begin(name), std::find_if(begin(name), end(name), [](char ch) { return ch != ' '; }));
+    return name;
+}
+
+// the program id as 16 upper case hex digits, empty if it is not hex
+inline auto getProgramIdName(std::string_view programId) {
+    while (not programId.empty() and programId.front() == ' ') programId.remove_prefix(1);
+    while (not programId.empty() and programId.back() == ' ') programId.remove_suffix(1);
+    if (programId.empty() or programId.size() > PROGRAM_ID_DIGITS) return std::string{};
+
+    auto result = std::string(PROGRAM_ID_DIGITS - programId.size(), '0');
+    for (auto ch : programId) {
+        if (ch >= 'a' and ch <= 'f') ch = static_cast<char>(ch - 'a' + 'A');
+        if (not((ch >= '0' and ch <= '9') or (ch >= 'A' and ch <= 'F'))) return std::string{};
+        result.push_back(ch);
+    }
+    return result;
+}
+
+inline auto getTempPath(const std::filesystem::path& path) {
+    auto result = path;
+    result += TEMP_EXTENSION;
+    return result;
+}
+
+inline auto getBackupPath(const std::filesystem::path& path) {
+    auto result = path;
+    result += BACKUP_EXTENSION;
+    return result;
+}
+
+#if defined(_WIN32)
+inline auto openFile(const std::filesystem::path& path) {
+    return _wopen(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+}
+
+inline auto writeFile(int fd, const char* data, size_t size) {
+    return _write(fd, data, static_cast<unsigned>(std::min<size_t>(size, INT_MAX)));
+}
+
+inline auto syncFile(int fd) { return _commit(fd) == 0; }
+
+inline auto closeFile(int fd) { return _close(fd) == 0; }
+
+inline auto syncDirectory(const std::filesystem::path&) { return true; }  // renames are flushed by the file system
+#else
+inline auto openFile(const std::filesystem::path& path) {
+    return open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+}
+
+inline auto writeFile(int fd, const char* data, size_t size) { return write(fd, data, size); }
+
+inline auto syncFile(int fd) { return fsync(fd) == 0; }
+
+inline auto closeFile(int fd) { return close(fd) == 0; }
+
+inline auto syncDirectory(const std::filesystem::path& path) {
+    auto fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return false;
+    auto isSynced = fsync(fd) == 0;
+    close(fd);
+    return isSynced;
+}
+#endif
+
+// write the whole content and flush it to disk, so the file is complete before it is renamed into place
+auto writeSyncedFile(const std::filesystem::path& path, const std::string& content) -> bool {
+    auto fd = openFile(path);
+    if (fd < 0) return false;
+
+    auto writtenSize = size_t{0};
+    while (writtenSize < content.size()) {
+        auto chunkSize = writeFile(fd, content.data() + writtenSize, content.size() - writtenSize);
+        if (chunkSize < 0 and errno == EINTR) continue;
+        if (chunkSize <= 0) break;
+        writtenSize += chunkSize;
+    }
+
+    auto isWritten = writtenSize == content.size() and syncFile(fd);
+    return closeFile(fd) and isWritten;
+}
+
+void removeTempFiles(const std::vector<ExportFile>& files) {
+    for (auto& file : files) {
+        auto errorCode = std::error_code{};
+        std::filesystem::remove(getTempPath(file.path), errorCode);
+        if (file.hasBackup) std::filesystem::remove(getBackupPath(file.path), errorCode);
+    }
+}
+
+// put back the files that were there before the export, and remove the ones it added
+void restoreReplacedFiles(const std::vector<ExportFile>& files, std::ostream& logOs) {
+    for (auto& file : files) {
+        if (not file.isReplaced) continue;
+        auto errorCode = std::error_code{};
+        if (file.hasBackup) {
+            std::filesystem::rename(getBackupPath(file.path), file.path, errorCode);
+        } else {
+            std::filesystem::remove(file.path, errorCode);
+        }
+        if (errorCode) {
+            logOs << "ERROR: could not restore " << file.path.string() << ": " << errorCode.message() << std::endl;
+        }
+    }
+}
+
+// not utils
+
+void writeAmsCheats(const PatchCollection& patchCollection, std::ostream& ostream) {
+    for (auto& patch : patchCollection.patches) {
+        if (not patch.enabled or patch.type != AMS) continue;
+        ostream << '[' << patch.name.str() << "]\n";
+        for (auto& patchContent : patch.contents) {
+            ostream.write(reinterpret_cast<const char*>(patchContent.value.data()), patchContent.value.size());
+            ostream << '\n';
+        }
+        ostream << '\n';
+    }
+}
+
+auto exportAtmosphere(const PatchTextOutput& patchTextOutput, const std::string& rootPath) -> bool {
+    auto throwAwaySs = std::stringstream{};
+    return exportAtmosphere(patchTextOutput, rootPath, throwAwaySs);
+}
+
+auto exportAtmosphere(const PatchTextOutput& patchTextOutput, const std::string& rootPath, std::ostream& logOs)
+    -> bool {
+    return exportAtmosphere({AtmosphereExport{&patchTextOutput, {}}}, rootPath, logOs);
+}
+
+auto exportAtmosphere(const std::vector<AtmosphereExport>& exports, const std::string& rootPath, unsigned threadCount)
+    -> bool {
+    auto throwAwaySs = std::stringstream{};
+    return exportAtmosphere(exports, rootPath, throwAwaySs, threadCount);
+}
+
+auto exportAtmosphere(const std::vector<AtmosphereExport>& exports, const std::string& rootPath, std::ostream& logOs,
+                      unsigned threadCount) -> bool {
+    auto traceSpan = TraceSpan{"export Atmosphere"};
+    auto atmospherePath = std::filesystem::path(rootPath) / ATMOSPHERE_DIR;
+
+    // decide every file up front, so nothing is written if two exports want the same file
+    auto files = std::vector<ExportFile>{};
+    auto filePaths = std::set<std::filesystem::path>{};
+    auto addFile = [&](std::filesystem::path path, const PatchCollection& patchCollection, PatchType patchType) {
+        if (not filePaths.insert(path).second) {
+            logOs << "ERROR: " << path.string() << " is exported more than once" << std::endl;
+            return false;
+        }
+        files.push_back({std::move(path), &patchCollection, patchType, {}});
+        return true;
+    };
+
+    for (auto& atmosphereExport : exports) {
+        auto& meta = atmosphereExport.patchTextOutput->meta;
+        auto patchName = getFolderName(atmosphereExport.patchName.empty() ? meta.title : atmosphereExport.patchName);
+        auto programIdName = getProgramIdName(meta.programId);
+
+        for (auto& patchCollection : atmosphereExport.patchTextOutput->collections) {
+            auto buildIdStr = patchCollection.buildId.toString();
+
+            if (hasEnabledPatches(patchCollection, HEAP)) {
+                logOs << "WARNING: heap patches for " << buildIdStr << " have no place in the layout and were skipped"
+                      << std::endl;
+            }
+
+            if (hasEnabledPatches(patchCollection, BIN)) {
+                if (patchName.empty()) {
+                    logOs << "WARNING: patches for " << buildIdStr << " were skipped because they have no name"
+                          << std::endl;
+                } else {
+                    auto patchesDir = patchCollection.targetType == NRO ? NRO_PATCHES_DIR : EXEFS_PATCHES_DIR;
+                    auto ipsName = getBuildIdName(patchCollection.buildId, IPS_NAME_DIGITS) + IPS_EXTENSION;
+                    if (not addFile(atmospherePath / patchesDir / patchName / ipsName, patchCollection, BIN)) {
+                        return false;
+                    }
+                }
+            }
+
+            if (hasEnabledPatches(patchCollection, AMS)) {
+                if (patchCollection.targetType != NSO) {
+                    logOs << "WARNING: cheats for " << buildIdStr << " were skipped because they are not for an NSO"
+                          << std::endl;
+                } else if (programIdName.empty()) {
+                    logOs << "WARNING: cheats for " << buildIdStr
+                          << " were skipped because the program id is missing or not hex" << std::endl;
+                } else {
+                    auto cheatsName = getBuildIdName(patchCollection.buildId, CHEATS_NAME_DIGITS) + CHEATS_EXTENSION;
+                    auto cheatsPath = atmospherePath / CONTENTS_DIR / programIdName / CHEATS_DIR / cheatsName;
+                    if (not addFile(std::move(cheatsPath), patchCollection, AMS)) return false;
+                }
+            }
+        }
+    }
+
+    runInParallel(files.size(), threadCount, [&files](size_t fileIdx) {
+        auto& file = files[fileIdx];
+        auto fileTraceSpan = TraceSpan{"export file"};
+        if (fileTraceSpan.isRecording()) fileTraceSpan.setDetail(file.path.string());
+
+        auto contentSs = std::ostringstream{};
+        if (file.patchType == AMS) {
+            writeAmsCheats(*file.patchCollection, contentSs);
+        } else {
+            writeIps(*file.patchCollection, PatchEnabledSet{*file.patchCollection}, contentSs);
+        }
+
+        auto errorCode = std::error_code{};
+        std::filesystem::create_directories(file.path.parent_path(), errorCode);
+        if (errorCode) {
+            file.error = "could not create " + file.path.parent_path().string() + ": " + errorCode.message();
+            return;
+        }
+        if (not writeSyncedFile(getTempPath(file.path), contentSs.str())) {
+            file.error = "could not write " + getTempPath(file.path).string();
+            return;
+        }
+
+        // a copy rather than a link, FAT32 SD cards have no hard links
+        if (std::filesystem::is_regular_file(file.path, errorCode)) {
+            auto copyOptions = std::filesystem::copy_options::overwrite_existing;
+            file.hasBackup = std::filesystem::copy_file(file.path, getBackupPath(file.path), copyOptions, errorCode);
+            if (not file.hasBackup) file.error = "could not back up " + file.path.string() + ": " + errorCode.message();
+        }
+    });
+
+    auto isWritten = true;
+    for (auto& file : files) {
+        if (file.error.empty()) continue;
+        logOs << "ERROR: " << file.error << std::endl;
+        isWritten = false;
+    }
+    if (not isWritten) {
+        removeTempFiles(files);
+        return false;
+    }
+
+    auto fileDirs = std::set<std::filesystem::path>{};
+    for (auto& file : files) {
+        auto errorCode = std::error_code{};
+        std::filesystem::rename(getTempPath(file.path), file.path, errorCode);
+        if (errorCode) {
+            logOs << "ERROR: could not replace " << file.path.string() << ": " << errorCode.message() << std::endl;
+            restoreReplacedFiles(files, logOs);
+            removeTempFiles(files);
+            return false;
+        }
+        file.isReplaced = true;
+        fileDirs.insert(file.path.parent_path());
+    }
+    for (auto& file : files) {
+        auto errorCode = std::error_code{};
+        if (file.hasBackup) std::filesystem::remove(getBackupPath(file.path), errorCode);
+    }
+
+    // the renames are only durable once their directories are flushed, which is done once per directory
+    auto dirsToSync = std::vector<std::filesystem::path>(begin(fileDirs), end(fileDirs));
+    auto isDirSynced = std::vector<char>(dirsToSync.size());
+    runInParallel(dirsToSync.size(), threadCount,
+                  [&](size_t dirIdx) { isDirSynced[dirIdx] = syncDirectory(dirsToSync[dirIdx]); });
+    for (auto dirIdx = size_t{0}; dirIdx < dirsToSync.size(); dirIdx++) {
+        if (not isDirSynced[dirIdx]) logOs << "WARNING: could not flush " << dirsToSync[dirIdx].string() << std::endl;
+    }
+
+    logOs << "exported " << files.size() << " files to " << atmospherePath.string() << std::endl;
+    return true;
+}
+
+}  // namespace pchtxt
@@ -0,0 +1,70 @@
+/**
+ * @file pchtxt_atmosphere.hpp
+ * @brief Exporting patches to the Atmosphere SD card layout
+ * @author 3096
+ *
+ * Copyright (c) 2020 3096
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pchtxt.hpp"
+
+namespace pchtxt {
+
+/**
+ * One Patch Text to export to the Atmosphere layout
+ */
+struct AtmosphereExport {
+    const PatchTextOutput* patchTextOutput; /*!< The Patch Text to export. Must outlive the export */
+    std::string patchName;                  /*!< Folder name for the IPS files. The title is used if empty */
+};
+
+/**
+ * Write an Atmosphere cheat file with the enabled AMS patches to an ostream
+ * @param patchCollection the PatchCollection for one binary file
+ * @param ostream the ostream to write the cheats to
+ */
+void writeAmsCheats(const PatchCollection& patchCollection, std::ostream& ostream);
+
+/**
+ * Export one Patch Text to the Atmosphere layout under an SD card root, named after its title. Enabled BIN patches are
+ * written to atmosphere/exefs_patches/<title>/<BUILDID>.ips, or nro_patches for NRO, and enabled AMS patches to
+ * atmosphere/contents/<programId>/cheats/<BUILDID>.txt. Files are replaced as by the overload below
+ * @param patchTextOutput the Patch Text to export, with its title as the folder name
+ * @param rootPath path of the SD card root
+ * @param logOs [optional] an ostream to capture logs
+ * @return If every file was exported. Patches that have no place in the layout are skipped with a warning
+ */
+auto exportAtmosphere(const PatchTextOutput& patchTextOutput, const std::string& rootPath) -> bool;
+auto exportAtmosphere(const PatchTextOutput& patchTextOutput, const std::string& rootPath, std::ostream& logOs) -> bool;
+
+/**
+ * Export Patch Texts to the Atmosphere layout under an SD card root, in one pass. Files are written in parallel next to
+ * their destination and flushed to disk, then renamed over it, so a reader never sees a partial file. Nothing is
+ * renamed if any file can not be written, and the files already renamed are put back if a later rename fails. Each
+ * directory is flushed once after all the renames
+ * @param exports the Patch Texts to export
+ * @param rootPath path of the SD card root
+ * @param logOs [optional] an ostream to capture logs
+ * @param threadCount how many threads to write with. 0 to use the hardware concurrency
+ * @return If every file was exported. Patches that have no place in the layout are skipped with a warning
+ */
+auto exportAtmosphere(const std::vector<AtmosphereExport>& exports, const std::string& rootPath,
+                      unsigned threadCount = 0) -> bool;
+auto exportAtmosphere(const std::vector<AtmosphereExport>& exports, const std::string& rootPath, std::ostream& logOs,
+                      unsigned threadCount = 0) -> bool;
+
+}  // namespace pchtxt
@@ -0,0 +1,342 @@
+/**
+ * @file pchtxt_bundle.cpp
+ * @brief Parsing of the Patch Text files inside zip and tar mod bundles
+ * @author 3096
+ *
+ * Copyright (c) 2020 3096
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pchtxt_bundle.hpp"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <sstream>
+
+#include "pchtxt_trace.hpp"
+#include "pchtxt_utils.hpp"
+
+namespace pchtxt {
+
+// CONSTANTS
+
+constexpr auto PCHTXT_EXTENSION = std::string_view(".pchtxt");
+constexpr auto DECOMPRESSED_BLOCK_SIZE = 0x40000;
+constexpr auto ZLIB_WINDOW_BITS_RAW_DEFLATE = -15;
+
+// zip
+constexpr auto ZIP_LOCAL_HEADER_MAGIC = 0x04034b50u;
+constexpr auto ZIP_CENTRAL_HEADER_MAGIC = 0x02014b50u;
+constexpr auto ZIP_END_OF_CENTRAL_DIR_MAGIC = 0x06054b50u;
+constexpr auto ZIP_LOCAL_HEADER_SIZE = size_t{30};
+constexpr auto ZIP_CENTRAL_HEADER_SIZE = size_t{46};
+constexpr auto ZIP_END_OF_CENTRAL_DIR_SIZE = size_t{22};
+constexpr auto ZIP_MAX_COMMENT_SIZE = size_t{0xFFFF};
+constexpr auto ZIP_FLAG_ENCRYPTED = 0x1u;
+constexpr auto ZIP_METHOD_STORED = 0u;
+constexpr auto ZIP_METHOD_DEFLATE = 8u;
+constexpr auto ZIP64_PLACEHOLDER = 0xFFFFFFFFu;
+
+// tar
+constexpr auto TAR_BLOCK_SIZE = size_t{512};
+constexpr auto TAR_NAME_SIZE = size_t{100};
+constexpr auto TAR_SIZE_POS = size_t{124};
+constexpr auto TAR_SIZE_SIZE = size_t{12};
+constexpr auto TAR_TYPE_POS = size_t{156};
+constexpr auto TAR_MAGIC_POS = size_t{257};
+constexpr auto TAR_MAGIC = std::string_view("ustar");
+constexpr auto TAR_PREFIX_POS = size_t{345};
+constexpr auto TAR_PREFIX_SIZE = size_t{155};
+constexpr auto TAR_TYPE_FILE = '0';
+constexpr auto TAR_TYPE_OLD_FILE = '\0';
+constexpr auto TAR_TYPE_GNU_LONG_NAME = 'L';
+
+// utils
+
+inline auto readU16(const uint8_t* pos) -> uint32_t { return pos[0] | pos[1] << 8; }
+
+inline auto readU32(const uint8_t* pos) -> uint32_t {
+    return pos[0] | pos[1] << 8 | pos[2] << 16 | static_cast<uint32_t>(pos[3]) << 24;
+}
+
+inline auto readCString(const uint8_t* pos, size_t maxSize) {
+    auto str = reinterpret_cast<const char*>(pos);
+    return std::string(str, std::find(str, str + maxSize, '\0'));
+}
+
+inline auto isPchtxtPath(const std::string& path) {
+    if (path.size() < PCHTXT_EXTENSION.size()) return false;
+    auto isSameCharIgnoreCase = [](char pathCh, char extCh) { return toAsciiLower(pathCh) == extCh; };
+    return std::equal(end(path) - PCHTXT_EXTENSION.size(), end(path), begin(PCHTXT_EXTENSION), isSameCharIgnoreCase);
+}
+
+inline auto isTar(const uint8_t* bundleData, size_t bundleSize) {
+    return bundleSize >= TAR_BLOCK_SIZE and
+           std::string_view(reinterpret_cast<const char*>(bundleData + TAR_MAGIC_POS), TAR_MAGIC.size()) == TAR_MAGIC;
+}
+
+// a .pchtxt entry as listed, along with why it cannot be read if it was skipped
+struct ListedEntry {
+    BundleEntry entry;
+    std::string skipReason;  // empty for entries that can be read
+};
+
+auto getZipPchtxtEntries(const uint8_t* bundleData, size_t bundleSize, std::ostream& logOs)
+    -> std::vector<ListedEntry> {
+    auto result = std::vector<ListedEntry>{};
+    auto skip = [&](const std::string& path, std::string skipReason) {
+        logOs << path << ": WARNING skipped " << skipReason << std::endl;
+        result.push_back({{path, nullptr, 0, 0, false}, std::move(skipReason)});
+    };
+
+    // find end of central directory, which is followed by a comment of up to 64 KiB
+    if (bundleSize < ZIP_END_OF_CENTRAL_DIR_SIZE) {
+        logOs << "ERROR: bundle is neither zip nor tar" << std::endl;
+        return {};
+    }
+    auto searchStop = bundleSize - ZIP_END_OF_CENTRAL_DIR_SIZE - std::min(bundleSize - ZIP_END_OF_CENTRAL_DIR_SIZE,
+                                                                          ZIP_MAX_COMMENT_SIZE);
+    auto endOfCentralDir = static_cast<const uint8_t*>(nullptr);
+    for (auto searchPos = bundleSize - ZIP_END_OF_CENTRAL_DIR_SIZE + 1; searchPos-- > searchStop;) {
+        if (readU32(bundleData + searchPos) == ZIP_END_OF_CENTRAL_DIR_MAGIC) {
+            endOfCentralDir = bundleData + searchPos;
+            break;
+        }
+    }
+    if (endOfCentralDir == nullptr) {
+        logOs << "ERROR: bundle is neither zip nor tar" << std::endl;
+        return {};
+    }
+
+    auto entryCount = readU16(endOfCentralDir + 10);
+    auto centralDirOffset = readU32(endOfCentralDir + 16);
+    if (centralDirOffset == ZIP64_PLACEHOLDER) {
+        logOs << "ERROR: zip64 bundles are not supported" << std::endl;
+        return {};
+    }
+
+    auto curHeaderPos = size_t{centralDirOffset};
+    for (auto entryIdx = 0u; entryIdx < entryCount; entryIdx++) {
+        if (curHeaderPos + ZIP_CENTRAL_HEADER_SIZE > bundleSize or
+            readU32(bundleData + curHeaderPos) != ZIP_CENTRAL_HEADER_MAGIC) {
+            logOs << "ERROR: bad zip central directory" << std::endl;
+            return {};
+        }
+        auto centralHeader = bundleData + curHeaderPos;
+        auto flags = readU16(centralHeader + 8);
+        auto method = readU16(centralHeader + 10);
+        auto compressedSize = readU32(centralHeader + 20);
+        auto size = readU32(centralHeader + 24);
+        auto nameSize = readU16(centralHeader + 28);
+        auto extraSize = readU16(centralHeader + 30);
+        auto commentSize = readU16(centralHeader + 32);
+        auto localHeaderOffset = size_t{readU32(centralHeader + 42)};
+        curHeaderPos += ZIP_CENTRAL_HEADER_SIZE + nameSize + extraSize + commentSize;
+        if (curHeaderPos > bundleSize) {
+            logOs << "ERROR: bad zip central directory" << std::endl;
+            return {};
+        }
+
+        auto path = std::string(reinterpret_cast<const char*>(centralHeader + ZIP_CENTRAL_HEADER_SIZE), nameSize);
+        if (not isPchtxtPath(path)) continue;
+
+        if (flags & ZIP_FLAG_ENCRYPTED) {
+            skip(path, "encrypted entry");
+            continue;
+        }
+        if (method != ZIP_METHOD_STORED and method != ZIP_METHOD_DEFLATE) {
+            skip(path, "entry with unsupported compression method " + std::to_string(method));
+            continue;
+        }
+        if (compressedSize == ZIP64_PLACEHOLDER or size == ZIP64_PLACEHOLDER or
+            localHeaderOffset == ZIP64_PLACEHOLDER) {
+            skip(path, "zip64 entry");
+            continue;
+        }
+
+        // the local header can have a different extra field size than the central one
+        if (localHeaderOffset + ZIP_LOCAL_HEADER_SIZE > bundleSize or
+            readU32(bundleData + localHeaderOffset) != ZIP_LOCAL_HEADER_MAGIC) {
+            skip(path, "entry with bad local header");
+            continue;
+        }
+        auto localHeader = bundleData + localHeaderOffset;
+        auto dataOffset = localHeaderOffset + ZIP_LOCAL_HEADER_SIZE + readU16(localHeader + 26) +
+                          readU16(localHeader + 28);
+        if (dataOffset + compressedSize > bundleSize) {
+            skip(path, "truncated entry");
+            continue;
+        }
+
+        result.push_back({{path, bundleData + dataOffset, compressedSize, size, method == ZIP_METHOD_DEFLATE}, {}});
+    }
+
+    return result;
+}
+
+auto getTarPchtxtEntries(const uint8_t* bundleData, size_t bundleSize, std::ostream& logOs)
+    -> std::vector<ListedEntry> {
+    auto result = std::vector<ListedEntry>{};
+
+    auto longName = std::string{};
+    auto curHeaderPos = size_t{0};
+    while (curHeaderPos + TAR_BLOCK_SIZE <= bundleSize) {
+        auto header = bundleData + curHeaderPos;
+        if (header[0] == '\0') break;  // end of archive
+
+        auto sizeStr = readCString(header + TAR_SIZE_POS, TAR_SIZE_SIZE);
+        auto size = size_t{std::strtoull(sizeStr.c_str(), nullptr, 8)};
+        auto dataOffset = curHeaderPos + TAR_BLOCK_SIZE;
+        if (dataOffset + size > bundleSize) {
+            logOs << "ERROR: tar bundle is truncated" << std::endl;
+            break;
+        }
+        curHeaderPos = dataOffset + (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+
+        auto type = static_cast<char>(header[TAR_TYPE_POS]);
+        if (type == TAR_TYPE_GNU_LONG_NAME) {
+            longName = readCString(bundleData + dataOffset, size);
+            continue;
+        }
+
+        auto path = std::string{};
+        if (not longName.empty()) {
+            path = std::move(longName);
+            longName.clear();
+        } else {
+            path = readCString(header + TAR_PREFIX_POS, TAR_PREFIX_SIZE);
+            if (not path.empty()) path += '/';
+            path += readCString(header, TAR_NAME_SIZE);
+        }
+
+        if ((type == TAR_TYPE_FILE or type == TAR_TYPE_OLD_FILE) and isPchtxtPath(path)) {
+            result.push_back({{path, bundleData + dataOffset, size, size, false}, {}});
+        }
+    }
+
+    return result;
+}
+
+auto getListedEntries(const uint8_t* bundleData, size_t bundleSize, std::ostream& logOs) -> std::vector<ListedEntry> {
+    if (isTar(bundleData, bundleSize)) return getTarPchtxtEntries(bundleData, bundleSize, logOs);
+    return getZipPchtxtEntries(bundleData, bundleSize, logOs);
+}
+
+// not utils
+
+auto getBundlePchtxtEntries(const uint8_t* bundleData, size_t bundleSize) -> std::vector<BundleEntry> {
+    auto throwAwaySs = std::stringstream{};
+    return getBundlePchtxtEntries(bundleData, bundleSize, throwAwaySs);
+}
+
+auto getBundlePchtxtEntries(const uint8_t* bundleData, size_t bundleSize, std::ostream& logOs)
+    -> std::vector<BundleEntry> {
+    auto result = std::vector<BundleEntry>{};
+    for (auto& listedEntry : getListedEntries(bundleData, bundleSize, logOs)) {
+        if (listedEntry.skipReason.empty()) result.push_back(std::move(listedEntry.entry));
+    }
+    return result;
+}
+
+auto parseBundleEntry(const BundleEntry& entry, PatchTextVisitor& visitor) -> bool {
+    auto traceSpan = TraceSpan{"load bundle entry", entry.path};
+    auto parser = PatchTextParser{visitor};
+
+    if (not entry.isDeflated) {  // stored entries are parsed right out of the bundle memory
+        if (entry.dataSize != entry.size) {
+            visitor.onDiagnostic(DIAGNOSTIC_ERROR, 0,
+                                 "ERROR: " + entry.path + " is stored with " + std::to_string(entry.dataSize) +
+                                     " bytes but declares " + std::to_string(entry.size));
+            return false;
+        }
+        parser.feed({reinterpret_cast<const char*>(entry.data), entry.dataSize});
+        return parser.finish();
+    }
+
+    auto stream = z_stream{};
+    if (inflateInit2(&stream, ZLIB_WINDOW_BITS_RAW_DEFLATE) != Z_OK) {
+        visitor.onDiagnostic(DIAGNOSTIC_ERROR, 0, "ERROR: failed to initialize zlib");
+        return false;
+    }
+    stream.next_in = const_cast<Bytef*>(entry.data);
+    stream.avail_in = static_cast<uInt>(entry.dataSize);
+
+    // inflated to the end even once the parser stops, so the size can be checked against the declared one
+    auto decompressedBlock = std::array<char, DECOMPRESSED_BLOCK_SIZE>{};
+    auto isParserAccepting = true;
+    auto zlibResult = Z_OK;
+    auto inflatedSize = size_t{0};
+    while (zlibResult == Z_OK) {
+        stream.next_out = reinterpret_cast<Bytef*>(decompressedBlock.data());
+        stream.avail_out = static_cast<uInt>(decompressedBlock.size());
+
+        zlibResult = inflate(&stream, Z_NO_FLUSH);
+        if (zlibResult != Z_OK and zlibResult != Z_STREAM_END) {
+            inflateEnd(&stream);
+            visitor.onDiagnostic(DIAGNOSTIC_ERROR, 0, "ERROR: bad deflate data in " + entry.path);
+            return false;
+        }
+
+        auto decompressedSize = decompressedBlock.size() - stream.avail_out;
+        inflatedSize += decompressedSize;
+        if (inflatedSize > entry.size) break;
+        if (isParserAccepting) isParserAccepting = parser.feed({decompressedBlock.data(), decompressedSize});
+    }
+    inflateEnd(&stream);
+
+    if (inflatedSize != entry.size) {
+        auto inflatedSizeStr = (inflatedSize > entry.size ? "at least " : "") + std::to_string(inflatedSize);
+        visitor.onDiagnostic(DIAGNOSTIC_ERROR, 0,
+                             "ERROR: " + entry.path + " inflates to " + inflatedSizeStr + " bytes but declares " +
+                                 std::to_string(entry.size));
+        return false;
+    }
+    return parser.finish();
+}
+
+auto parseBundle(const uint8_t* bundleData, size_t bundleSize, unsigned threadCount)
+    -> std::vector<BundlePchtxtOutput> {
+    auto throwAwaySs = std::stringstream{};
+    return parseBundle(bundleData, bundleSize, throwAwaySs, threadCount);
+}
+
+auto parseBundle(const uint8_t* bundleData, size_t bundleSize, std::ostream& logOs, unsigned threadCount)
+    -> std::vector<BundlePchtxtOutput> {
+    auto listedEntries = getListedEntries(bundleData, bundleSize, logOs);
+    auto result = std::vector<BundlePchtxtOutput>(listedEntries.size());
+
+    runInParallel(listedEntries.size(), threadCount, [&](size_t entryIdx) {
+        auto& [entry, skipReason] = listedEntries[entryIdx];
+        auto& entryResult = result[entryIdx];
+        entryResult.path = entry.path;
+        if (not skipReason.empty()) {
+            entryResult.isParsedOk = false;
+            entryResult.log = "ERROR: skipped " + skipReason + "\n";
+            return;
+        }
+
+        auto logSs = std::stringstream{};
+        auto builder = PatchTextOutputBuilder{logSs};
+        entryResult.isParsedOk = parseBundleEntry(entry, builder);
+        if (entryResult.isParsedOk) entryResult.output = std::move(builder.output);
+        entryResult.log = logSs.str();
+    });
+
+    return result;
+}
+
+}  // namespace pchtxt
@@ -0,0 +1,84 @@
+/**
+ * @file pchtxt_bundle.hpp
+ * @brief Parsing of the Patch Text files inside zip and tar mod bundles
+ * @author 3096
+ *
+ * Copyright (c) 2020 3096
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pchtxt.hpp"
+
+namespace pchtxt {
+
+/**
+ * One pchtxt file inside a bundle. Points into the bundle memory, which must outlive it
+ */
+struct BundleEntry {
+    std::string path;    /*!< Path of the file inside the bundle */
+    const uint8_t* data; /*!< Start of the file data inside the bundle, compressed if isDeflated is set */
+    size_t dataSize;     /*!< Size of the file data inside the bundle */
+    size_t size;         /*!< Size of the file once decompressed */
+    bool isDeflated;     /*!< The file data is deflate compressed */
+};
+
+/**
+ * Output for one pchtxt file inside a bundle
+ */
+struct BundlePchtxtOutput {
+    std::string path;       /*!< Path of the file inside the bundle */
+    bool isParsedOk;        /*!< The file was decompressed and parsed without errors */
+    PatchTextOutput output; /*!< Compiled output of the file, empty if it could not be parsed */
+    std::string log;        /*!< Parsing logs for the file */
+};
+
+/**
+ * List the pchtxt files inside a zip or tar bundle, without decompressing anything. The format is detected from the
+ * content. Encrypted and zip64 entries are not supported, they are skipped with a warning
+ * @param bundleData the bundle content, usually a memory mapped file
+ * @param bundleSize size of the bundle content
+ * @param logOs [optional] an ostream to capture logs
+ * @return All the .pchtxt entries in the bundle, in the order they are stored
+ */
+auto getBundlePchtxtEntries(const uint8_t* bundleData, size_t bundleSize) -> std::vector<BundleEntry>;
+auto getBundlePchtxtEntries(const uint8_t* bundleData, size_t bundleSize, std::ostream& logOs)
+    -> std::vector<BundleEntry>;
+
+/**
+ * Parse one pchtxt file inside a bundle in place, decompressing it on the fly if necessary. Requires zlib
+ * @param entry the entry to parse
+ * @param visitor the visitor to report parsing events to. Decompression errors, and data that does not decompress to
+ * the size the bundle declares, are reported as DIAGNOSTIC_ERROR
+ * @return If the entry was decompressed and parsed without errors
+ */
+auto parseBundleEntry(const BundleEntry& entry, PatchTextVisitor& visitor) -> bool;
+
+/**
+ * Parse every pchtxt file inside a zip or tar bundle. Entries are parsed in parallel. Requires zlib
+ * @param bundleData the bundle content, usually a memory mapped file
+ * @param bundleSize size of the bundle content
+ * @param logOs [optional] an ostream to capture the logs of listing the bundle, such as skipped entries and errors in
+ * the archive itself. The parsing logs of each file are in its output
+ * @param threadCount how many threads to parse with. 0 to use the hardware concurrency
+ * @return Outputs for all the .pchtxt entries in the bundle, in the order they are stored. Entries that cannot be read,
+ * such as encrypted ones, are there too, not parsed ok and with the reason in their log
+ */
+auto parseBundle(const uint8_t* bundleData, size_t bundleSize, unsigned threadCount = 0)
+    -> std::vector<BundlePchtxtOutput>;
+auto parseBundle(const uint8_t* bundleData, size_t bundleSize, std::ostream& logOs, unsigned threadCount = 0)
+    -> std::vector<BundlePchtxtOutput>;
+
+}  // namespace pchtxt
@@ -0,0 +1,396 @@
+/**
+ * @file pchtxt_catalog.cpp
+ * @brief Persistent index of Patch Text files by program id and build id
+ * @author 3096
+ *
+ * Copyright (c) 2020 3096
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pchtxt_catalog.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <tuple>
+
+#include "pchtxt_trace.hpp"
+#include "pchtxt_utils.hpp"
+
+namespace pchtxt {
+
+// CONSTANTS
+
+// index layout, all little endian:
+//   header, file records sorted by path, program keys sorted by program id, build keys sorted by build id, strings
+constexpr auto INDEX_MAGIC = uint32_t{0x54414350};  // "PCAT"
+constexpr auto INDEX_VERSION = uint32_t{1};
+constexpr auto INDEX_HEADER_SIZE = size_t{24};  // magic, version, file, program key and build key counts, strings size
+constexpr auto FILE_RECORD_SIZE = size_t{40};   // path and title offsets and sizes, program id, time, size
+constexpr auto PROGRAM_KEY_SIZE = size_t{12};   // program id, file index
+constexpr auto BUILD_KEY_SIZE = BuildId::SIZE + 8;  // build id, file index, target type
+constexpr auto PROGRAM_ID_MAX_DIGITS = size_t{16};
+
+// utils
+
+inline auto readU32(const uint8_t* pos) -> uint32_t {
+    return pos[0] | pos[1] << 8 | pos[2] << 16 | static_cast<uint32_t>(pos[3]) << 24;
+}
+
+inline auto readU64(const uint8_t* pos) -> uint64_t { return readU32(pos) | uint64_t{readU32(pos + 4)} << 32; }
+
+inline void appendU32(std::vector<uint8_t>& buffer, uint32_t value) {
+    for (auto byteIdx = 0; byteIdx < 4; byteIdx++) buffer.push_back((value >> byteIdx * 8) & 0xFF);
+}
+
+inline void appendU64(std::vector<uint8_t>& buffer, uint64_t value) {
+    appendU32(buffer, static_cast<uint32_t>(value));
+    appendU32(buffer, static_cast<uint32_t>(value >> 32));
+}
+
+inline auto trimView(std::string_view str) {
+    while (not str.empty() and isAsciiSpace(str.front())) str.remove_prefix(1);
+    while (not str.empty() and isAsciiSpace(str.back())) str.remove_suffix(1);
+    return str;
+}
+
+inline auto getFirstToken(std::string_view str) {
+    return str.substr(0, std::find_if(begin(str), end(str), [](char ch) { return isAsciiSpace(ch); }) - begin(str));
+}
+
+inline auto getLowerCase(std::string_view str) {
+    auto result = std::string(str);
+    std::transform(begin(result), end(result), begin(result), toAsciiLower);
+    return result;
+}
+
+inline auto getProgramIdValue(std::string_view programIdStr) -> uint64_t {
+    programIdStr = trimView(programIdStr);
+    if (programIdStr.empty() or programIdStr.size() > PROGRAM_ID_MAX_DIGITS) return 0;
+
+    auto result = uint64_t{0};
+    for (auto ch : programIdStr) {
+        if (not isAsciiHexDigit(ch)) return 0;
+        result = result << 4 | getHexCharNibble(ch);
+    }
+    return result;
+}
+
+inline auto getFileStamp(const std::string& path, uint64_t& modifiedTime, uint64_t& fileSize) {
+    auto errorCode = std::error_code{};
+    auto lastWriteTime = std::filesystem::last_write_time(path, errorCode);
+    if (errorCode) return false;
+    fileSize = std::filesystem::file_size(path, errorCode);
+    if (errorCode) return false;
+    modifiedTime = static_cast<uint64_t>(lastWriteTime.time_since_epoch().count());
+    return true;
+}
+
+class MetaReader : public PatchTextVisitor {
+   public:
+    void onMeta(const PatchTextMeta& meta) override { this->meta = meta; }
+
+    PatchTextMeta meta{};
+};
+
+// finds the build ids a Patch Text declares one line at a time. Comments, tags and flags are matched the way the
+// parser matches them
+class BuildScanner {
+   public:
+    // false once the Patch Text stops
+    auto scanLine(std::string_view line) -> bool {
+        auto lineView = trimView(line.substr(0, getCommentPos(line)));
+        if (lineView.empty() or lineView.front() != '@') return true;  // only tag lines matter
+
+        auto lineLower = getLowerCase(lineView);
+        auto tag = getFirstToken(lineLower);
+        auto tagType = TAG_TYPES.find(tag);
+        if (tagType == TAG_STOP) return false;
+
+        if (tagType == TAG_FLAG) {
+            auto flagContent = trimView(lineView.substr(tag.size()));
+            auto flagType = getFirstToken(flagContent);
+            auto flag = FLAG_TYPES.find(getLowerCase(flagType));
+            if (flag == FLAG_NSOBID or flag == FLAG_NROBID) {
+                addBuild(flagContent.substr(flagType.size()), flag == FLAG_NROBID ? NRO : NSO);
+            }
+        } else if (tag.substr(0, std::string_view(NSOBID_TAG).size()) == NSOBID_TAG) {  // legacy, bid follows
+            auto tagSize = std::string_view(NSOBID_TAG).size();
+            if (lineView.size() > tagSize + 1) addBuild(lineView.substr(tagSize + 1), NSO);
+        }
+        return true;
+    }
+
+    std::vector<CatalogBuild> builds{};
+
+   private:
+    void addBuild(std::string_view buildIdStr, TargetType targetType) {
+        auto buildId = BuildId::fromHex(trimView(buildIdStr));
+        if (not buildId) return;
+        auto isSameBuildId = [&buildId](const CatalogBuild& build) { return build.buildId == *buildId; };
+        if (std::none_of(begin(builds), end(builds), isSameBuildId)) builds.push_back({*buildId, targetType});
+    }
+};
+
+// not utils
+
+auto getPchtxtBuilds(std::istream& input) -> std::vector<CatalogBuild> {
+    auto buildScanner = BuildScanner{};
+    auto line = std::string{};
+    while (std::getline(input, line)) {
+        if (not buildScanner.scanLine(line)) break;
+    }
+    return buildScanner.builds;
+}
+
+// catalog index
+
+auto CatalogIndex::fromData(const uint8_t* indexData, size_t indexSize) -> std::optional<CatalogIndex> {
+    if (indexSize < INDEX_HEADER_SIZE or readU32(indexData) != INDEX_MAGIC or
+        readU32(indexData + 4) != INDEX_VERSION) {
+        return {};
+    }
+
+    auto result = CatalogIndex{};
+    result.fileCount = readU32(indexData + 8);
+    result.programKeyCount = readU32(indexData + 12);
+    result.buildKeyCount = readU32(indexData + 16);
+    result.stringTableSize = readU32(indexData + 20);
+
+    auto expectedSize = uint64_t{INDEX_HEADER_SIZE} + uint64_t{result.fileCount} * FILE_RECORD_SIZE +
+                        uint64_t{result.programKeyCount} * PROGRAM_KEY_SIZE +
+                        uint64_t{result.buildKeyCount} * BUILD_KEY_SIZE + result.stringTableSize;
+    if (expectedSize != indexSize) return {};
+
+    result.fileRecords = indexData + INDEX_HEADER_SIZE;
+    result.programKeys = result.fileRecords + size_t{result.fileCount} * FILE_RECORD_SIZE;
+    result.buildKeys = result.programKeys + size_t{result.programKeyCount} * PROGRAM_KEY_SIZE;
+    result.stringTable = result.buildKeys + size_t{result.buildKeyCount} * BUILD_KEY_SIZE;
+    return result;
+}
+
+auto CatalogIndex::findByProgramId(uint64_t programId) const -> std::vector<CatalogFileView> {
+    // lower bound over the program keys
+    auto first = uint32_t{0};
+    auto count = programKeyCount;
+    while (count > 0) {
+        auto step = count / 2;
+        if (readU64(programKeys + size_t{first + step} * PROGRAM_KEY_SIZE) < programId) {
+            first += step + 1;
+            count -= step + 1;
+        } else {
+            count = step;
+        }
+    }
+
+    auto result = std::vector<CatalogFileView>{};
+    for (auto keyIdx = first; keyIdx < programKeyCount; keyIdx++) {
+        auto key = programKeys + size_t{keyIdx} * PROGRAM_KEY_SIZE;
+        if (readU64(key) != programId) break;
+        auto fileIdx = readU32(key + 8);
+        if (fileIdx < fileCount) result.push_back(getFile(fileIdx));
+    }
+    return result;
+}
+
+auto CatalogIndex::findByBuildId(const BuildId& buildId) const -> std::vector<CatalogFileView> {
+    auto buildIdBytes = buildId.getBytes().data();
+
+    // lower bound over the build keys
+    auto first = uint32_t{0};
+    auto count = buildKeyCount;
+    while (count > 0) {
+        auto step = count / 2;
+        if (std::memcmp(buildKeys + size_t{first + step} * BUILD_KEY_SIZE, buildIdBytes, BuildId::SIZE) < 0) {
+            first += step + 1;
+            count -= step + 1;
+        } else {
+            count = step;
+        }
+    }
+
+    auto result = std::vector<CatalogFileView>{};
+    for (auto keyIdx = first; keyIdx < buildKeyCount; keyIdx++) {
+        auto key = buildKeys + size_t{keyIdx} * BUILD_KEY_SIZE;
+        if (std::memcmp(key, buildIdBytes, BuildId::SIZE) != 0) break;
+        auto fileIdx = readU32(key + BuildId::SIZE);
+        if (fileIdx < fileCount) result.push_back(getFile(fileIdx));
+    }
+    return result;
+}
+
+auto CatalogIndex::findByPath(std::string_view path) const -> std::optional<CatalogFileView> {
+    auto first = uint32_t{0};
+    auto count = fileCount;
+    while (count > 0) {
+        auto step = count / 2;
+        if (getString(fileRecords + size_t{first + step} * FILE_RECORD_SIZE) < path) {
+            first += step + 1;
+            count -= step + 1;
+        } else {
+            count = step;
+        }
+    }
+
+    if (first == fileCount or getString(fileRecords + size_t{first} * FILE_RECORD_SIZE) != path) return {};
+    return getFile(first);
+}
+
+auto CatalogIndex::getFile(uint32_t fileIdx) const -> CatalogFileView {
+    auto record = fileRecords + size_t{fileIdx} * FILE_RECORD_SIZE;
+    return {fileIdx,          getString(record),    getString(record + 8), readU64(record + 16),
+            readU64(record + 24), readU64(record + 32)};
+}
+
+auto CatalogIndex::getString(const uint8_t* stringRef) const -> std::string_view {
+    auto stringOffset = readU32(stringRef);
+    auto stringSize = readU32(stringRef + 4);
+    if (uint64_t{stringOffset} + stringSize > stringTableSize) return {};  // corrupted index
+    return {reinterpret_cast<const char*>(stringTable + stringOffset), stringSize};
+}
+
+// catalog index builder
+
+CatalogIndexBuilder::CatalogIndexBuilder(const CatalogIndex& existingIndex) {
+    auto filesByIdx = std::vector<CatalogFile*>{};
+    for (auto fileIdx = uint32_t{0}; fileIdx < existingIndex.fileCount; fileIdx++) {
+        auto fileView = existingIndex.getFile(fileIdx);
+        auto& file = files[std::string(fileView.path)];
+        file = {std::string(fileView.path), std::string(fileView.title), fileView.programId, fileView.modifiedTime,
+                fileView.fileSize, {}};
+        filesByIdx.push_back(&file);
+    }
+
+    for (auto keyIdx = uint32_t{0}; keyIdx < existingIndex.buildKeyCount; keyIdx++) {
+        auto key = existingIndex.buildKeys + size_t{keyIdx} * BUILD_KEY_SIZE;
+        auto fileIdx = readU32(key + BuildId::SIZE);
+        if (fileIdx >= filesByIdx.size()) continue;
+        auto targetType = readU32(key + BuildId::SIZE + 4) == NRO ? NRO : NSO;
+        filesByIdx[fileIdx]->builds.push_back({BuildId::fromBytes(key, BuildId::SIZE), targetType});
+    }
+}
+
+auto CatalogIndexBuilder::updateFile(const std::string& path) -> bool {
+    uint64_t modifiedTime, fileSize;
+    if (not getFileStamp(path, modifiedTime, fileSize)) return false;
+
+    auto existingFile = files.find(path);
+    if (existingFile != end(files) and existingFile->second.modifiedTime == modifiedTime and
+        existingFile->second.fileSize == fileSize) {
+        return false;
+    }
+
+    auto traceSpan = TraceSpan{"load file", path};
+    auto input = std::ifstream(path, std::ios::binary);
+    if (not input) return false;
+    addFile(path, input, modifiedTime, fileSize);
+    return true;
+}
+
+void CatalogIndexBuilder::addFile(const std::string& path, std::istream& input, uint64_t modifiedTime,
+                                  uint64_t fileSize) {
+    // the meta parser and the build scanner share one pass, so the input does not need to be seekable
+    auto metaReader = MetaReader{};
+    auto metaParser = PatchTextParser{metaReader, true};
+    auto isReadingMeta = true;
+    auto buildScanner = BuildScanner{};
+    auto line = std::string{};
+    auto metaLine = std::string{};
+    while (std::getline(input, line)) {
+        if (isReadingMeta) {
+            metaLine = line;  // the parser may modify it
+            isReadingMeta = metaParser.parseLine(metaLine);
+        }
+        if (not buildScanner.scanLine(line)) break;
+    }
+    metaParser.finish();
+
+    auto& meta = metaReader.meta;
+    files[path] = {path,     meta.title, getProgramIdValue(meta.programId), modifiedTime,
+                   fileSize, std::move(buildScanner.builds)};
+}
+
+auto CatalogIndexBuilder::removeFile(const std::string& path) -> bool { return files.erase(path) > 0; }
+
+auto CatalogIndexBuilder::removeMissingFiles() -> size_t {
+    auto removedCount = size_t{0};
+    for (auto fileIter = begin(files); fileIter != end(files);) {
+        auto errorCode = std::error_code{};
+        if (not std::filesystem::exists(fileIter->first, errorCode)) {
+            fileIter = files.erase(fileIter);
+            removedCount++;
+        } else {
+            fileIter++;
+        }
+    }
+    return removedCount;
+}
+
+void CatalogIndexBuilder::write(std::ostream& ostream) const {
+    auto fileRecords = std::vector<uint8_t>{};
+    auto programKeys = std::vector<std::pair<uint64_t, uint32_t>>{};
+    auto buildKeys = std::vector<std::tuple<const BuildId*, uint32_t, TargetType>>{};
+    auto stringTable = std::vector<uint8_t>{};
+
+    auto appendString = [&](const std::string& str) {
+        appendU32(fileRecords, static_cast<uint32_t>(stringTable.size()));
+        appendU32(fileRecords, static_cast<uint32_t>(str.size()));
+        stringTable.insert(end(stringTable), begin(str), end(str));
+    };
+
+    auto fileIdx = uint32_t{0};
+    for (auto& [path, file] : files) {
+        appendString(path);
+        appendString(file.title);
+        appendU64(fileRecords, file.programId);
+        appendU64(fileRecords, file.modifiedTime);
+        appendU64(fileRecords, file.fileSize);
+
+        if (file.programId != 0) programKeys.emplace_back(file.programId, fileIdx);
+        for (auto& build : file.builds) buildKeys.emplace_back(&build.buildId, fileIdx, build.targetType);
+        fileIdx++;
+    }
+
+    // files are in path order already, so sorting keys by file index keeps matches in path order
+    std::sort(begin(programKeys), end(programKeys));
+    std::sort(begin(buildKeys), end(buildKeys), [](auto& key, auto& otherKey) {
+        if (*std::get<0>(key) != *std::get<0>(otherKey)) return *std::get<0>(key) < *std::get<0>(otherKey);
+        return std::get<1>(key) < std::get<1>(otherKey);
+    });
+
+    auto index = std::vector<uint8_t>{};
+    index.reserve(INDEX_HEADER_SIZE + fileRecords.size() + programKeys.size() * PROGRAM_KEY_SIZE +
+                  buildKeys.size() * BUILD_KEY_SIZE + stringTable.size());
+    appendU32(index, INDEX_MAGIC);
+    appendU32(index, INDEX_VERSION);
+    appendU32(index, static_cast<uint32_t>(files.size()));
+    appendU32(index, static_cast<uint32_t>(programKeys.size()));
+    appendU32(index, static_cast<uint32_t>(buildKeys.size()));
+    appendU32(index, static_cast<uint32_t>(stringTable.size()));
+    index.insert(end(index), begin(fileRecords), end(fileRecords));
+    for (auto& [programId, keyFileIdx] : programKeys) {
+        appendU64(index, programId);
+        appendU32(index, keyFileIdx);
+    }
+    for (auto& [buildId, keyFileIdx, targetType] : buildKeys) {
+        index.insert(end(index), begin(buildId->getBytes()), end(buildId->getBytes()));
+        appendU32(index, keyFileIdx);
+        appendU32(index, targetType);
+    }
+    index.insert(end(index), begin(stringTable), end(stringTable));
+
+    ostream.write(reinterpret_cast<const char*>(index.data()), index.size());
+}
+
+}  // namespace pchtxt
@@ -0,0 +1,172 @@
+/**
+ * @file pchtxt_catalog.hpp
+ * @brief Persistent index of Patch Text files by program id and build id
+ * @author 3096
+ *
+ * Copyright (c) 2020 3096
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <map>
+
+#include "pchtxt.hpp"
+
+namespace pchtxt {
+
+/**
+ * One binary a Patch Text has patches for
+ */
+struct CatalogBuild {
+    BuildId buildId;       /*!< Build ID of the target binary */
+    TargetType targetType; /*!< Type of the target binary */
+};
+
+/**
+ * Everything the catalog knows about one Patch Text file
+ */
+struct CatalogFile {
+    std::string path;                 /*!< Path of the pchtxt file */
+    std::string title;                /*!< Title from the meta data */
+    uint64_t programId;               /*!< Program ID from the meta data, 0 if missing or not hex */
+    uint64_t modifiedTime;            /*!< Modification time of the file when it was indexed, in file clock ticks */
+    uint64_t fileSize;                /*!< Size of the file when it was indexed */
+    std::vector<CatalogBuild> builds; /*!< Binaries the file declares patches for, without duplicates */
+};
+
+/**
+ * One file found in a CatalogIndex. Points into the index memory, which must outlive it
+ */
+struct CatalogFileView {
+    uint32_t fileIdx;       /*!< Position of the file in the index */
+    std::string_view path;  /*!< Path of the pchtxt file */
+    std::string_view title; /*!< Title from the meta data */
+    uint64_t programId;     /*!< Program ID from the meta data, 0 if missing or not hex */
+    uint64_t modifiedTime;  /*!< Modification time of the file when it was indexed, in file clock ticks */
+    uint64_t fileSize;      /*!< Size of the file when it was indexed */
+};
+
+/**
+ * Read the build ids a Patch Text declares with @flag nsobid, @flag nrobid and the legacy @nsobid, without parsing
+ * any patches. Stops at @stop like the parser
+ * @param input an istream from the pchtxt file
+ * @return The declared binaries in the order they appear, without duplicates. Invalid build ids are left out
+ */
+auto getPchtxtBuilds(std::istream& input) -> std::vector<CatalogBuild>;
+
+/**
+ * Read-only catalog over an index written by CatalogIndexBuilder. Lookups are binary searches over the index memory,
+ * which is never copied, so the index can be a memory mapped file
+ */
+class CatalogIndex {
+   public:
+    CatalogIndex() = default;
+
+    /**
+     * @param indexData the index content, usually a memory mapped file. Must outlive the CatalogIndex
+     * @param indexSize size of the index content
+     * @return The index, or nothing if the content is not a valid index
+     */
+    static auto fromData(const uint8_t* indexData, size_t indexSize) -> std::optional<CatalogIndex>;
+
+    /**
+     * @param programId the program id to look for
+     * @return Files with that program id, in path order
+     */
+    auto findByProgramId(uint64_t programId) const -> std::vector<CatalogFileView>;
+
+    /**
+     * @param buildId the build id to look for
+     * @return Files with patches for that build id, in path order
+     */
+    auto findByBuildId(const BuildId& buildId) const -> std::vector<CatalogFileView>;
+
+    /**
+     * @param path the path the file was indexed with
+     * @return The file, or nothing if it is not in the index
+     */
+    auto findByPath(std::string_view path) const -> std::optional<CatalogFileView>;
+
+    auto getFileCount() const -> uint32_t { return fileCount; }
+    auto getFile(uint32_t fileIdx) const -> CatalogFileView;
+
+   private:
+    friend class CatalogIndexBuilder;
+
+    auto getString(const uint8_t* stringRef) const -> std::string_view;
+
+    const uint8_t* fileRecords = nullptr;
+    const uint8_t* programKeys = nullptr;
+    const uint8_t* buildKeys = nullptr;
+    const uint8_t* stringTable = nullptr;
+    uint32_t stringTableSize = 0;
+    uint32_t fileCount = 0;
+    uint32_t programKeyCount = 0;
+    uint32_t buildKeyCount = 0;
+};
+
+/**
+ * Builds and updates a catalog index. Start from an existing index to update it incrementally, then write it out
+ */
+class CatalogIndexBuilder {
+   public:
+    CatalogIndexBuilder() = default;
+
+    /**
+     * @param existingIndex an index to start from. Its content is copied, so it does not need to outlive the builder
+     */
+    explicit CatalogIndexBuilder(const CatalogIndex& existingIndex);
+
+    /**
+     * Index a pchtxt file on disk, unless it is already indexed with the same modification time and size
+     * @param path path of the pchtxt file
+     * @return If the file was read. False if it is unchanged or could not be opened
+     */
+    auto updateFile(const std::string& path) -> bool;
+
+    /**
+     * Index a pchtxt file from any source, replacing what was indexed for the path before
+     * @param path the path to index the file with
+     * @param input an istream from the pchtxt file. It is read once, so it does not need to be seekable
+     * @param modifiedTime modification time of the file
+     * @param fileSize size of the file
+     */
+    void addFile(const std::string& path, std::istream& input, uint64_t modifiedTime, uint64_t fileSize);
+
+    /**
+     * @param path the path the file was indexed with
+     * @return If the file was in the index
+     */
+    auto removeFile(const std::string& path) -> bool;
+
+    /**
+     * Remove every indexed file that no longer exists on disk
+     * @return How many files were removed
+     */
+    auto removeMissingFiles() -> size_t;
+
+    /**
+     * Write the index, which CatalogIndex::fromData can read back
+     * @param ostream the ostream to write the index to
+     */
+    void write(std::ostream& ostream) const;
+
+    auto getFiles() const -> const std::map<std::string, CatalogFile>& { return files; }
+
+   private:
+    std::map<std::string, CatalogFile> files;  // by path, the order files are written in
+};
+
+}  // namespace pchtxt
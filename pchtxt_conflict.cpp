@@ -0,0 +1,316 @@
+/**
+ * @file pchtxt_conflict.cpp
+ * @brief Detection of conflicting patches in a Patch Text
+ * @author 3096
+ *
+ * Copyright (c) 2020 3096
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pchtxt_conflict.hpp"
+
+#include <algorithm>
+#include <array>
+
+#include "pchtxt_utils.hpp"
+
+namespace pchtxt {
+
+// CONSTANTS
+
+constexpr auto MAX_TREE_HEIGHT = 64;
+constexpr auto SCANNED_SUBTREE_HEIGHT = 3;  // small subtrees are faster to scan than to traverse
+constexpr auto SWEEP_CHUNK_SIZE = size_t{0x10000};
+
+// utils
+
+struct ModRange {
+    uint32_t begin;
+    uint64_t end;
+    size_t modIdx;
+    uint64_t prefixMaxEnd;  // max end of this range and all the ranges before it
+};
+
+struct SweepChunk {
+    const std::vector<ModRange>* ranges;
+    size_t beginIdx;
+    size_t endIdx;
+};
+
+void sweepModRanges(const SweepChunk& chunk, std::vector<std::pair<size_t, size_t>>& conflictingPairs) {
+    auto& ranges = *chunk.ranges;
+
+    // mods with a range still open at the current offset, with the end of their furthest open range
+    auto activeMods = std::vector<std::pair<size_t, uint64_t>>{};
+    auto updateActiveMod = [&activeMods](size_t modIdx, uint64_t rangeEnd) {
+        auto activeMod = std::find_if(begin(activeMods), end(activeMods),
+                                      [modIdx](auto& activeMod) { return activeMod.first == modIdx; });
+        if (activeMod == end(activeMods)) {
+            activeMods.push_back({modIdx, rangeEnd});
+        } else {
+            activeMod->second = std::max(activeMod->second, rangeEnd);
+        }
+    };
+
+    // ranges from earlier chunks can still be open, but only back to where nothing reaches into this chunk
+    auto chunkBegin = ranges[chunk.beginIdx].begin;
+    for (auto rangeIdx = chunk.beginIdx; rangeIdx-- > 0 and ranges[rangeIdx].prefixMaxEnd > chunkBegin;) {
+        if (ranges[rangeIdx].end > chunkBegin) updateActiveMod(ranges[rangeIdx].modIdx, ranges[rangeIdx].end);
+    }
+
+    for (auto rangeIdx = chunk.beginIdx; rangeIdx < chunk.endIdx; rangeIdx++) {
+        auto& range = ranges[rangeIdx];
+        activeMods.erase(std::remove_if(begin(activeMods), end(activeMods),
+                                        [&range](auto& activeMod) { return activeMod.second <= range.begin; }),
+                         end(activeMods));
+
+        for (auto& activeMod : activeMods) {
+            if (activeMod.first == range.modIdx) continue;
+            conflictingPairs.push_back(
+                {std::min(activeMod.first, range.modIdx), std::max(activeMod.first, range.modIdx)});
+        }
+        updateActiveMod(range.modIdx, range.end);
+    }
+}
+
+PatchConflictIndex::PatchConflictIndex(const PatchCollection& patchCollection)
+    : PatchConflictIndex(patchCollection, PatchEnabledSet{patchCollection}) {}
+
+PatchConflictIndex::PatchConflictIndex(const PatchCollection& patchCollection, const PatchEnabledSet& enabledSet) {
+    for (auto& patch : patchCollection.patches) {
+        auto patchIdx = patches.size();
+        patches.push_back(&patch);
+        patchIdxMap[&patch] = patchIdx;
+        patchEnabledStates.push_back(enabledSet.isEnabled(patchIdx));
+
+        if (patch.type != BIN) continue;  // only BIN patches write to the binary
+        for (auto& patchContent : patch.contents) {
+            if (patchContent.value.empty()) continue;
+            auto end = uint64_t{patchContent.offset} + patchContent.value.size();
+            ranges.push_back({patchContent.offset, end, end, patchIdx});
+        }
+    }
+
+    std::sort(begin(ranges), end(ranges), [](const Range& lhs, const Range& rhs) {
+        return lhs.begin < rhs.begin or (lhs.begin == rhs.begin and lhs.end < rhs.end);
+    });
+
+    // every range at an odd position is the root of the ranges around it, with the even positions as leaves
+    auto rangeCount = ranges.size();
+    if (rangeCount > 0) {
+        auto lastIdx = size_t{0};
+        auto lastMaxEnd = uint64_t{0};
+        for (auto rangeIdx = size_t{0}; rangeIdx < rangeCount; rangeIdx += 2) {
+            lastIdx = rangeIdx;
+            lastMaxEnd = ranges[rangeIdx].maxEnd = ranges[rangeIdx].end;
+        }
+
+        auto height = 1;
+        for (; size_t{1} << height <= rangeCount; height++) {
+            auto childDistance = size_t{1} << (height - 1);
+            for (auto rangeIdx = (childDistance << 1) - 1; rangeIdx < rangeCount; rangeIdx += childDistance << 2) {
+                auto leftMaxEnd = ranges[rangeIdx - childDistance].maxEnd;
+                auto rightMaxEnd =
+                    rangeIdx + childDistance < rangeCount ? ranges[rangeIdx + childDistance].maxEnd : lastMaxEnd;
+                ranges[rangeIdx].maxEnd = std::max({ranges[rangeIdx].end, leftMaxEnd, rightMaxEnd});
+            }
+
+            // move last up to its parent, the right children past the end take the max end from it
+            lastIdx = (lastIdx >> height & 1) ? lastIdx - childDistance : lastIdx + childDistance;
+            if (lastIdx < rangeCount and ranges[lastIdx].maxEnd > lastMaxEnd) lastMaxEnd = ranges[lastIdx].maxEnd;
+        }
+        treeHeight = height - 1;
+    }
+
+    // find every overlapping pair of patches up front, so toggling a patch does not need to search again
+    auto pairIdxMap = std::unordered_map<uint64_t, size_t>{};
+    for (auto& range : ranges) {
+        forEachOverlap(range.begin, range.end, [&](const Range& otherRange) {
+            if (otherRange.patchIdx <= range.patchIdx) return;  // each pair is found from both sides
+
+            auto overlapBegin = std::max(range.begin, otherRange.begin);
+            auto overlapEnd = std::min(range.end, otherRange.end);
+            auto overlapSize = static_cast<uint32_t>(overlapEnd - overlapBegin);
+            auto pairKey = static_cast<uint64_t>(range.patchIdx) << 32 | otherRange.patchIdx;
+
+            auto existingPair = pairIdxMap.find(pairKey);
+            if (existingPair == end(pairIdxMap)) {
+                pairIdxMap[pairKey] = overlappingPairs.size();
+                overlappingPairs.push_back({range.patchIdx, otherRange.patchIdx, overlapBegin, overlapSize});
+            } else if (overlapBegin < overlappingPairs[existingPair->second].offset) {
+                overlappingPairs[existingPair->second].offset = overlapBegin;
+                overlappingPairs[existingPair->second].size = overlapSize;
+            }
+        });
+    }
+
+    std::sort(begin(overlappingPairs), end(overlappingPairs), [](const PatchPair& lhs, const PatchPair& rhs) {
+        return lhs.patchIdx < rhs.patchIdx or (lhs.patchIdx == rhs.patchIdx and lhs.otherPatchIdx < rhs.otherPatchIdx);
+    });
+}
+
+template <typename Callback>
+void PatchConflictIndex::forEachOverlap(uint32_t begin, uint64_t end, Callback callback) const {
+    if (treeHeight < 0) return;
+
+    struct Node {
+        int height;
+        size_t rangeIdx;
+        bool isLeftDone;
+    };
+
+    auto rangeCount = ranges.size();
+    auto stack = std::array<Node, MAX_TREE_HEIGHT * 2>{};
+    auto stackSize = 0;
+    stack[stackSize++] = {treeHeight, (size_t{1} << treeHeight) - 1, false};
+
+    while (stackSize > 0) {
+        auto node = stack[--stackSize];
+
+        if (node.height <= SCANNED_SUBTREE_HEIGHT) {
+            auto scanBegin = node.rangeIdx >> node.height << node.height;
+            auto scanEnd = std::min(scanBegin + (size_t{1} << (node.height + 1)) - 1, rangeCount);
+            for (auto rangeIdx = scanBegin; rangeIdx < scanEnd and ranges[rangeIdx].begin < end; rangeIdx++) {
+                if (begin < ranges[rangeIdx].end) callback(ranges[rangeIdx]);
+            }
+
+        } else if (not node.isLeftDone) {
+            // the left child may be past the end, in which case it still has valid children
+            auto leftIdx = node.rangeIdx - (size_t{1} << (node.height - 1));
+            stack[stackSize++] = {node.height, node.rangeIdx, true};
+            if (leftIdx >= rangeCount or ranges[leftIdx].maxEnd > begin) {
+                stack[stackSize++] = {node.height - 1, leftIdx, false};
+            }
+
+        } else if (node.rangeIdx < rangeCount and ranges[node.rangeIdx].begin < end) {
+            if (begin < ranges[node.rangeIdx].end) callback(ranges[node.rangeIdx]);
+            stack[stackSize++] = {node.height - 1, node.rangeIdx + (size_t{1} << (node.height - 1)), false};
+        }
+    }
+}
+
+auto PatchConflictIndex::getConflicts() const -> std::vector<PatchConflict> {
+    auto result = std::vector<PatchConflict>{};
+    for (auto& pair : overlappingPairs) {
+        if (patchEnabledStates[pair.patchIdx] and patchEnabledStates[pair.otherPatchIdx]) {
+            result.push_back({patches[pair.patchIdx], patches[pair.otherPatchIdx], pair.offset, pair.size});
+        }
+    }
+    return result;
+}
+
+auto PatchConflictIndex::getPatchesAt(uint32_t offset) const -> std::vector<const Patch*> {
+    auto patchIdxs = std::vector<size_t>{};
+    forEachOverlap(offset, uint64_t{offset} + 1, [&](const Range& range) { patchIdxs.push_back(range.patchIdx); });
+
+    // a patch can have multiple contents at the same offset
+    std::sort(begin(patchIdxs), end(patchIdxs));
+    patchIdxs.erase(std::unique(begin(patchIdxs), end(patchIdxs)), end(patchIdxs));
+
+    auto result = std::vector<const Patch*>{};
+    for (auto patchIdx : patchIdxs) result.push_back(patches[patchIdx]);
+    return result;
+}
+
+void PatchConflictIndex::updateEnabled(const Patch& patch) { updateEnabled(patch, patch.enabled); }
+
+void PatchConflictIndex::updateEnabled(const Patch& patch, bool isEnabled) {
+    auto patchIdxFound = patchIdxMap.find(&patch);
+    if (patchIdxFound != end(patchIdxMap)) patchEnabledStates[patchIdxFound->second] = isEnabled;
+}
+
+auto getPatchConflicts(const PatchCollection& patchCollection) -> std::vector<PatchConflict> {
+    return PatchConflictIndex{patchCollection}.getConflicts();
+}
+
+auto getPatchConflicts(const PatchCollection& patchCollection, const PatchEnabledSet& enabledSet)
+    -> std::vector<PatchConflict> {
+    return PatchConflictIndex{patchCollection, enabledSet}.getConflicts();
+}
+
+auto ModConflictMatrix::isConflicting(size_t modIdx, size_t otherModIdx) const -> bool {
+    return std::binary_search(begin(conflictingPairs), end(conflictingPairs),
+                              std::make_pair(std::min(modIdx, otherModIdx), std::max(modIdx, otherModIdx)));
+}
+
+auto getModConflictMatrix(const std::vector<const PatchTextOutput*>& mods, unsigned threadCount)
+    -> ModConflictMatrix {
+    return getModConflictMatrix(mods, std::vector<const PatchEnabledOverlay*>(mods.size()), threadCount);
+}
+
+auto getModConflictMatrix(const std::vector<const PatchTextOutput*>& mods,
+                          const std::vector<const PatchEnabledOverlay*>& enabledOverlays, unsigned threadCount)
+    -> ModConflictMatrix {
+    // group the ranges of all mods by build id
+    auto groupIdxMap = std::unordered_map<BuildId, size_t>{};
+    auto rangeGroups = std::vector<std::vector<ModRange>>{};
+    for (auto modIdx = size_t{0}; modIdx < mods.size(); modIdx++) {
+        auto* enabledOverlay = modIdx < enabledOverlays.size() ? enabledOverlays[modIdx] : nullptr;
+        auto collectionIdx = size_t{0};
+        for (auto& patchCollection : mods[modIdx]->collections) {
+            auto groupFound = groupIdxMap.emplace(patchCollection.buildId, rangeGroups.size());
+            if (groupFound.second) rangeGroups.emplace_back();
+            auto& rangeGroup = rangeGroups[groupFound.first->second];
+
+            auto patchIdx = size_t{0};
+            for (auto& patch : patchCollection.patches) {
+                auto isEnabled = enabledOverlay ? enabledOverlay->isEnabled(collectionIdx, patchIdx++) : patch.enabled;
+                if (patch.type != BIN or not isEnabled) continue;
+                for (auto& patchContent : patch.contents) {
+                    if (patchContent.value.empty()) continue;
+                    auto end = uint64_t{patchContent.offset} + patchContent.value.size();
+                    rangeGroup.push_back({patchContent.offset, end, modIdx, end});
+                }
+            }
+            collectionIdx++;
+        }
+    }
+
+    runInParallel(rangeGroups.size(), threadCount, [&rangeGroups](size_t groupIdx) {
+        auto& rangeGroup = rangeGroups[groupIdx];
+        std::sort(begin(rangeGroup), end(rangeGroup),
+                  [](const ModRange& lhs, const ModRange& rhs) { return lhs.begin < rhs.begin; });
+
+        auto prefixMaxEnd = uint64_t{0};
+        for (auto& range : rangeGroup) range.prefixMaxEnd = prefixMaxEnd = std::max(prefixMaxEnd, range.end);
+    });
+
+    // big groups are split so they can be swept in parallel too
+    auto chunks = std::vector<SweepChunk>{};
+    for (auto& rangeGroup : rangeGroups) {
+        for (auto chunkBeginIdx = size_t{0}; chunkBeginIdx < rangeGroup.size(); chunkBeginIdx += SWEEP_CHUNK_SIZE) {
+            chunks.push_back(
+                {&rangeGroup, chunkBeginIdx, std::min(chunkBeginIdx + SWEEP_CHUNK_SIZE, rangeGroup.size())});
+        }
+    }
+
+    auto chunkPairs = std::vector<std::vector<std::pair<size_t, size_t>>>(chunks.size());
+    runInParallel(chunks.size(), threadCount, [&chunks, &chunkPairs](size_t chunkIdx) {
+        auto& conflictingPairs = chunkPairs[chunkIdx];
+        sweepModRanges(chunks[chunkIdx], conflictingPairs);
+        std::sort(begin(conflictingPairs), end(conflictingPairs));
+        conflictingPairs.erase(std::unique(begin(conflictingPairs), end(conflictingPairs)), end(conflictingPairs));
+    });
+
+    auto result = ModConflictMatrix{mods.size(), {}};
+    for (auto& conflictingPairs : chunkPairs) {
+        result.conflictingPairs.insert(end(result.conflictingPairs), begin(conflictingPairs), end(conflictingPairs));
+    }
+    std::sort(begin(result.conflictingPairs), end(result.conflictingPairs));
+    result.conflictingPairs.erase(std::unique(begin(result.conflictingPairs), end(result.conflictingPairs)),
+                                  end(result.conflictingPairs));
+    return result;
+}
+
+}  // namespace pchtxt
@@ -0,0 +1,143 @@
+/**
+ * @file pchtxt_conflict.hpp
+ * @brief Detection of conflicting patches in a Patch Text
+ * @author 3096
+ *
+ * Copyright (c) 2020 3096
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <unordered_map>
+
+#include "pchtxt.hpp"
+
+namespace pchtxt {
+
+/**
+ * Two patches of the same collection that write to overlapping bytes
+ */
+struct PatchConflict {
+    const Patch* patch;      /*!< The patch that comes first in the collection */
+    const Patch* otherPatch; /*!< The patch that comes later in the collection */
+    uint32_t offset;         /*!< Offset of the first byte both patches write to */
+    uint32_t size;           /*!< Size of the first overlapping byte range */
+};
+
+/**
+ * Index of the byte ranges written by the BIN patches of one collection, kept sorted by offset with the maximum range
+ * end of every subtree of an implicit binary tree over it. Building is O(n log n), looking up the patches at an
+ * offset is O(log n) plus the number of patches found. The collection must outlive the index and its patches must
+ * not be added, removed or have their contents changed while it is in use
+ */
+class PatchConflictIndex {
+   public:
+    /**
+     * @param patchCollection the collection to index
+     */
+    explicit PatchConflictIndex(const PatchCollection& patchCollection);
+
+    /**
+     * @param patchCollection the collection to index
+     * @param enabledSet which patches are enabled, instead of their enabled flags
+     */
+    PatchConflictIndex(const PatchCollection& patchCollection, const PatchEnabledSet& enabledSet);
+
+    /**
+     * @return Every pair of enabled patches that write to overlapping bytes, in collection order
+     */
+    auto getConflicts() const -> std::vector<PatchConflict>;
+
+    /**
+     * @param offset the offset to look up
+     * @return All the patches that write to the byte at the offset, enabled or not, in collection order
+     */
+    auto getPatchesAt(uint32_t offset) const -> std::vector<const Patch*>;
+
+    /**
+     * Update the conflicts after the enabled flag of one patch changed, without rebuilding the index. The overlapping
+     * ranges are found while building, so this is O(1)
+     * @param patch the patch that changed, from the indexed collection
+     * @param isEnabled [optional] the new enabled state, instead of its enabled flag
+     */
+    void updateEnabled(const Patch& patch);
+    void updateEnabled(const Patch& patch, bool isEnabled);
+
+   private:
+    struct Range {
+        uint32_t begin;
+        uint64_t end;
+        uint64_t maxEnd;
+        size_t patchIdx;
+    };
+
+    struct PatchPair {
+        size_t patchIdx;
+        size_t otherPatchIdx;
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    template <typename Callback>
+    void forEachOverlap(uint32_t begin, uint64_t end, Callback callback) const;
+
+    std::vector<const Patch*> patches{};
+    std::unordered_map<const Patch*, size_t> patchIdxMap{};
+    std::vector<bool> patchEnabledStates{};
+    std::vector<Range> ranges{};
+    int treeHeight = -1;
+    std::vector<PatchPair> overlappingPairs{};
+};
+
+/**
+ * Find the pairs of enabled patches that write to overlapping bytes in one collection
+ * @param patchCollection the collection to check
+ * @param enabledSet [optional] which patches are enabled, instead of their enabled flags
+ * @return Every pair of enabled conflicting patches, in collection order
+ */
+auto getPatchConflicts(const PatchCollection& patchCollection) -> std::vector<PatchConflict>;
+auto getPatchConflicts(const PatchCollection& patchCollection, const PatchEnabledSet& enabledSet)
+    -> std::vector<PatchConflict>;
+
+/**
+ * Which mods conflict with each other, a mod being one Patch Text. Two mods conflict when they have enabled BIN
+ * patches for the same build id that write to overlapping bytes
+ */
+struct ModConflictMatrix {
+    size_t modCount;                                         /*!< Number of mods compared */
+    std::vector<std::pair<size_t, size_t>> conflictingPairs; /*!< Conflicting mod indices, lower index first, sorted */
+
+    /**
+     * @return If the two mods conflict. O(log n) in the number of conflicting pairs
+     */
+    auto isConflicting(size_t modIdx, size_t otherModIdx) const -> bool;
+};
+
+/**
+ * Compute the conflicts between many mods. Collections are grouped by build id, and the byte ranges of each group are
+ * sorted and swept in parallel, so mods that do not touch the same bytes are never compared
+ * @param mods the parsed Patch Text of every mod
+ * @param enabledOverlays [optional] which patches of each mod are enabled, indexed like in mods. Mods without an
+ * overlay, or with nullptr, use the enabled flags of their patches
+ * @param threadCount how many threads to use. 0 to use the hardware concurrency
+ * @return The conflict matrix, with mods indexed like in mods
+ */
+auto getModConflictMatrix(const std::vector<const PatchTextOutput*>& mods, unsigned threadCount = 0)
+    -> ModConflictMatrix;
+auto getModConflictMatrix(const std::vector<const PatchTextOutput*>& mods,
+                          const std::vector<const PatchEnabledOverlay*>& enabledOverlays, unsigned threadCount = 0)
+    -> ModConflictMatrix;
+
+}  // namespace pchtxt
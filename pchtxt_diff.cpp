@@ -0,0 +1,135 @@
+/**
+ * @file pchtxt_diff.cpp
+ * @brief Generation of Patch Text from the difference between two binaries
+ * @author 3096
+ *
+ * Copyright (c) 2020 3096
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pchtxt_diff.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+namespace pchtxt {
+
+// CONSTANTS
+
+constexpr auto COMPARE_BLOCK_SIZE = size_t{0x1000};
+constexpr auto MAX_CONTENT_SIZE = size_t{0xFFFF};  // IPS records have a 16 bit size
+// binary headers
+constexpr auto NSO_MAGIC = "NSO0";
+constexpr auto NSO_MAGIC_POS = size_t{0};
+constexpr auto NRO_MAGIC = "NRO0";
+constexpr auto NRO_MAGIC_POS = size_t{0x10};
+constexpr auto MODULE_ID_POS = size_t{0x40};  // same for both NSO and NRO
+constexpr auto MODULE_ID_SIZE = size_t{0x20};
+
+// utils
+
+inline auto isMagicAt(const uint8_t* image, size_t imageSize, size_t magicPos, const char* magic) {
+    return imageSize >= magicPos + std::strlen(magic) and std::memcmp(image + magicPos, magic, std::strlen(magic)) == 0;
+}
+
+// compare word by word, which compilers turn into vector compares, to find the first differing byte
+inline auto findMismatch(const uint8_t* original, const uint8_t* modified, size_t pos, size_t endPos) {
+    while (pos + sizeof(uint64_t) <= endPos) {
+        uint64_t originalWord, modifiedWord;
+        std::memcpy(&originalWord, original + pos, sizeof(uint64_t));
+        std::memcpy(&modifiedWord, modified + pos, sizeof(uint64_t));
+        if (originalWord != modifiedWord) break;
+        pos += sizeof(uint64_t);
+    }
+    while (pos < endPos and original[pos] == modified[pos]) pos++;
+    return pos;
+}
+
+// not utils
+
+auto diffImages(const uint8_t* originalImage, const uint8_t* modifiedImage, size_t imageSize, size_t mergeDistance)
+    -> std::pmr::list<PatchContent> {
+    auto result = std::pmr::list<PatchContent>{};
+
+    auto curPos = size_t{0};
+    while (curPos < imageSize) {
+        // skip identical blocks with memcmp, which is vectorized by the standard library
+        auto blockEnd = std::min(curPos + COMPARE_BLOCK_SIZE, imageSize);
+        if (std::memcmp(originalImage + curPos, modifiedImage + curPos, blockEnd - curPos) == 0) {
+            curPos = blockEnd;
+            continue;
+        }
+
+        auto diffBegin = findMismatch(originalImage, modifiedImage, curPos, blockEnd);
+
+        // extend the difference until more than mergeDistance bytes in a row are equal
+        auto diffEnd = diffBegin + 1;
+        auto equalCount = size_t{0};
+        auto scanPos = diffEnd;
+        while (scanPos < imageSize and scanPos - diffBegin < MAX_CONTENT_SIZE) {
+            if (originalImage[scanPos] != modifiedImage[scanPos]) {
+                diffEnd = scanPos + 1;
+                equalCount = 0;
+            } else if (++equalCount > mergeDistance) {
+                break;
+            }
+            scanPos++;
+        }
+
+        result.push_back({static_cast<uint32_t>(diffBegin), {modifiedImage + diffBegin, modifiedImage + diffEnd}});
+        curPos = diffEnd;
+    }
+
+    return result;
+}
+
+auto diffBinaries(const uint8_t* originalImage, size_t originalSize, const uint8_t* modifiedImage, size_t modifiedSize,
+                  const std::string& patchName) -> PatchCollection {
+    auto throwAwaySs = std::stringstream{};
+    return diffBinaries(originalImage, originalSize, modifiedImage, modifiedSize, patchName, throwAwaySs);
+}
+
+auto diffBinaries(const uint8_t* originalImage, size_t originalSize, const uint8_t* modifiedImage, size_t modifiedSize,
+                  const std::string& patchName, std::ostream& logOs) -> PatchCollection {
+    auto result = PatchCollection{};
+
+    if (isMagicAt(originalImage, originalSize, NSO_MAGIC_POS, NSO_MAGIC)) {
+        result.targetType = NSO;
+    } else if (isMagicAt(originalImage, originalSize, NRO_MAGIC_POS, NRO_MAGIC)) {
+        result.targetType = NRO;
+    } else {
+        logOs << "ERROR: original image is neither NSO nor NRO" << std::endl;
+        return {};
+    }
+    if (originalSize < MODULE_ID_POS + MODULE_ID_SIZE) {
+        logOs << "ERROR: original image is too small" << std::endl;
+        return {};
+    }
+    result.buildId = BuildId::fromBytes(originalImage + MODULE_ID_POS, MODULE_ID_SIZE);
+
+    if (modifiedSize != originalSize) {
+        logOs << "WARNING: images differ in size, only the first " << std::min(originalSize, modifiedSize)
+              << " bytes are compared" << std::endl;
+    }
+
+    auto patch = Patch{patchName, {}, BIN, true, 0, {}};
+    patch.contents = diffImages(originalImage, modifiedImage, std::min(originalSize, modifiedSize));
+    logOs << "found " << patch.contents.size() << " differences for " << result.buildId.toString() << std::endl;
+
+    if (not patch.contents.empty()) result.patches.push_back(std::move(patch));
+    return result;
+}
+
+}  // namespace pchtxt
@@ -0,0 +1,62 @@
+/**
+ * @file pchtxt_diff.hpp
+ * @brief Generation of Patch Text from the difference between two binaries
+ * @author 3096
+ *
+ * Copyright (c) 2020 3096
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pchtxt.hpp"
+
+namespace pchtxt {
+
+/**
+ * Differences closer than this many bytes are merged into one content by default
+ */
+constexpr auto DEFAULT_DIFF_MERGE_DISTANCE = size_t{8};
+
+/**
+ * Find the bytes that differ between two images of the same size
+ * @param originalImage the original image
+ * @param modifiedImage the modified image
+ * @param imageSize size of both images
+ * @param mergeDistance differences separated by at most this many equal bytes are merged into one content
+ * @return Contents that turn the original image into the modified one, sorted by offset. Each is at most 0xFFFF
+ * bytes, the most an IPS record can hold
+ */
+auto diffImages(const uint8_t* originalImage, const uint8_t* modifiedImage, size_t imageSize,
+                size_t mergeDistance = DEFAULT_DIFF_MERGE_DISTANCE) -> std::pmr::list<PatchContent>;
+
+/**
+ * Generate a PatchCollection from an original and a modified NSO or NRO image. The build id and target type are read
+ * from the original image's header. An NSO image must be the module as laid out in memory with its 0x100 byte header
+ * in front, which is what NSO patch offsets are relative to. An NRO image is the NRO file itself
+ * @param originalImage the original image
+ * @param originalSize size of the original image
+ * @param modifiedImage the modified image. Bytes past the end of the original image are ignored
+ * @param modifiedSize size of the modified image
+ * @param patchName name of the patch holding the differences
+ * @param logOs [optional] an ostream to capture logs
+ * @return A PatchCollection with one enabled BIN patch holding all the differences. Empty if the original is not an
+ * NSO or NRO
+ */
+auto diffBinaries(const uint8_t* originalImage, size_t originalSize, const uint8_t* modifiedImage, size_t modifiedSize,
+                  const std::string& patchName) -> PatchCollection;
+auto diffBinaries(const uint8_t* originalImage, size_t originalSize, const uint8_t* modifiedImage, size_t modifiedSize,
+                  const std::string& patchName, std::ostream& logOs) -> PatchCollection;
+
+}  // namespace pchtxt
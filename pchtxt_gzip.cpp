@@ -0,0 +1,105 @@
+/**
+ * @file pchtxt_gzip.cpp
+ * @brief Parsing of gzip and zlib compressed Patch Text
+ * @author 3096
+ *
+ * Copyright (c) 2020 3096
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pchtxt_gzip.hpp"
+
+#include <zlib.h>
+
+#include <array>
+
+#include "pchtxt_trace.hpp"
+
+namespace pchtxt {
+
+// CONSTANTS
+
+constexpr auto COMPRESSED_BLOCK_SIZE = 0x10000;
+constexpr auto DECOMPRESSED_BLOCK_SIZE = 0x40000;
+constexpr auto ZLIB_WINDOW_BITS_AUTO_DETECT = 15 + 32;  // accept both gzip and zlib headers
+
+auto parseCompressedPchtxt(std::istream& compressedInput, PatchTextVisitor& visitor) -> bool {
+    auto traceSpan = TraceSpan{"load compressed pchtxt"};
+    auto stream = z_stream{};
+    if (inflateInit2(&stream, ZLIB_WINDOW_BITS_AUTO_DETECT) != Z_OK) {
+        visitor.onDiagnostic(DIAGNOSTIC_ERROR, 0, "ERROR: failed to initialize zlib");
+        return false;
+    }
+
+    auto parser = PatchTextParser{visitor};
+    auto compressedBlock = std::array<char, COMPRESSED_BLOCK_SIZE>{};
+    auto decompressedBlock = std::array<char, DECOMPRESSED_BLOCK_SIZE>{};
+    auto isParserAccepting = true;
+    auto isStreamEnded = false;
+
+    while (isParserAccepting and compressedInput) {
+        compressedInput.read(compressedBlock.data(), compressedBlock.size());
+        stream.next_in = reinterpret_cast<Bytef*>(compressedBlock.data());
+        stream.avail_in = static_cast<uInt>(compressedInput.gcount());
+
+        // keep going while there is input left, or the output block was filled and zlib may have more
+        do {
+            // gzip files can have multiple members, decompressed as one. The next one can start in a later block
+            if (isStreamEnded and stream.avail_in > 0) {
+                inflateReset(&stream);
+                isStreamEnded = false;
+            }
+
+            stream.next_out = reinterpret_cast<Bytef*>(decompressedBlock.data());
+            stream.avail_out = static_cast<uInt>(decompressedBlock.size());
+
+            auto zlibResult = inflate(&stream, Z_NO_FLUSH);
+            if (zlibResult == Z_BUF_ERROR) break;  // needs more input
+            if (zlibResult != Z_OK and zlibResult != Z_STREAM_END) {
+                inflateEnd(&stream);
+                visitor.onDiagnostic(DIAGNOSTIC_ERROR, 0,
+                                     std::string("ERROR: bad compressed data: ") +
+                                         (stream.msg != nullptr ? stream.msg : "unknown zlib error"));
+                return false;
+            }
+            isStreamEnded = zlibResult == Z_STREAM_END;
+
+            auto decompressedSize = decompressedBlock.size() - stream.avail_out;
+            isParserAccepting = parser.feed({decompressedBlock.data(), decompressedSize});
+        } while (isParserAccepting and (stream.avail_in > 0 or stream.avail_out == 0));
+    }
+
+    inflateEnd(&stream);
+
+    if (isParserAccepting and not isStreamEnded) {
+        visitor.onDiagnostic(DIAGNOSTIC_ERROR, 0, "ERROR: compressed data is truncated");
+        return false;
+    }
+
+    return parser.finish();
+}
+
+auto parseCompressedPchtxt(std::istream& compressedInput) -> PatchTextOutput {
+    auto builder = PatchTextOutputBuilder{};
+    if (not parseCompressedPchtxt(compressedInput, builder)) return {};
+    return std::move(builder.output);
+}
+
+auto parseCompressedPchtxt(std::istream& compressedInput, std::ostream& logOs) -> PatchTextOutput {
+    auto builder = PatchTextOutputBuilder{logOs};
+    if (not parseCompressedPchtxt(compressedInput, builder)) return {};
+    return std::move(builder.output);
+}
+
+}  // namespace pchtxt
@@ -0,0 +1,45 @@
+/**
+ * @file pchtxt_gzip.hpp
+ * @brief Parsing of gzip and zlib compressed Patch Text
+ * @author 3096
+ *
+ * Copyright (c) 2020 3096
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pchtxt.hpp"
+
+namespace pchtxt {
+
+/**
+ * Parse a gzip or zlib compressed Patch Text. The input is decompressed block by block straight into the parser, so
+ * the decompressed file is never held in memory as a whole. Requires zlib
+ * @param compressedInput an istream from the compressed pchtxt file
+ * @param visitor the visitor to report parsing events to. Decompression errors are reported as DIAGNOSTIC_ERROR
+ * @return If the Patch Text was decompressed and parsed without errors
+ */
+auto parseCompressedPchtxt(std::istream& compressedInput, PatchTextVisitor& visitor) -> bool;
+
+/**
+ * Compile a complete output from one gzip or zlib compressed Patch Text. Requires zlib
+ * @param compressedInput an istream from the compressed pchtxt file
+ * @param logOs [optional] an ostream to capture parsing logs
+ * @return The PatchTextOutput struct containing all the parsed information from the Patch Text
+ */
+auto parseCompressedPchtxt(std::istream& compressedInput) -> PatchTextOutput;
+auto parseCompressedPchtxt(std::istream& compressedInput, std::ostream& logOs) -> PatchTextOutput;
+
+}  // namespace pchtxt
@@ -0,0 +1,316 @@
+/**
+ * @file pchtxt_nso.cpp
+ * @brief Loading, patching and writing of NSO executables
+ * @author 3096
+ *
+ * Copyright (c) 2020 3096
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pchtxt_nso.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <thread>
+
+#include "pchtxt_trace.hpp"
+
+namespace pchtxt {
+
+// CONSTANTS
+
+constexpr auto NSO_MAGIC = "NSO0";
+constexpr auto NSO_FLAGS_POS = size_t{0x0C};
+constexpr auto NSO_SEGMENT_HEADER_POS = size_t{0x10};  // file offset, memory offset and size of each segment
+constexpr auto NSO_SEGMENT_HEADER_SIZE = size_t{0x10};
+constexpr auto NSO_MODULE_ID_POS = size_t{0x40};
+constexpr auto NSO_FILE_SIZE_POS = size_t{0x60};  // stored size of each segment
+constexpr auto NSO_COMPRESSED_FLAG = 1u;          // shifted by the segment index
+constexpr auto NSO_HASH_CHECK_FLAG = 1u << 3;     // shifted by the segment index
+constexpr auto NSO_SEGMENT_NAMES = std::array<const char*, NSO_SEGMENT_COUNT>{".text", ".rodata", ".data"};
+
+// LZ4
+constexpr auto LZ4_MIN_MATCH_SIZE = size_t{4};
+constexpr auto LZ4_LENGTH_EXTENDED = size_t{0xF};
+
+// utils
+
+inline auto readU32(const uint8_t* pos) -> uint32_t {
+    return pos[0] | pos[1] << 8 | pos[2] << 16 | static_cast<uint32_t>(pos[3]) << 24;
+}
+
+inline void writeU32(uint8_t* pos, uint32_t value) {
+    for (auto byteIdx = 0; byteIdx < 4; byteIdx++) pos[byteIdx] = (value >> byteIdx * 8) & 0xFF;
+}
+
+inline auto getSegmentHeader(const uint8_t* header, size_t segmentIdx) {
+    return header + NSO_SEGMENT_HEADER_POS + segmentIdx * NSO_SEGMENT_HEADER_SIZE;
+}
+
+// lengths of 15 continue in the following bytes, each adding up to 255
+inline auto readLz4Length(const uint8_t*& srcPos, const uint8_t* srcEnd, size_t& length) {
+    if (length != LZ4_LENGTH_EXTENDED) return true;
+    uint8_t lengthByte;
+    do {
+        if (srcPos == srcEnd) return false;
+        lengthByte = *srcPos++;
+        length += lengthByte;
+    } while (lengthByte == 0xFF);
+    return true;
+}
+
+// decompress one LZ4 block, which must fill the destination exactly
+auto decompressLz4Block(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize) -> bool {
+    auto srcPos = src;
+    auto srcEnd = src + srcSize;
+    auto dstPos = size_t{0};
+
+    while (srcPos != srcEnd) {
+        auto token = *srcPos++;
+
+        auto literalSize = static_cast<size_t>(token >> 4);
+        if (not readLz4Length(srcPos, srcEnd, literalSize)) return false;
+        if (literalSize > static_cast<size_t>(srcEnd - srcPos) or literalSize > dstSize - dstPos) return false;
+        std::memcpy(dst + dstPos, srcPos, literalSize);
+        srcPos += literalSize;
+        dstPos += literalSize;
+
+        if (srcPos == srcEnd) break;  // the last sequence only has literals
+
+        if (srcEnd - srcPos < 2) return false;
+        auto matchDistance = size_t{srcPos[0] | static_cast<size_t>(srcPos[1]) << 8};
+        srcPos += 2;
+        if (matchDistance == 0 or matchDistance > dstPos) return false;
+
+        auto matchSize = token & LZ4_LENGTH_EXTENDED;
+        if (not readLz4Length(srcPos, srcEnd, matchSize)) return false;
+        matchSize += LZ4_MIN_MATCH_SIZE;
+        if (matchSize > dstSize - dstPos) return false;
+
+        // a match can overlap the bytes it produces, which repeats them
+        if (matchDistance >= matchSize) {
+            std::memcpy(dst + dstPos, dst + dstPos - matchDistance, matchSize);
+        } else {
+            for (auto byteIdx = size_t{0}; byteIdx < matchSize; byteIdx++) {
+                dst[dstPos + byteIdx] = dst[dstPos + byteIdx - matchDistance];
+            }
+        }
+        dstPos += matchSize;
+    }
+
+    return dstPos == dstSize;
+}
+
+// not utils
+
+auto readNso(const uint8_t* nsoData, size_t nsoSize) -> std::optional<NsoFile> {
+    auto throwAwaySs = std::stringstream{};
+    return readNso(nsoData, nsoSize, throwAwaySs);
+}
+
+auto readNso(const uint8_t* nsoData, size_t nsoSize, std::ostream& logOs) -> std::optional<NsoFile> {
+    auto traceSpan = TraceSpan{"load NSO"};
+    if (nsoSize < NSO_HEADER_SIZE or std::memcmp(nsoData, NSO_MAGIC, std::strlen(NSO_MAGIC)) != 0) {
+        logOs << "ERROR: file is not an NSO" << std::endl;
+        return {};
+    }
+
+    auto result = NsoFile{};
+    std::copy(nsoData, nsoData + NSO_HEADER_SIZE, begin(result.header));
+    result.moduleId = BuildId::fromBytes(nsoData + NSO_MODULE_ID_POS, BuildId::SIZE);
+    auto flags = readU32(nsoData + NSO_FLAGS_POS);
+
+    // check every segment before decompressing any of them
+    auto dataBegin = nsoSize;
+    for (auto segmentIdx = size_t{0}; segmentIdx < NSO_SEGMENT_COUNT; segmentIdx++) {
+        auto segmentHeader = getSegmentHeader(nsoData, segmentIdx);
+        auto fileOffset = readU32(segmentHeader);
+        auto fileSize = readU32(nsoData + NSO_FILE_SIZE_POS + segmentIdx * sizeof(uint32_t));
+        auto isCompressed = (flags & NSO_COMPRESSED_FLAG << segmentIdx) != 0;
+        auto size = readU32(segmentHeader + 8);
+
+        if (fileOffset < NSO_HEADER_SIZE or uint64_t{fileOffset} + fileSize > nsoSize or
+            (not isCompressed and fileSize != size)) {
+            logOs << "ERROR: NSO " << NSO_SEGMENT_NAMES[segmentIdx] << " segment is out of bounds" << std::endl;
+            return {};
+        }
+        dataBegin = std::min<size_t>(dataBegin, fileOffset);
+        result.segments[segmentIdx].memoryOffset = readU32(segmentHeader + 4);
+        result.segments[segmentIdx].data.resize(size);
+    }
+    result.extraData.assign(nsoData + NSO_HEADER_SIZE, nsoData + dataBegin);
+
+    auto isSegmentOk = std::array<bool, NSO_SEGMENT_COUNT>{};
+    auto loadSegment = [&](size_t segmentIdx) {
+        auto segmentTraceSpan = TraceSpan{"load NSO segment", NSO_SEGMENT_NAMES[segmentIdx]};
+        auto& segmentData = result.segments[segmentIdx].data;
+        auto fileData = nsoData + readU32(getSegmentHeader(nsoData, segmentIdx));
+        auto fileSize = readU32(nsoData + NSO_FILE_SIZE_POS + segmentIdx * sizeof(uint32_t));
+        if ((flags & NSO_COMPRESSED_FLAG << segmentIdx) != 0) {
+            isSegmentOk[segmentIdx] = decompressLz4Block(fileData, fileSize, segmentData.data(), segmentData.size());
+        } else {
+            std::copy(fileData, fileData + fileSize, begin(segmentData));
+            isSegmentOk[segmentIdx] = true;
+        }
+    };
+
+    auto workers = std::vector<std::thread>{};
+    for (auto segmentIdx = size_t{1}; segmentIdx < NSO_SEGMENT_COUNT; segmentIdx++) {
+        workers.emplace_back(loadSegment, segmentIdx);
+    }
+    loadSegment(0);
+    for (auto& worker : workers) worker.join();
+
+    for (auto segmentIdx = size_t{0}; segmentIdx < NSO_SEGMENT_COUNT; segmentIdx++) {
+        if (not isSegmentOk[segmentIdx]) {
+            logOs << "ERROR: NSO " << NSO_SEGMENT_NAMES[segmentIdx] << " segment failed to decompress" << std::endl;
+            return {};
+        }
+    }
+
+    logOs << "read NSO " << result.moduleId.toString() << std::endl;
+    return result;
+}
+
+auto applyNsoPatches(NsoFile& nsoFile, const PatchCollection& patchCollection) -> bool {
+    auto throwAwaySs = std::stringstream{};
+    return applyNsoPatches(nsoFile, patchCollection, throwAwaySs);
+}
+
+auto applyNsoPatches(NsoFile& nsoFile, const PatchCollection& patchCollection, std::ostream& logOs) -> bool {
+    return applyNsoPatches(nsoFile, patchCollection, PatchEnabledSet{patchCollection}, logOs);
+}
+
+auto applyNsoPatches(NsoFile& nsoFile, const PatchCollection& patchCollection, const PatchEnabledSet& enabledSet)
+    -> bool {
+    auto throwAwaySs = std::stringstream{};
+    return applyNsoPatches(nsoFile, patchCollection, enabledSet, throwAwaySs);
+}
+
+auto applyNsoPatches(NsoFile& nsoFile, const PatchCollection& patchCollection, const PatchEnabledSet& enabledSet,
+                     std::ostream& logOs) -> bool {
+    auto traceSpan = TraceSpan{"apply patches"};
+    if (traceSpan.isRecording()) traceSpan.setDetail(patchCollection.buildId.toString());
+    if (patchCollection.targetType != NSO) {
+        logOs << "ERROR: patches for " << patchCollection.buildId.toString() << " are not for an NSO" << std::endl;
+        return false;
+    }
+    if (patchCollection.buildId != nsoFile.moduleId) {
+        logOs << "ERROR: patches are for " << patchCollection.buildId.toString() << " but the NSO is "
+              << nsoFile.moduleId.toString() << std::endl;
+        return false;
+    }
+
+    auto patchIdx = size_t{0};
+    for (auto& patch : patchCollection.patches) {
+        if (not enabledSet.isEnabled(patchIdx++) or patch.type != BIN) continue;
+
+        for (auto& patchContent : patch.contents) {
+            auto contentBegin = uint64_t{patchContent.offset};
+            auto contentEnd = contentBegin + patchContent.value.size();
+            auto writtenSize = uint64_t{0};
+
+            for (auto& segment : nsoFile.segments) {
+                // offsets count the header, which is not part of the loaded module
+                auto segmentBegin = uint64_t{segment.memoryOffset} + NSO_HEADER_SIZE;
+                auto writeBegin = std::max(contentBegin, segmentBegin);
+                auto writeEnd = std::min(contentEnd, segmentBegin + segment.data.size());
+                if (writeBegin >= writeEnd) continue;
+
+                std::copy(patchContent.value.begin() + (writeBegin - contentBegin),
+                          patchContent.value.begin() + (writeEnd - contentBegin),
+                          begin(segment.data) + (writeBegin - segmentBegin));
+                writtenSize += writeEnd - writeBegin;
+            }
+
+            if (writtenSize != patchContent.value.size()) {
+                logOs << "WARNING: " << patchContent.value.size() - writtenSize << " bytes of " << patch.name
+                      << " at offset 0x" << std::hex << patchContent.offset << std::dec
+                      << " are outside the NSO segments and were skipped" << std::endl;
+            }
+        }
+        logOs << "applied patch: " << patch.name << std::endl;
+    }
+
+    return true;
+}
+
+void writeNso(const NsoFile& nsoFile, std::ostream& ostream) {
+    auto traceSpan = TraceSpan{"write NSO"};
+    auto header = nsoFile.header;
+
+    auto flags = readU32(header.data() + NSO_FLAGS_POS);
+    for (auto segmentIdx = size_t{0}; segmentIdx < NSO_SEGMENT_COUNT; segmentIdx++) {
+        flags &= ~(NSO_COMPRESSED_FLAG << segmentIdx | NSO_HASH_CHECK_FLAG << segmentIdx);
+    }
+    writeU32(header.data() + NSO_FLAGS_POS, flags);
+
+    // segments follow the header and the extra data, in order and uncompressed
+    auto fileOffset = NSO_HEADER_SIZE + nsoFile.extraData.size();
+    for (auto segmentIdx = size_t{0}; segmentIdx < NSO_SEGMENT_COUNT; segmentIdx++) {
+        auto segmentSize = static_cast<uint32_t>(nsoFile.segments[segmentIdx].data.size());
+        auto segmentHeader = header.data() + NSO_SEGMENT_HEADER_POS + segmentIdx * NSO_SEGMENT_HEADER_SIZE;
+        writeU32(segmentHeader, static_cast<uint32_t>(fileOffset));
+        writeU32(segmentHeader + 8, segmentSize);
+        writeU32(header.data() + NSO_FILE_SIZE_POS + segmentIdx * sizeof(uint32_t), segmentSize);
+        fileOffset += segmentSize;
+    }
+
+    ostream.write(reinterpret_cast<const char*>(header.data()), header.size());
+    ostream.write(reinterpret_cast<const char*>(nsoFile.extraData.data()), nsoFile.extraData.size());
+    for (auto& segment : nsoFile.segments) {
+        ostream.write(reinterpret_cast<const char*>(segment.data.data()), segment.data.size());
+    }
+}
+
+auto getNsoImage(const NsoFile& nsoFile) -> std::vector<uint8_t> {
+    auto imageSize = NSO_HEADER_SIZE;
+    for (auto& segment : nsoFile.segments) {
+        imageSize = std::max(imageSize, NSO_HEADER_SIZE + segment.memoryOffset + segment.data.size());
+    }
+
+    auto result = std::vector<uint8_t>(imageSize);
+    std::copy(begin(nsoFile.header), end(nsoFile.header), begin(result));
+    for (auto& segment : nsoFile.segments) {
+        std::copy(begin(segment.data), end(segment.data), begin(result) + NSO_HEADER_SIZE + segment.memoryOffset);
+    }
+    return result;
+}
+
+auto patchNso(const uint8_t* nsoData, size_t nsoSize, const PatchCollection& patchCollection, std::ostream& ostream)
+    -> bool {
+    auto throwAwaySs = std::stringstream{};
+    return patchNso(nsoData, nsoSize, patchCollection, ostream, throwAwaySs);
+}
+
+auto patchNso(const uint8_t* nsoData, size_t nsoSize, const PatchCollection& patchCollection, std::ostream& ostream,
+              std::ostream& logOs) -> bool {
+    return patchNso(nsoData, nsoSize, patchCollection, PatchEnabledSet{patchCollection}, ostream, logOs);
+}
+
+auto patchNso(const uint8_t* nsoData, size_t nsoSize, const PatchCollection& patchCollection,
+              const PatchEnabledSet& enabledSet, std::ostream& ostream) -> bool {
+    auto throwAwaySs = std::stringstream{};
+    return patchNso(nsoData, nsoSize, patchCollection, enabledSet, ostream, throwAwaySs);
+}
+
+auto patchNso(const uint8_t* nsoData, size_t nsoSize, const PatchCollection& patchCollection,
+              const PatchEnabledSet& enabledSet, std::ostream& ostream, std::ostream& logOs) -> bool {
+    auto nsoFile = readNso(nsoData, nsoSize, logOs);
+    if (not nsoFile or not applyNsoPatches(*nsoFile, patchCollection, enabledSet, logOs)) return false;
+    writeNso(*nsoFile, ostream);
+    return true;
+}
+
+}  // namespace pchtxt
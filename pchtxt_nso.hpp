@@ -0,0 +1,114 @@
+/**
+ * @file pchtxt_nso.hpp
+ * @brief Loading, patching and writing of NSO executables
+ * @author 3096
+ *
+ * Copyright (c) 2020 3096
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pchtxt.hpp"
+
+namespace pchtxt {
+
+/**
+ * Size of the NSO header. NSO patch offsets count it, so offset 0x100 is the start of the loaded module
+ */
+constexpr auto NSO_HEADER_SIZE = size_t{0x100};
+
+/**
+ * Segments of an NSO, in the order they are stored
+ */
+enum NsoSegmentType { NSO_TEXT, NSO_RODATA, NSO_DATA, NSO_SEGMENT_COUNT };
+
+/**
+ * One decompressed NSO segment
+ */
+struct NsoSegment {
+    uint32_t memoryOffset;     /*!< Offset of the segment in the loaded module */
+    std::vector<uint8_t> data; /*!< Decompressed content of the segment */
+};
+
+/**
+ * An NSO with its segments decompressed
+ */
+struct NsoFile {
+    std::array<uint8_t, NSO_HEADER_SIZE> header;        /*!< The NSO header as it was read */
+    BuildId moduleId;                                   /*!< Module id from the header, the build id patches target */
+    std::vector<uint8_t> extraData;                     /*!< Bytes between the header and the first segment */
+    std::array<NsoSegment, NSO_SEGMENT_COUNT> segments; /*!< The segments, indexed by NsoSegmentType */
+};
+
+/**
+ * Read an NSO and decompress its LZ4 compressed segments, each on its own thread
+ * @param nsoData the NSO file content
+ * @param nsoSize size of the NSO file content
+ * @param logOs [optional] an ostream to capture logs
+ * @return The NSO with decompressed segments, or nothing if it is not a valid NSO
+ */
+auto readNso(const uint8_t* nsoData, size_t nsoSize) -> std::optional<NsoFile>;
+auto readNso(const uint8_t* nsoData, size_t nsoSize, std::ostream& logOs) -> std::optional<NsoFile>;
+
+/**
+ * Apply the enabled BIN patches of a PatchCollection to an NSO. Bytes that land on the header or outside the
+ * segments are skipped with a warning, the way the loader skips them
+ * @param nsoFile the NSO to patch
+ * @param patchCollection the PatchCollection to apply. Its build id must match the NSO's module id
+ * @param enabledSet [optional] which patches are enabled, instead of their enabled flags
+ * @param logOs [optional] an ostream to capture logs
+ * @return If the collection is for this NSO and was applied
+ */
+auto applyNsoPatches(NsoFile& nsoFile, const PatchCollection& patchCollection) -> bool;
+auto applyNsoPatches(NsoFile& nsoFile, const PatchCollection& patchCollection, std::ostream& logOs) -> bool;
+auto applyNsoPatches(NsoFile& nsoFile, const PatchCollection& patchCollection, const PatchEnabledSet& enabledSet)
+    -> bool;
+auto applyNsoPatches(NsoFile& nsoFile, const PatchCollection& patchCollection, const PatchEnabledSet& enabledSet,
+                     std::ostream& logOs) -> bool;
+
+/**
+ * Write an NSO with uncompressed segments to an ostream. Segment hash checks are turned off, since patched segments
+ * no longer match the hashes in the header
+ * @param nsoFile the NSO to write
+ * @param ostream the ostream to write the NSO file to
+ */
+void writeNso(const NsoFile& nsoFile, std::ostream& ostream);
+
+/**
+ * @param nsoFile the NSO to lay out
+ * @return The module as laid out in memory with the NSO header in front, the image diffBinaries expects for an NSO
+ */
+auto getNsoImage(const NsoFile& nsoFile) -> std::vector<uint8_t>;
+
+/**
+ * Read an NSO, apply the enabled BIN patches of a PatchCollection to it and write the patched NSO to an ostream
+ * @param nsoData the NSO file content
+ * @param nsoSize size of the NSO file content
+ * @param patchCollection the PatchCollection to apply. Its build id must match the NSO's module id
+ * @param enabledSet [optional] which patches are enabled, instead of their enabled flags
+ * @param ostream the ostream to write the patched NSO file to
+ * @param logOs [optional] an ostream to capture logs
+ * @return If the NSO was read and patched. Nothing is written otherwise
+ */
+auto patchNso(const uint8_t* nsoData, size_t nsoSize, const PatchCollection& patchCollection, std::ostream& ostream)
+    -> bool;
+auto patchNso(const uint8_t* nsoData, size_t nsoSize, const PatchCollection& patchCollection, std::ostream& ostream,
+              std::ostream& logOs) -> bool;
+auto patchNso(const uint8_t* nsoData, size_t nsoSize, const PatchCollection& patchCollection,
+              const PatchEnabledSet& enabledSet, std::ostream& ostream) -> bool;
+auto patchNso(const uint8_t* nsoData, size_t nsoSize, const PatchCollection& patchCollection,
+              const PatchEnabledSet& enabledSet, std::ostream& ostream, std::ostream& logOs) -> bool;
+
+}  // namespace pchtxt
@@ -0,0 +1,359 @@
+/**
+ * @file pchtxt_search.cpp
+ * @brief Trigram full text index over patch names and authors
+ * @author 3096
+ *
+ * Copyright (c) 2020 3096
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pchtxt_search.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "pchtxt_utils.hpp"
+
+namespace pchtxt {
+
+// CONSTANTS
+
+// index layout, all little endian:
+//   header, file records, collection records, patch records in file order, trigram records sorted by trigram,
+//   posting lists of delta encoded varint patch record indexes, strings
+constexpr auto INDEX_MAGIC = uint32_t{0x58495350};  // "PSIX"
+constexpr auto INDEX_VERSION = uint32_t{1};
+constexpr auto INDEX_HEADER_SIZE = size_t{32};              // magic, version, 6 counts and sizes
+constexpr auto FILE_RECORD_SIZE = size_t{8};                // path offset and size
+constexpr auto COLLECTION_RECORD_SIZE = BuildId::SIZE + 4;  // build id, file index
+constexpr auto PATCH_RECORD_SIZE = size_t{24};              // collection index, patch index, name and author
+constexpr auto TRIGRAM_RECORD_SIZE = size_t{12};            // trigram, postings offset, patch count
+constexpr auto TRIGRAM_SIZE = size_t{3};
+
+// a posting list this many times longer than the candidates left costs more to read than checking the candidates
+constexpr auto MAX_POSTINGS_PER_CANDIDATE = size_t{32};
+
+// utils
+
+inline auto readU32(const uint8_t* pos) -> uint32_t {
+    return pos[0] | pos[1] << 8 | pos[2] << 16 | static_cast<uint32_t>(pos[3]) << 24;
+}
+
+inline void appendU32(std::vector<uint8_t>& buffer, uint32_t value) {
+    for (auto byteIdx = 0; byteIdx < 4; byteIdx++) buffer.push_back((value >> byteIdx * 8) & 0xFF);
+}
+
+inline void appendVarint(std::vector<uint8_t>& buffer, uint32_t value) {
+    while (value >= 0x80) {
+        buffer.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back(static_cast<uint8_t>(value));
+}
+
+inline auto getTrigram(const char* str) -> uint32_t {
+    return static_cast<uint8_t>(toAsciiLower(str[0])) << 16 | static_cast<uint8_t>(toAsciiLower(str[1])) << 8 |
+           static_cast<uint8_t>(toAsciiLower(str[2]));
+}
+
+inline void addTrigrams(std::string_view str, std::vector<uint32_t>& trigrams) {
+    for (auto pos = size_t{0}; pos + TRIGRAM_SIZE <= str.size(); pos++) trigrams.push_back(getTrigram(&str[pos]));
+}
+
+// an empty query is in every string, even an empty one, where std::search finds it at the end
+inline auto isContainedIgnoreCase(std::string_view str, std::string_view lowerQuery) {
+    return lowerQuery.empty() or std::search(begin(str), end(str), begin(lowerQuery), end(lowerQuery),
+                       [](char strCh, char queryCh) { return toAsciiLower(strCh) == queryCh; }) != end(str);
+}
+
+// not utils
+
+auto PatchSearchIndex::fromData(const uint8_t* indexData, size_t indexSize) -> std::optional<PatchSearchIndex> {
+    if (indexSize < INDEX_HEADER_SIZE or readU32(indexData) != INDEX_MAGIC or
+        readU32(indexData + 4) != INDEX_VERSION) {
+        return {};
+    }
+
+    auto result = PatchSearchIndex{};
+    result.fileCount = readU32(indexData + 8);
+    result.collectionCount = readU32(indexData + 12);
+    result.patchCount = readU32(indexData + 16);
+    result.trigramCount = readU32(indexData + 20);
+    result.postingsSize = readU32(indexData + 24);
+    result.stringTableSize = readU32(indexData + 28);
+
+    auto expectedSize = uint64_t{INDEX_HEADER_SIZE} + uint64_t{result.fileCount} * FILE_RECORD_SIZE +
+                        uint64_t{result.collectionCount} * COLLECTION_RECORD_SIZE +
+                        uint64_t{result.patchCount} * PATCH_RECORD_SIZE +
+                        uint64_t{result.trigramCount} * TRIGRAM_RECORD_SIZE + result.postingsSize +
+                        result.stringTableSize;
+    if (expectedSize != indexSize) return {};
+    if ((result.patchCount > 0 and result.collectionCount == 0) or
+        (result.collectionCount > 0 and result.fileCount == 0)) {
+        return {};
+    }
+
+    result.fileRecords = indexData + INDEX_HEADER_SIZE;
+    result.collectionRecords = result.fileRecords + size_t{result.fileCount} * FILE_RECORD_SIZE;
+    result.patchRecords = result.collectionRecords + size_t{result.collectionCount} * COLLECTION_RECORD_SIZE;
+    result.trigramRecords = result.patchRecords + size_t{result.patchCount} * PATCH_RECORD_SIZE;
+    result.postings = result.trigramRecords + size_t{result.trigramCount} * TRIGRAM_RECORD_SIZE;
+    result.stringTable = result.postings + result.postingsSize;
+    return result;
+}
+
+auto PatchSearchIndex::search(std::string_view query, PatchSearchField fields, size_t maxHits) const
+    -> std::vector<PatchSearchHit> {
+    auto lowerQuery = std::string(query);
+    std::transform(begin(lowerQuery), end(lowerQuery), begin(lowerQuery), toAsciiLower);
+
+    auto result = std::vector<PatchSearchHit>{};
+    if (maxHits == 0) return result;
+
+    if (lowerQuery.size() < TRIGRAM_SIZE) {
+        for (auto patchRecordIdx = uint32_t{0}; patchRecordIdx < patchCount; patchRecordIdx++) {
+            if (not isMatch(patchRecordIdx, lowerQuery, fields)) continue;
+            result.push_back(getHit(patchRecordIdx));
+            if (result.size() == maxHits) break;
+        }
+        return result;
+    }
+
+    // find every trigram of the query, any one missing means nothing matches
+    auto queryTrigrams = std::vector<uint32_t>{};
+    addTrigrams(lowerQuery, queryTrigrams);
+    std::sort(begin(queryTrigrams), end(queryTrigrams));
+    queryTrigrams.erase(std::unique(begin(queryTrigrams), end(queryTrigrams)), end(queryTrigrams));
+
+    auto trigramIdxs = std::vector<uint32_t>{};
+    for (auto trigram : queryTrigrams) {
+        auto first = uint32_t{0};
+        auto count = trigramCount;
+        while (count > 0) {
+            auto step = count / 2;
+            if (readU32(trigramRecords + size_t{first + step} * TRIGRAM_RECORD_SIZE) < trigram) {
+                first += step + 1;
+                count -= step + 1;
+            } else {
+                count = step;
+            }
+        }
+        if (first == trigramCount or readU32(trigramRecords + size_t{first} * TRIGRAM_RECORD_SIZE) != trigram) {
+            return result;
+        }
+        trigramIdxs.push_back(first);
+    }
+
+    // intersect the shortest posting lists first
+    auto getPostingCount = [this](uint32_t trigramIdx) {
+        return readU32(trigramRecords + size_t{trigramIdx} * TRIGRAM_RECORD_SIZE + 8);
+    };
+    std::sort(begin(trigramIdxs), end(trigramIdxs), [&](uint32_t trigramIdx, uint32_t otherIdx) {
+        return getPostingCount(trigramIdx) < getPostingCount(otherIdx);
+    });
+
+    auto candidates = std::vector<uint32_t>{};
+    auto postingList = std::vector<uint32_t>{};
+    readPostings(trigramIdxs.front(), candidates);
+    for (auto trigramIdxIter = begin(trigramIdxs) + 1; trigramIdxIter != end(trigramIdxs); trigramIdxIter++) {
+        if (getPostingCount(*trigramIdxIter) > candidates.size() * MAX_POSTINGS_PER_CANDIDATE) break;
+        readPostings(*trigramIdxIter, postingList);
+        auto intersectionEnd = std::set_intersection(begin(candidates), end(candidates), begin(postingList),
+                                                     end(postingList), begin(candidates));
+        candidates.erase(intersectionEnd, end(candidates));
+    }
+
+    // trigrams can match out of order, so every candidate is checked
+    for (auto patchRecordIdx : candidates) {
+        if (not isMatch(patchRecordIdx, lowerQuery, fields)) continue;
+        result.push_back(getHit(patchRecordIdx));
+        if (result.size() == maxHits) break;
+    }
+    return result;
+}
+
+auto PatchSearchIndex::getString(const uint8_t* stringRef) const -> std::string_view {
+    auto stringOffset = readU32(stringRef);
+    auto stringSize = readU32(stringRef + 4);
+    if (uint64_t{stringOffset} + stringSize > stringTableSize) return {};  // corrupted index
+    return {reinterpret_cast<const char*>(stringTable + stringOffset), stringSize};
+}
+
+auto PatchSearchIndex::getHit(uint32_t patchRecordIdx) const -> PatchSearchHit {
+    auto patchRecord = patchRecords + size_t{patchRecordIdx} * PATCH_RECORD_SIZE;
+    auto collectionIdx = std::min(readU32(patchRecord), collectionCount - 1);
+    auto collectionRecord = collectionRecords + size_t{collectionIdx} * COLLECTION_RECORD_SIZE;
+    auto fileIdx = std::min(readU32(collectionRecord + BuildId::SIZE), fileCount - 1);
+
+    return {getString(fileRecords + size_t{fileIdx} * FILE_RECORD_SIZE),
+            BuildId::fromBytes(collectionRecord, BuildId::SIZE), readU32(patchRecord + 4), getString(patchRecord + 8),
+            getString(patchRecord + 16)};
+}
+
+auto PatchSearchIndex::isMatch(uint32_t patchRecordIdx, std::string_view lowerQuery, PatchSearchField fields) const
+    -> bool {
+    auto patchRecord = patchRecords + size_t{patchRecordIdx} * PATCH_RECORD_SIZE;
+    return ((fields & SEARCH_NAME) != 0 and isContainedIgnoreCase(getString(patchRecord + 8), lowerQuery)) or
+           ((fields & SEARCH_AUTHOR) != 0 and isContainedIgnoreCase(getString(patchRecord + 16), lowerQuery));
+}
+
+void PatchSearchIndex::readPostings(uint32_t trigramIdx, std::vector<uint32_t>& patchRecordIdxs) const {
+    auto trigramRecord = trigramRecords + size_t{trigramIdx} * TRIGRAM_RECORD_SIZE;
+    auto postingPos = std::min<size_t>(readU32(trigramRecord + 4), postingsSize);
+    auto postingCount = readU32(trigramRecord + 8);
+
+    patchRecordIdxs.clear();
+    patchRecordIdxs.reserve(postingCount);
+    auto patchRecordIdx = uint32_t{0};
+    for (auto postingIdx = uint32_t{0}; postingIdx < postingCount and postingPos < postingsSize; postingIdx++) {
+        auto delta = uint32_t{0};
+        for (auto shift = 0; postingPos < postingsSize and shift < 32; shift += 7) {
+            auto byte = postings[postingPos++];
+            delta |= static_cast<uint32_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) break;
+        }
+        patchRecordIdx += delta;
+        if (patchRecordIdx >= patchCount) break;  // corrupted index
+        patchRecordIdxs.push_back(patchRecordIdx);
+    }
+}
+
+// search index builder
+
+PatchSearchIndexBuilder::PatchSearchIndexBuilder(const PatchSearchIndex& existingIndex) {
+    // map nodes are stable but the collection vectors grow, so collections are found by position
+    auto collectionsByIdx = std::vector<std::pair<std::vector<IndexedCollection>*, size_t>>{};
+    for (auto collectionIdx = uint32_t{0}; collectionIdx < existingIndex.collectionCount; collectionIdx++) {
+        auto collectionRecord = existingIndex.collectionRecords + size_t{collectionIdx} * COLLECTION_RECORD_SIZE;
+        auto fileIdx = readU32(collectionRecord + BuildId::SIZE);
+        if (fileIdx >= existingIndex.fileCount) {
+            collectionsByIdx.emplace_back(nullptr, 0);
+            continue;
+        }
+        auto path = existingIndex.getString(existingIndex.fileRecords + size_t{fileIdx} * FILE_RECORD_SIZE);
+        auto& collections = files[std::string(path)];
+        collections.push_back({BuildId::fromBytes(collectionRecord, BuildId::SIZE), {}});
+        collectionsByIdx.emplace_back(&collections, collections.size() - 1);
+    }
+
+    for (auto patchRecordIdx = uint32_t{0}; patchRecordIdx < existingIndex.patchCount; patchRecordIdx++) {
+        auto patchRecord = existingIndex.patchRecords + size_t{patchRecordIdx} * PATCH_RECORD_SIZE;
+        auto collectionIdx = readU32(patchRecord);
+        if (collectionIdx >= collectionsByIdx.size() or collectionsByIdx[collectionIdx].first == nullptr) continue;
+        auto& [collections, collectionPos] = collectionsByIdx[collectionIdx];
+        (*collections)[collectionPos].patches.push_back({std::string(existingIndex.getString(patchRecord + 8)),
+                                                         std::string(existingIndex.getString(patchRecord + 16))});
+    }
+}
+
+void PatchSearchIndexBuilder::addFile(const std::string& path, const PatchTextOutput& patchTextOutput) {
+    auto& collections = files[path];
+    collections.clear();
+    for (auto& patchCollection : patchTextOutput.collections) {
+        auto& collection = collections.emplace_back(IndexedCollection{patchCollection.buildId, {}});
+        for (auto& patch : patchCollection.patches) {
+            collection.patches.push_back({std::string(patch.name), std::string(patch.author)});
+        }
+    }
+}
+
+auto PatchSearchIndexBuilder::removeFile(const std::string& path) -> bool { return files.erase(path) > 0; }
+
+void PatchSearchIndexBuilder::write(std::ostream& ostream) const {
+    auto fileRecords = std::vector<uint8_t>{};
+    auto collectionRecords = std::vector<uint8_t>{};
+    auto patchRecords = std::vector<uint8_t>{};
+    auto stringTable = std::vector<uint8_t>{};
+    auto trigramPostings = std::vector<std::pair<uint32_t, uint32_t>>{};  // trigram, patch record index
+
+    // names and authors repeat a lot, so each distinct string is stored once
+    auto stringOffsets = std::unordered_map<std::string_view, uint32_t>{};
+    auto appendString = [&](std::vector<uint8_t>& records, const std::string& str) {
+        auto [stringOffset, isNew] = stringOffsets.try_emplace(str, static_cast<uint32_t>(stringTable.size()));
+        if (isNew) stringTable.insert(end(stringTable), begin(str), end(str));
+        appendU32(records, stringOffset->second);
+        appendU32(records, static_cast<uint32_t>(str.size()));
+    };
+
+    auto fileIdx = uint32_t{0};
+    auto collectionIdx = uint32_t{0};
+    auto patchRecordIdx = uint32_t{0};
+    auto patchTrigrams = std::vector<uint32_t>{};
+    for (auto& [path, collections] : files) {
+        appendString(fileRecords, path);
+        for (auto& collection : collections) {
+            collectionRecords.insert(end(collectionRecords), begin(collection.buildId.getBytes()),
+                                     end(collection.buildId.getBytes()));
+            appendU32(collectionRecords, fileIdx);
+
+            for (auto patchIdx = size_t{0}; patchIdx < collection.patches.size(); patchIdx++) {
+                auto& patch = collection.patches[patchIdx];
+                appendU32(patchRecords, collectionIdx);
+                appendU32(patchRecords, static_cast<uint32_t>(patchIdx));
+                appendString(patchRecords, patch.name);
+                appendString(patchRecords, patch.author);
+
+                patchTrigrams.clear();
+                addTrigrams(patch.name, patchTrigrams);
+                addTrigrams(patch.author, patchTrigrams);
+                std::sort(begin(patchTrigrams), end(patchTrigrams));
+                patchTrigrams.erase(std::unique(begin(patchTrigrams), end(patchTrigrams)), end(patchTrigrams));
+                for (auto trigram : patchTrigrams) trigramPostings.emplace_back(trigram, patchRecordIdx);
+                patchRecordIdx++;
+            }
+            collectionIdx++;
+        }
+        fileIdx++;
+    }
+
+    // patch record indexes are added in order, so a stable sort by trigram keeps each posting list sorted
+    std::stable_sort(begin(trigramPostings), end(trigramPostings),
+                     [](auto& posting, auto& otherPosting) { return posting.first < otherPosting.first; });
+
+    auto trigramRecords = std::vector<uint8_t>{};
+    auto postings = std::vector<uint8_t>{};
+    auto trigramCount = uint32_t{0};
+    for (auto postingIter = begin(trigramPostings); postingIter != end(trigramPostings);) {
+        auto trigram = postingIter->first;
+        appendU32(trigramRecords, trigram);
+        appendU32(trigramRecords, static_cast<uint32_t>(postings.size()));
+
+        auto postingCount = uint32_t{0};
+        auto lastPatchRecordIdx = uint32_t{0};
+        for (; postingIter != end(trigramPostings) and postingIter->first == trigram; postingIter++) {
+            appendVarint(postings, postingIter->second - lastPatchRecordIdx);
+            lastPatchRecordIdx = postingIter->second;
+            postingCount++;
+        }
+        appendU32(trigramRecords, postingCount);
+        trigramCount++;
+    }
+
+    auto header = std::vector<uint8_t>{};
+    appendU32(header, INDEX_MAGIC);
+    appendU32(header, INDEX_VERSION);
+    appendU32(header, fileIdx);
+    appendU32(header, collectionIdx);
+    appendU32(header, patchRecordIdx);
+    appendU32(header, trigramCount);
+    appendU32(header, static_cast<uint32_t>(postings.size()));
+    appendU32(header, static_cast<uint32_t>(stringTable.size()));
+
+    for (auto section : {&header, &fileRecords, &collectionRecords, &patchRecords, &trigramRecords, &postings,
+                         &stringTable}) {
+        ostream.write(reinterpret_cast<const char*>(section->data()), section->size());
+    }
+}
+
+}  // namespace pchtxt
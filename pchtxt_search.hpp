@@ -0,0 +1,142 @@
+/**
+ * @file pchtxt_search.hpp
+ * @brief Trigram full text index over patch names and authors
+ * @author 3096
+ *
+ * Copyright (c) 2020 3096
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <limits>
+#include <map>
+
+#include "pchtxt.hpp"
+
+namespace pchtxt {
+
+/**
+ * Which patch fields a search matches against
+ */
+enum PatchSearchField { SEARCH_NAME = 1, SEARCH_AUTHOR = 2, SEARCH_NAME_OR_AUTHOR = SEARCH_NAME | SEARCH_AUTHOR };
+
+/**
+ * One patch found by a search. Points into the index memory, which must outlive it
+ */
+struct PatchSearchHit {
+    std::string_view path;   /*!< Path of the pchtxt file the patch is in */
+    BuildId buildId;         /*!< Build ID of the collection the patch is in */
+    uint32_t patchIdx;       /*!< Position of the patch in its collection */
+    std::string_view name;   /*!< Name of the patch */
+    std::string_view author; /*!< Author of the patch */
+};
+
+/**
+ * Read-only search index over an index written by PatchSearchIndexBuilder. Queries look up the trigrams of the query
+ * in a sorted table, intersect their posting lists and check the remaining patches, all in the index memory, which is
+ * never copied, so the index can be a memory mapped file
+ */
+class PatchSearchIndex {
+   public:
+    PatchSearchIndex() = default;
+
+    /**
+     * @param indexData the index content, usually a memory mapped file. Must outlive the PatchSearchIndex
+     * @param indexSize size of the index content
+     * @return The index, or nothing if the content is not a valid index
+     */
+    static auto fromData(const uint8_t* indexData, size_t indexSize) -> std::optional<PatchSearchIndex>;
+
+    /**
+     * Find patches containing a substring, ignoring ASCII case. Queries shorter than 3 bytes have no trigrams and
+     * check every patch
+     * @param query the substring to look for
+     * @param fields the fields to match against
+     * @param maxHits stop after this many hits
+     * @return Patches that match, in file path order
+     */
+    auto search(std::string_view query, PatchSearchField fields = SEARCH_NAME_OR_AUTHOR,
+                size_t maxHits = std::numeric_limits<size_t>::max()) const -> std::vector<PatchSearchHit>;
+
+    auto getPatchCount() const -> uint32_t { return patchCount; }
+
+   private:
+    friend class PatchSearchIndexBuilder;
+
+    auto getString(const uint8_t* stringRef) const -> std::string_view;
+    auto getHit(uint32_t patchRecordIdx) const -> PatchSearchHit;
+    auto isMatch(uint32_t patchRecordIdx, std::string_view lowerQuery, PatchSearchField fields) const -> bool;
+    void readPostings(uint32_t trigramIdx, std::vector<uint32_t>& patchRecordIdxs) const;
+
+    const uint8_t* fileRecords = nullptr;
+    const uint8_t* collectionRecords = nullptr;
+    const uint8_t* patchRecords = nullptr;
+    const uint8_t* trigramRecords = nullptr;
+    const uint8_t* postings = nullptr;
+    const uint8_t* stringTable = nullptr;
+    uint32_t fileCount = 0;
+    uint32_t collectionCount = 0;
+    uint32_t patchCount = 0;
+    uint32_t trigramCount = 0;
+    uint32_t postingsSize = 0;
+    uint32_t stringTableSize = 0;
+};
+
+/**
+ * Builds and updates a search index. Add each file as it is indexed, for example when CatalogIndexBuilder::updateFile
+ * reports it changed, then write the index out next to the catalog index
+ */
+class PatchSearchIndexBuilder {
+   public:
+    PatchSearchIndexBuilder() = default;
+
+    /**
+     * @param existingIndex an index to start from. Its content is copied, so it does not need to outlive the builder
+     */
+    explicit PatchSearchIndexBuilder(const PatchSearchIndex& existingIndex);
+
+    /**
+     * Index the patches of a parsed pchtxt file, replacing what was indexed for the path before
+     * @param path the path to index the file with
+     * @param patchTextOutput the parsed file
+     */
+    void addFile(const std::string& path, const PatchTextOutput& patchTextOutput);
+
+    /**
+     * @param path the path the file was indexed with
+     * @return If the file was in the index
+     */
+    auto removeFile(const std::string& path) -> bool;
+
+    /**
+     * Write the index, which PatchSearchIndex::fromData can read back
+     * @param ostream the ostream to write the index to
+     */
+    void write(std::ostream& ostream) const;
+
+   private:
+    struct IndexedPatch {
+        std::string name;
+        std::string author;
+    };
+    struct IndexedCollection {
+        BuildId buildId;
+        std::vector<IndexedPatch> patches;
+    };
+
+    std::map<std::string, std::vector<IndexedCollection>> files;  // by path, the order files are written in
+};
+
+}  // namespace pchtxt
@@ -0,0 +1,122 @@
+/**
+ * @file pchtxt_snapshot.cpp
+ * @brief Immutable Patch Text outputs shared between threads
+ * @author 3096
+ *
+ * Copyright (c) 2020 3096
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pchtxt_snapshot.hpp"
+
+#include <sstream>
+
+#include "pchtxt_utils.hpp"
+
+namespace pchtxt {
+
+// snapshot
+
+PatchTextSnapshot::PatchTextSnapshot(PatchTextOutput&& patchTextOutput,
+                                     std::shared_ptr<std::pmr::memory_resource> resource)
+    : resource(std::move(resource)), output(std::move(patchTextOutput)) {
+    collections.reserve(output.collections.size());
+    for (auto& patchCollection : output.collections) {
+        collectionIdxMap.emplace(patchCollection.buildId, collections.size());  // keeps the first one
+        collections.push_back(&patchCollection);
+    }
+}
+
+auto PatchTextSnapshot::freeze(PatchTextOutput&& patchTextOutput, std::shared_ptr<std::pmr::memory_resource> resource)
+    -> std::shared_ptr<const PatchTextSnapshot> {
+    return std::shared_ptr<const PatchTextSnapshot>(
+        new PatchTextSnapshot(std::move(patchTextOutput), std::move(resource)));
+}
+
+auto PatchTextSnapshot::parse(std::istream& input) -> std::shared_ptr<const PatchTextSnapshot> {
+    auto throwAwaySs = std::stringstream{};
+    return parse(input, throwAwaySs);
+}
+
+auto PatchTextSnapshot::parse(std::istream& input, std::ostream& logOs) -> std::shared_ptr<const PatchTextSnapshot> {
+    auto arena = std::make_shared<std::pmr::monotonic_buffer_resource>();
+    auto builder = PatchTextOutputBuilder{logOs, arena.get()};
+    if (not parsePchtxt(input, builder)) return nullptr;
+    return freeze(std::move(builder.output), std::move(arena));
+}
+
+auto PatchTextSnapshot::findCollection(const BuildId& buildId) const -> const PatchCollection* {
+    auto collectionIdxFound = collectionIdxMap.find(buildId);
+    return collectionIdxFound == end(collectionIdxMap) ? nullptr : collections[collectionIdxFound->second];
+}
+
+auto PatchTextSnapshot::findCollectionIdx(const BuildId& buildId) const -> std::optional<size_t> {
+    auto collectionIdxFound = collectionIdxMap.find(buildId);
+    if (collectionIdxFound == end(collectionIdxMap)) return {};
+    return collectionIdxFound->second;
+}
+
+auto getMemoryUsage(const PatchTextSnapshot& snapshot) -> size_t {
+    constexpr auto MAP_NODE_SIZE = getMapNodeSize<decltype(snapshot.collectionIdxMap)>();
+
+    return sizeof(snapshot) - sizeof(snapshot.output) + getMemoryUsage(snapshot.output) +
+           snapshot.collections.capacity() * sizeof(const PatchCollection*) +
+           snapshot.collectionIdxMap.bucket_count() * sizeof(void*) + snapshot.collectionIdxMap.size() * MAP_NODE_SIZE;
+}
+
+// shared patch text
+
+SharedPatchText::SharedPatchText(std::shared_ptr<const PatchTextSnapshot> snapshot) : current(std::move(snapshot)) {}
+
+auto SharedPatchText::load() const -> std::shared_ptr<const PatchTextSnapshot> {
+#if defined(__cpp_lib_atomic_shared_ptr)
+    return current.load(std::memory_order_acquire);
+#else
+    return std::atomic_load_explicit(&current, std::memory_order_acquire);
+#endif
+}
+
+auto SharedPatchText::publish(std::shared_ptr<const PatchTextSnapshot> snapshot)
+    -> std::shared_ptr<const PatchTextSnapshot> {
+#if defined(__cpp_lib_atomic_shared_ptr)
+    return current.exchange(std::move(snapshot), std::memory_order_acq_rel);
+#else
+    return std::atomic_exchange_explicit(&current, std::move(snapshot), std::memory_order_acq_rel);
+#endif
+}
+
+auto SharedPatchText::compareAndPublish(std::shared_ptr<const PatchTextSnapshot>& expected,
+                                        std::shared_ptr<const PatchTextSnapshot> snapshot) -> bool {
+#if defined(__cpp_lib_atomic_shared_ptr)
+    return current.compare_exchange_strong(expected, std::move(snapshot), std::memory_order_acq_rel,
+                                           std::memory_order_acquire);
+#else
+    return std::atomic_compare_exchange_strong_explicit(&current, &expected, std::move(snapshot),
+                                                        std::memory_order_acq_rel, std::memory_order_acquire);
+#endif
+}
+
+auto SharedPatchText::reload(std::istream& input) -> bool {
+    auto throwAwaySs = std::stringstream{};
+    return reload(input, throwAwaySs);
+}
+
+auto SharedPatchText::reload(std::istream& input, std::ostream& logOs) -> bool {
+    auto snapshot = PatchTextSnapshot::parse(input, logOs);
+    if (not snapshot) return false;
+    publish(std::move(snapshot));  // the old version is freed here, or by its last reader
+    return true;
+}
+
+}  // namespace pchtxt
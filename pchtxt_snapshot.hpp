@@ -0,0 +1,145 @@
+/**
+ * @file pchtxt_snapshot.hpp
+ * @brief Immutable Patch Text outputs shared between threads
+ * @author 3096
+ *
+ * Copyright (c) 2020 3096
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+
+#include "pchtxt.hpp"
+
+namespace pchtxt {
+
+/**
+ * A frozen PatchTextOutput. It can only be read, so any number of threads can read one snapshot at once without
+ * locks. Snapshots are only handed out as std::shared_ptr<const PatchTextSnapshot>, and live as long as a reader
+ * holds them
+ */
+class PatchTextSnapshot {
+   public:
+    /**
+     * @param patchTextOutput the output to freeze. It is moved into the snapshot
+     * @param resource [optional] the memory resource the output was allocated from, kept alive with the snapshot
+     * @return The snapshot
+     */
+    static auto freeze(PatchTextOutput&& patchTextOutput, std::shared_ptr<std::pmr::memory_resource> resource = {})
+        -> std::shared_ptr<const PatchTextSnapshot>;
+
+    /**
+     * Parse a Patch Text into a snapshot. Its lists and content values are allocated from one arena owned by the
+     * snapshot, so dropping an old version frees them at once. Meta strings and long patch names and authors are
+     * allocated apart from the arena
+     * @param input an istream from the pchtxt file
+     * @param logOs [optional] an ostream to capture parsing logs
+     * @return The snapshot, or nullptr if the pchtxt could not be parsed
+     */
+    static auto parse(std::istream& input) -> std::shared_ptr<const PatchTextSnapshot>;
+    static auto parse(std::istream& input, std::ostream& logOs) -> std::shared_ptr<const PatchTextSnapshot>;
+
+    auto getOutput() const -> const PatchTextOutput& { return output; }
+    auto getMeta() const -> const PatchTextMeta& { return output.meta; }
+    auto getCollectionCount() const -> size_t { return collections.size(); }
+    auto getCollection(size_t collectionIdx) const -> const PatchCollection& { return *collections[collectionIdx]; }
+
+    /**
+     * @param buildId build id of the binary
+     * @return The first collection for the binary, or nullptr if there is none. O(1)
+     */
+    auto findCollection(const BuildId& buildId) const -> const PatchCollection*;
+
+    /**
+     * @param buildId build id of the binary
+     * @return Position of the first collection for the binary, the index of its PatchEnabledOverlay set, or nothing
+     */
+    auto findCollectionIdx(const BuildId& buildId) const -> std::optional<size_t>;
+
+   private:
+    friend auto getMemoryUsage(const PatchTextSnapshot& snapshot) -> size_t;
+
+    PatchTextSnapshot(PatchTextOutput&& patchTextOutput, std::shared_ptr<std::pmr::memory_resource> resource);
+
+    std::shared_ptr<std::pmr::memory_resource> resource;  // declared first, so it is destroyed after the output
+    PatchTextOutput output;
+    std::vector<const PatchCollection*> collections{};
+    std::unordered_map<BuildId, size_t> collectionIdxMap{};
+};
+
+/**
+ * Estimate how many bytes a snapshot occupies, its output and lookup tables included, like getMemoryUsage of an
+ * output. Counts what the output uses, not what an arena it was parsed into has reserved
+ * @param snapshot the snapshot to measure
+ * @return The estimated size in bytes
+ */
+auto getMemoryUsage(const PatchTextSnapshot& snapshot) -> size_t;
+
+/**
+ * The current version of a Patch Text, shared by reader threads while a reloader publishes new versions. Readers load
+ * the current snapshot and keep using it for as long as they hold it, publishing swaps the pointer atomically, and an
+ * old version is freed once its last reader drops it, so readers never see a partially built output
+ */
+class SharedPatchText {
+   public:
+    SharedPatchText() = default;
+
+    /**
+     * @param snapshot the first version to publish
+     */
+    explicit SharedPatchText(std::shared_ptr<const PatchTextSnapshot> snapshot);
+
+    SharedPatchText(const SharedPatchText&) = delete;
+    auto operator=(const SharedPatchText&) -> SharedPatchText& = delete;
+
+    /**
+     * @return The current version, or nullptr if nothing was published yet
+     */
+    auto load() const -> std::shared_ptr<const PatchTextSnapshot>;
+
+    /**
+     * @param snapshot the new version. Readers that already loaded the old version keep it
+     * @return The old version
+     */
+    auto publish(std::shared_ptr<const PatchTextSnapshot> snapshot) -> std::shared_ptr<const PatchTextSnapshot>;
+
+    /**
+     * Publish a new version only if the current one is still expected, for reloaders that may race each other
+     * @param expected the version the new one was made from. Set to the current version if it is not anymore
+     * @param snapshot the new version
+     * @return If the new version was published
+     */
+    auto compareAndPublish(std::shared_ptr<const PatchTextSnapshot>& expected,
+                           std::shared_ptr<const PatchTextSnapshot> snapshot) -> bool;
+
+    /**
+     * Parse a Patch Text and publish it. The current version stays if the pchtxt could not be parsed
+     * @param input an istream from the pchtxt file
+     * @param logOs [optional] an ostream to capture parsing logs
+     * @return If the new version was published
+     */
+    auto reload(std::istream& input) -> bool;
+    auto reload(std::istream& input, std::ostream& logOs) -> bool;
+
+   private:
+#if defined(__cpp_lib_atomic_shared_ptr)
+    std::atomic<std::shared_ptr<const PatchTextSnapshot>> current{};
+#else
+    std::shared_ptr<const PatchTextSnapshot> current{};  // only accessed with the std::atomic_* shared_ptr functions
+#endif
+};
+
+}  // namespace pchtxt
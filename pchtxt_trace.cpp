@@ -0,0 +1,169 @@
+/**
+ * @file pchtxt_trace.cpp
+ * @brief Chrome trace event recording of parsing and patching stages
+ * @author 3096
+ *
+ * Copyright (c) 2020 3096
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pchtxt_trace.hpp"
+
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace pchtxt {
+
+// CONSTANTS
+
+constexpr auto TRACE_CATEGORY = "pchtxt";
+constexpr auto TRACE_PROCESS_ID = 1;
+
+// recording
+
+struct TraceEvent {
+    const char* name;
+    std::string detail;
+    std::chrono::steady_clock::time_point beginTime;
+    std::chrono::steady_clock::time_point endTime;
+};
+
+struct ThreadTraceBuffer {
+    std::mutex mutex;  // only taken by its own thread while tracing, so it is never contended until stop
+    uint32_t threadIdx;
+    uint64_t sessionIdx;
+    std::vector<TraceEvent> events;
+};
+
+struct TraceSession {
+    std::mutex mutex;
+    std::atomic<uint64_t> sessionIdx{0};
+    std::chrono::steady_clock::time_point startTime{};
+    std::vector<std::shared_ptr<ThreadTraceBuffer>> buffers{};  // kept after their thread exits
+};
+
+// never destroyed, threads may still record while statics are destroyed
+inline auto getTraceSession() -> TraceSession& {
+    static auto* session = new TraceSession{};
+    return *session;
+}
+
+inline auto getThreadIdx() -> uint32_t {
+    static auto nextThreadIdx = std::atomic<uint32_t>{0};
+    thread_local auto threadIdx = nextThreadIdx++;
+    return threadIdx;
+}
+
+thread_local std::shared_ptr<ThreadTraceBuffer> curThreadBuffer{};
+
+void Tracer::start() {
+    auto& session = getTraceSession();
+    auto lock = std::lock_guard{session.mutex};
+    session.buffers.clear();
+    session.sessionIdx++;
+    session.startTime = now();
+    enabled.store(true, std::memory_order_release);
+}
+
+void Tracer::addSpan(const char* name, std::chrono::steady_clock::time_point beginTime, std::string_view detail) {
+    if (not isEnabled()) return;
+    auto endTime = now();
+
+    auto& session = getTraceSession();
+    if (not curThreadBuffer or curThreadBuffer->sessionIdx != session.sessionIdx.load(std::memory_order_acquire)) {
+        auto lock = std::lock_guard{session.mutex};
+        if (not isEnabled()) return;  // stopped meanwhile
+        curThreadBuffer = std::make_shared<ThreadTraceBuffer>();
+        curThreadBuffer->threadIdx = getThreadIdx();
+        curThreadBuffer->sessionIdx = session.sessionIdx;
+        session.buffers.push_back(curThreadBuffer);
+    }
+
+    auto lock = std::lock_guard{curThreadBuffer->mutex};
+    curThreadBuffer->events.push_back({name, std::string(detail), beginTime, endTime});
+}
+
+// writing
+
+inline void writeJsonString(std::ostream& ostream, std::string_view str) {
+    constexpr auto HEX_DIGITS = "0123456789abcdef";
+    ostream.put('"');
+    for (auto curChar : str) {
+        auto byte = static_cast<uint8_t>(curChar);
+        if (curChar == '"' or curChar == '\\') {
+            ostream.put('\\');
+            ostream.put(curChar);
+        } else if (byte < 0x20) {
+            ostream << "\\u00" << HEX_DIGITS[byte >> 4] << HEX_DIGITS[byte & 0xF];
+        } else {
+            ostream.put(curChar);
+        }
+    }
+    ostream.put('"');
+}
+
+inline auto getTraceMicroseconds(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+void Tracer::stop(std::ostream& ostream) {
+    auto& session = getTraceSession();
+    auto buffers = std::vector<std::shared_ptr<ThreadTraceBuffer>>{};
+    auto startTime = std::chrono::steady_clock::time_point{};
+    {
+        auto lock = std::lock_guard{session.mutex};
+        enabled.store(false, std::memory_order_release);
+        buffers.swap(session.buffers);
+        startTime = session.startTime;
+    }
+
+    auto oldFlags = ostream.flags();
+    auto oldPrecision = ostream.precision();
+    ostream << std::fixed << std::setprecision(3);
+
+    ostream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    auto isFirstEvent = true;
+    for (auto& buffer : buffers) {
+        auto lock = std::lock_guard{buffer->mutex};
+
+        ostream << (isFirstEvent ? "\n" : ",\n");
+        isFirstEvent = false;
+        ostream << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << TRACE_PROCESS_ID
+                << ",\"tid\":" << buffer->threadIdx << ",\"args\":{\"name\":\"thread " << buffer->threadIdx << "\"}}";
+
+        for (auto& event : buffer->events) {
+            auto beginTime = std::max(event.beginTime, startTime);  // spans opened before start are cut
+            ostream << ",\n{\"name\":";
+            writeJsonString(ostream, event.name);
+            ostream << ",\"cat\":\"" << TRACE_CATEGORY << "\",\"ph\":\"X\",\"ts\":"
+                    << getTraceMicroseconds(beginTime - startTime)
+                    << ",\"dur\":" << getTraceMicroseconds(event.endTime - beginTime) << ",\"pid\":" << TRACE_PROCESS_ID
+                    << ",\"tid\":" << buffer->threadIdx;
+            if (not event.detail.empty()) {
+                ostream << ",\"args\":{\"detail\":";
+                writeJsonString(ostream, event.detail);
+                ostream.put('}');
+            }
+            ostream.put('}');
+        }
+    }
+    ostream << "\n]}\n";
+
+    ostream.flags(oldFlags);
+    ostream.precision(oldPrecision);
+}
+
+}  // namespace pchtxt
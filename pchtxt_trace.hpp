@@ -0,0 +1,108 @@
+/**
+ * @file pchtxt_trace.hpp
+ * @brief Chrome trace event recording of parsing and patching stages
+ * @author 3096
+ *
+ * Copyright (c) 2020 3096
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+namespace pchtxt {
+
+/**
+ * Records spans of the major stages, such as loading files, parsing meta data and build id sections, writing IPS
+ * files and applying patches, from every thread. What was recorded is written as Chrome trace event JSON, which
+ * chrome://tracing and Perfetto open with one row per thread. While not tracing, a span costs one relaxed atomic load
+ */
+class Tracer {
+   public:
+    /**
+     * Start recording, dropping anything recorded before
+     */
+    static void start();
+
+    /**
+     * Stop recording and write what was recorded. Spans still open are left out
+     * @param ostream the ostream to write the trace JSON to
+     */
+    static void stop(std::ostream& ostream);
+
+    static auto isEnabled() -> bool { return enabled.load(std::memory_order_relaxed); }
+
+    /**
+     * @return A time stamp for addSpan
+     */
+    static auto now() -> std::chrono::steady_clock::time_point { return std::chrono::steady_clock::now(); }
+
+    /**
+     * Record a span on the calling thread that ends now. Nothing is recorded while not tracing
+     * @param name name of the span. Must be a string literal, or live as long as the program
+     * @param beginTime when the span began
+     * @param detail [optional] shown with the span, such as a path or build id
+     */
+    static void addSpan(const char* name, std::chrono::steady_clock::time_point beginTime,
+                        std::string_view detail = {});
+
+   private:
+    static inline std::atomic<bool> enabled{false};
+};
+
+/**
+ * A span from its construction to its destruction, or to end(). Does nothing while not tracing
+ */
+class TraceSpan {
+   public:
+    /**
+     * @param name name of the span. Must be a string literal, or live as long as the program
+     * @param detail [optional] shown with the span, such as a path or build id. Only copied while tracing
+     */
+    explicit TraceSpan(const char* name, std::string_view detail = {}) {
+        if (not Tracer::isEnabled()) return;
+        this->name = name;
+        this->detail = detail;
+        beginTime = Tracer::now();
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    auto operator=(const TraceSpan&) -> TraceSpan& = delete;
+    ~TraceSpan() { end(); }
+
+    auto isRecording() const -> bool { return name != nullptr; }
+
+    /**
+     * @param detail shown with the span. Set it only while recording, to not build it while not tracing
+     */
+    void setDetail(std::string detail) { this->detail = std::move(detail); }
+
+    void end() {
+        if (name == nullptr) return;
+        Tracer::addSpan(name, beginTime, detail);
+        name = nullptr;
+    }
+
+   private:
+    const char* name = nullptr;  // nullptr while not tracing
+    std::string detail{};
+    std::chrono::steady_clock::time_point beginTime{};
+};
+
+}  // namespace pchtxt
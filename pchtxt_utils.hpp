@@ -0,0 +1,238 @@
+/**
+ * @file pchtxt_utils.hpp
+ * @brief Internal helpers shared by the libpchtxt sources, not part of the public API
+ * @author 3096
+ *
+ * Copyright (c) 2020 3096
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "pchtxt.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+namespace pchtxt {
+
+// Patch Text syntax
+
+inline constexpr auto COMMENT_IDENTIFIER = "/";
+inline constexpr auto ECHO_IDENTIFIER = "#";
+inline constexpr auto AUTHOR_IDENTIFIER_OPEN = "[";
+inline constexpr auto AUTHOR_IDENTIFIER_CLOSE = "]";
+inline constexpr auto AMS_CHEAT_IDENTIFIER_OPEN = "[";
+inline constexpr auto AMS_CHEAT_IDENTIFIER_CLOSE = "]";
+// meta tags
+inline constexpr auto TITLE_TAG = "@title";
+inline constexpr auto PROGRAM_ID_TAG = "@program";
+inline constexpr auto URL_TAG = "@url";
+inline constexpr auto NSOBID_TAG = "@nsobid";  // legacy
+// parsing tags
+inline constexpr auto ENABLED_TAG = "@enabled";
+inline constexpr auto DISABLED_TAG = "@disabled";
+inline constexpr auto STOP_PARSING_TAG = "@stop";
+inline constexpr auto FLAG_TAG = "@flag";
+// patch type strings
+inline constexpr auto PATCH_TYPE_BIN = "bin";
+inline constexpr auto PATCH_TYPE_HEAP = "heap";
+inline constexpr auto PATCH_TYPE_AMS = "ams";
+// flags
+inline constexpr auto BIG_ENDIAN_FLAG = "be";
+inline constexpr auto LITTLE_ENDIAN_FLAG = "le";
+inline constexpr auto NSOBID_FLAG = "nsobid";
+inline constexpr auto NROBID_FLAG = "nrobid";
+inline constexpr auto OFFSET_SHIFT_FLAG = "offset_shift";
+inline constexpr auto DEBUG_INFO_FLAG = "debug_info";
+inline constexpr auto ALT_DEBUG_INFO_FLAG = "print_values";  // legacy
+
+// ASCII
+
+// character classes of the C locale, so parsing does not depend on the process locale
+inline constexpr auto ASCII_SPACE = uint8_t{1};
+inline constexpr auto ASCII_HEX_DIGIT = uint8_t{2};
+
+constexpr auto getAsciiClassTable() {
+    auto table = std::array<uint8_t, 0x100>{};
+    for (auto ch : std::string_view(" \t\n\v\f\r")) table[static_cast<uint8_t>(ch)] |= ASCII_SPACE;
+    for (auto ch : std::string_view("0123456789ABCDEFabcdef")) table[static_cast<uint8_t>(ch)] |= ASCII_HEX_DIGIT;
+    return table;
+}
+
+constexpr auto getAsciiLowerTable() {
+    auto table = std::array<char, 0x100>{};
+    for (auto ch = 0; ch < 0x100; ch++) table[ch] = static_cast<char>(ch >= 'A' and ch <= 'Z' ? ch - 'A' + 'a' : ch);
+    return table;
+}
+
+constexpr auto getHexNibbleTable() {
+    auto table = std::array<uint8_t, 0x100>{};
+    for (auto ch = '0'; ch <= '9'; ch++) table[ch] = ch - '0';
+    for (auto ch = 'A'; ch <= 'F'; ch++) table[ch] = table[ch - 'A' + 'a'] = ch - 'A' + 10;
+    return table;
+}
+
+inline constexpr auto ASCII_CLASS_TABLE = getAsciiClassTable();
+inline constexpr auto ASCII_LOWER_TABLE = getAsciiLowerTable();
+inline constexpr auto HEX_NIBBLE_TABLE = getHexNibbleTable();
+
+inline auto isAsciiSpace(char ch) { return (ASCII_CLASS_TABLE[static_cast<uint8_t>(ch)] & ASCII_SPACE) != 0; }
+
+inline auto isAsciiHexDigit(char ch) { return (ASCII_CLASS_TABLE[static_cast<uint8_t>(ch)] & ASCII_HEX_DIGIT) != 0; }
+
+inline auto toAsciiLower(char ch) { return ASCII_LOWER_TABLE[static_cast<uint8_t>(ch)]; }
+
+inline auto getHexCharNibble(char ch) -> uint8_t {
+    return HEX_NIBBLE_TABLE[static_cast<uint8_t>(ch)];  // 0 for non hex characters, which are checked for before
+}
+
+// lines
+
+// position of the comment in a line, or its size if it has none. Comment identifiers in strings do not count, and as
+// for the string reader, a quote after a backslash does not end a string
+inline auto getCommentPos(std::string_view line) -> size_t {
+    auto isInString = false;
+    for (auto pos = size_t{0}; pos < line.size(); pos++) {
+        if (line[pos] == COMMENT_IDENTIFIER[0] and not isInString) return pos;
+        if (line[pos] == '"' and not(isInString and line[pos - 1] == '\\')) isInString = not isInString;
+    }
+    return line.size();
+}
+
+// keywords
+
+// keywords are found with a perfect hash built at compile time, so recognizing one is a hash and one compare
+template <typename Value>
+struct Keyword {
+    std::string_view str;
+    Value value;
+};
+
+template <typename Value, size_t SLOT_COUNT = 16>
+class KeywordTable {
+   public:
+    template <size_t KEYWORD_COUNT>
+    constexpr explicit KeywordTable(const std::array<Keyword<Value>, KEYWORD_COUNT>& keywords) {
+        for (auto& keyword : keywords) {
+            if (keyword.str.size() < 2) {
+                isPerfect = false;
+                continue;
+            }
+            auto& slot = slots[getSlotIdx(keyword.str)];
+            if (not slot.str.empty()) isPerfect = false;
+            slot = keyword;
+        }
+    }
+
+    constexpr auto find(std::string_view str) const -> std::optional<Value> {
+        if (str.size() < 2) return {};
+        auto& slot = slots[getSlotIdx(str)];
+        if (slot.str != str) return {};
+        return slot.value;
+    }
+
+    bool isPerfect = true;  // every keyword has its own slot
+
+   private:
+    static constexpr auto getSlotIdx(std::string_view str) -> size_t {
+        return (str.size() * 3 + static_cast<uint8_t>(str[0]) * 2 + static_cast<uint8_t>(str[1])) % SLOT_COUNT;
+    }
+
+    std::array<Keyword<Value>, SLOT_COUNT> slots{};
+};
+
+enum TagType { TAG_TITLE, TAG_PROGRAM_ID, TAG_URL, TAG_NSOBID, TAG_ENABLED, TAG_DISABLED, TAG_STOP, TAG_FLAG };
+inline constexpr auto TAG_TYPES = KeywordTable<TagType>{std::array<Keyword<TagType>, 8>{{
+    {TITLE_TAG, TAG_TITLE},
+    {PROGRAM_ID_TAG, TAG_PROGRAM_ID},
+    {URL_TAG, TAG_URL},
+    {NSOBID_TAG, TAG_NSOBID},
+    {ENABLED_TAG, TAG_ENABLED},
+    {DISABLED_TAG, TAG_DISABLED},
+    {STOP_PARSING_TAG, TAG_STOP},
+    {FLAG_TAG, TAG_FLAG},
+}}};
+static_assert(TAG_TYPES.isPerfect, "tags need their own slots, change KeywordTable::getSlotIdx");
+
+enum FlagType { FLAG_BIG_ENDIAN, FLAG_LITTLE_ENDIAN, FLAG_NSOBID, FLAG_NROBID, FLAG_OFFSET_SHIFT, FLAG_DEBUG_INFO };
+inline constexpr auto FLAG_TYPES = KeywordTable<FlagType>{std::array<Keyword<FlagType>, 7>{{
+    {BIG_ENDIAN_FLAG, FLAG_BIG_ENDIAN},
+    {LITTLE_ENDIAN_FLAG, FLAG_LITTLE_ENDIAN},
+    {NSOBID_FLAG, FLAG_NSOBID},
+    {NROBID_FLAG, FLAG_NROBID},
+    {OFFSET_SHIFT_FLAG, FLAG_OFFSET_SHIFT},
+    {DEBUG_INFO_FLAG, FLAG_DEBUG_INFO},
+    {ALT_DEBUG_INFO_FLAG, FLAG_DEBUG_INFO},
+}}};
+static_assert(FLAG_TYPES.isPerfect, "flags need their own slots, change KeywordTable::getSlotIdx");
+
+// bin is the default and does not change the type, so it is not looked up
+inline constexpr auto PATCH_TYPES = KeywordTable<PatchType>{std::array<Keyword<PatchType>, 2>{{
+    {PATCH_TYPE_HEAP, HEAP},
+    {PATCH_TYPE_AMS, AMS},
+}}};
+static_assert(PATCH_TYPES.isPerfect, "patch types need their own slots, change KeywordTable::getSlotIdx");
+
+// memory usage
+
+// the heap layouts of standard containers are not standardized, so memory usage is an estimate from the layouts of
+// libstdc++ and libc++. Other standard libraries are estimated with the libstdc++ layouts
+
+// no heap memory while the string fits in its own small buffer
+inline auto getStringHeapSize(const std::string& str) -> size_t {
+    auto* strBegin = reinterpret_cast<const char*>(&str);
+    auto isInline = str.data() >= strBegin and str.data() < strBegin + sizeof(str);
+    return isInline ? 0 : str.capacity() + 1;
+}
+
+// both libraries link list nodes both ways
+template <typename T>
+constexpr auto getListNodeSize() -> size_t {
+    struct ListNode {
+        void* next;
+        void* prev;
+        T value;
+    };
+    return sizeof(ListNode);
+}
+
+// unordered map nodes link to the next node and are counted with a cached hash. libc++ always keeps the hash and
+// libstdc++ keeps it for string keys, so for other keys this can be one word per node too many
+template <typename Map>
+constexpr auto getMapNodeSize() -> size_t {
+    return sizeof(void*) + sizeof(typename Map::value_type) + sizeof(size_t);
+}
+
+// threads
+
+// run task(0) to task(taskCount - 1), each task taken by the next free thread. 0 threads uses the hardware concurrency
+template <typename Task>
+void runInParallel(size_t taskCount, unsigned threadCount, Task task) {
+    auto nextTaskIdx = std::atomic<size_t>{0};
+    auto runTasks = [&]() {
+        for (auto taskIdx = nextTaskIdx++; taskIdx < taskCount; taskIdx = nextTaskIdx++) task(taskIdx);
+    };
+
+    if (threadCount == 0) threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    threadCount = std::min<size_t>(threadCount, taskCount);
+
+    auto workers = std::vector<std::thread>{};
+    for (auto workerIdx = 1u; workerIdx < threadCount; workerIdx++) workers.emplace_back(runTasks);
+    runTasks();
+    for (auto& worker : workers) worker.join();
+}
+
+}  // namespace pchtxt
@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../pchtxt.hpp"
+
+// upper bounds on allocations, raise them only when an allocation is added on purpose
+constexpr auto PARSE_ALLOCATIONS_PER_PARSE = size_t{32};
+constexpr auto PARSE_ALLOCATIONS_PER_LINE = size_t{3};
+constexpr auto META_ALLOCATIONS_PER_PARSE = size_t{16};
+constexpr auto META_ALLOCATIONS_PER_LINE = size_t{4};
+constexpr auto WRITE_IPS_ALLOCATIONS = size_t{0};
+constexpr auto INTERN_KNOWN_ALLOCATIONS = size_t{0};
+constexpr auto SHORT_STRING_ALLOCATIONS = size_t{0};
+constexpr auto LONG_STRING_INTERN_ALLOCATIONS = size_t{1};  // only the pool entry, the handle's copy is taken over
+
+// counting global operator new
+
+std::atomic<size_t> allocationCount{0};
+
+void* operator new(size_t size) {
+    allocationCount++;
+    if (auto* ptr = std::malloc(size == 0 ? 1 : size)) return ptr;
+    throw std::bad_alloc{};
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    allocationCount++;
+    auto alignmentSize = static_cast<size_t>(alignment);
+    if (auto* ptr = std::aligned_alloc(alignmentSize, (size + alignmentSize - 1) / alignmentSize * alignmentSize)) {
+        return ptr;
+    }
+    throw std::bad_alloc{};
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new[](size_t size, std::align_val_t alignment) { return operator new(size, alignment); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { std::free(ptr); }
+
+// corpus
+
+const char* const BUILT_IN_PCHTXTS[] = {
+    R"(@title "Super Game"
+@program 0100000000010000
+@url "https://example.com/super_game.pchtxt"
+
+@flag nsobid 0123456789ABCDEF0123456789ABCDEF01234567
+@flag offset_shift 0x100
+
+// 60 FPS [someone]
+@enabled
+00001234 1F2003D5 E0031F2A
+00001238 "hello\n world"   // trailing comment
+
+// Disabled thing [other, person]
+@disabled
+00002000 00000000
+@flag be
+00002004 12345678
+
+[AMS cheat name]
+@enabled
+04000000 00001234 00000001
+
+@flag le
+@flag nrobid ABCDEF
+// NRO patch
+@enabled
+10 AABB
+@flag nsobid 0123456789ABCDEF0123456789ABCDEF01234567
+// Merged later [x]
+@enabled
+3000 CCDD
+@stop
+ignored after stop
+)",
+    R"(# Legacy Game
+@nsobid-0102030405060708090A0B0C0D0E0F10
+
+// Legacy patch
+@enabled
+0000F0 00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17
+)",
+};
+
+// many patches, so the per line bounds are not hidden by the per parse ones
+auto getLargePchtxt() -> std::string {
+    auto pchtxtSs = std::stringstream{};
+    pchtxtSs << "@title \"Large\"\n\n@flag nsobid 0123456789ABCDEF0123456789ABCDEF01234567\n";
+    for (auto patchIdx = 0; patchIdx < 5000; patchIdx++) {
+        pchtxtSs << "\n// Patch " << patchIdx << " [author " << patchIdx % 7 << "]\n";
+        pchtxtSs << (patchIdx % 3 == 0 ? "@disabled\n" : "@enabled\n");
+        pchtxtSs << std::hex << 0x1000 + patchIdx * 0x10 << std::dec << " 1F2003D5 E0031F2A\n";
+        if (patchIdx % 5 == 0) pchtxtSs << std::hex << 0x1008 + patchIdx * 0x10 << std::dec << " \"text\"\n";
+    }
+    return pchtxtSs.str();
+}
+
+auto getLineCount(const std::string& pchtxtStr) -> size_t {
+    return std::count(begin(pchtxtStr), end(pchtxtStr), '\n') + 1;
+}
+
+// meta parsing stops at the first empty line
+auto getMetaLineCount(const std::string& pchtxtStr) -> size_t {
+    auto lineSs = std::istringstream{pchtxtStr};
+    auto line = std::string{};
+    auto lineCount = size_t{0};
+    while (std::getline(lineSs, line)) {
+        lineCount++;
+        if (line.find_first_not_of(" \t\r") == std::string::npos) break;
+    }
+    return lineCount;
+}
+
+// discards everything, so only the allocations of the writer itself are counted
+class NullStreamBuf : public std::streambuf {
+   protected:
+    auto overflow(int curChar) -> int override { return curChar; }
+    auto xsputn(const char*, std::streamsize count) -> std::streamsize override { return count; }
+};
+
+// testing
+
+auto checkAllocations(const std::string& testName, size_t allocations, size_t maxAllocations) -> bool {
+    auto isOk = allocations <= maxAllocations;
+    std::cout << (isOk ? "ok   " : "FAIL ") << testName << ": " << allocations << " allocations, at most "
+              << maxAllocations << std::endl;
+    return isOk;
+}
+
+auto testPchtxt(const std::string& name, const std::string& pchtxtStr) -> bool {
+    auto isOk = true;
+    auto lineCount = getLineCount(pchtxtStr);
+
+    auto parseInput = std::istringstream{pchtxtStr};
+    auto allocationsBefore = allocationCount.load();
+    auto output = pchtxt::parsePchtxt(parseInput);
+    isOk &= checkAllocations(name + " parsePchtxt", allocationCount - allocationsBefore,
+                             PARSE_ALLOCATIONS_PER_PARSE + PARSE_ALLOCATIONS_PER_LINE * lineCount);
+
+    auto metaInput = std::istringstream{pchtxtStr};
+    allocationsBefore = allocationCount.load();
+    auto meta = pchtxt::getPchtxtMeta(metaInput);
+    isOk &= checkAllocations(name + " getPchtxtMeta", allocationCount - allocationsBefore,
+                             META_ALLOCATIONS_PER_PARSE + META_ALLOCATIONS_PER_LINE * getMetaLineCount(pchtxtStr));
+
+    auto nullStreamBuf = NullStreamBuf{};
+    auto nullOs = std::ostream{&nullStreamBuf};
+    for (auto& patchCollection : output.collections) {
+        allocationsBefore = allocationCount.load();
+        pchtxt::writeIps(patchCollection, nullOs);
+        isOk &= checkAllocations(name + " writeIps " + patchCollection.buildId.toString(),
+                                 allocationCount - allocationsBefore, WRITE_IPS_ALLOCATIONS);
+    }
+
+    return isOk;
+}
+
+auto testInterning() -> bool {
+    auto isOk = true;
+    auto stringPool = pchtxt::StringPool{};
+    auto knownStr = stringPool.intern("someone with a long author name");
+    auto longStr = pchtxt::InternedString{"another person with a long author name"};
+    auto internedStrs = std::vector<pchtxt::InternedString>{};
+    internedStrs.reserve(3);
+
+    auto allocationsBefore = allocationCount.load();
+    internedStrs.emplace_back("someone");
+    isOk &= checkAllocations("short string without a pool", allocationCount - allocationsBefore,
+                             SHORT_STRING_ALLOCATIONS);
+
+    allocationsBefore = allocationCount.load();
+    internedStrs.push_back(stringPool.intern("someone with a long author name"));
+    internedStrs.push_back(stringPool.adopt(knownStr));
+    isOk &= checkAllocations("intern known strings", allocationCount - allocationsBefore, INTERN_KNOWN_ALLOCATIONS);
+
+    allocationsBefore = allocationCount.load();
+    auto pooledLongStr = stringPool.adopt(longStr);
+    isOk &= checkAllocations("intern long string", allocationCount - allocationsBefore,
+                             LONG_STRING_INTERN_ALLOCATIONS);
+
+    // handles outlive their pool, and stay smaller than the strings they replace
+    auto survivingStr = pchtxt::InternedString{};
+    {
+        auto shortLivedPool = pchtxt::StringPool{};
+        survivingStr = shortLivedPool.intern("a long author name that outlives its pool");
+    }
+    auto isSurviving = survivingStr == pchtxt::InternedString{"a long author name that outlives its pool"} and
+                       pooledLongStr == longStr and sizeof(pchtxt::InternedString) < sizeof(std::string);
+    std::cout << (isSurviving ? "ok   " : "FAIL ") << "interned strings outlive the pool in "
+              << sizeof(pchtxt::InternedString) << " byte handles" << std::endl;
+    isOk &= isSurviving;
+    return isOk;
+}
+
+int main(int argc, char const* argv[]) {
+    auto isOk = true;
+    if (argc > 1) {  // a corpus of pchtxt files
+        for (auto argIdx = 1; argIdx < argc; argIdx++) {
+            auto pchtxtInStream = std::ifstream(argv[argIdx], std::ios::binary);
+            auto pchtxtSs = std::stringstream{};
+            pchtxtSs << pchtxtInStream.rdbuf();
+            isOk &= testPchtxt(argv[argIdx], pchtxtSs.str());
+        }
+    } else {
+        auto builtInIdx = 0;
+        for (auto* pchtxtStr : BUILT_IN_PCHTXTS) {
+            isOk &= testPchtxt("built-in " + std::to_string(builtInIdx++), pchtxtStr);
+        }
+        isOk &= testPchtxt("large", getLargePchtxt());
+        isOk &= testInterning();
+    }
+
+    std::cout << (isOk ? "all allocation bounds hold" : "allocation bounds exceeded") << std::endl;
+    return isOk ? 0 : 1;
+}
@@ -0,0 +1,147 @@
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../pchtxt_atmosphere.hpp"
+
+namespace fs = std::filesystem;
+
+// corpus
+
+constexpr auto PCHTXT_STR = R"(@title "Some: Game/Mod "
+@program 0100abc000000000
+
+@flag nsobid 0123456789ABCDEF
+// One [me]
+@enabled
+00001000 DEADBEEF
+
+[Inf Money]
+@enabled
+04000000 00001000 0000FFFF
+
+[Disabled cheat]
+@disabled
+04000000 00002000 0000FFFF
+
+@flag nrobid ABCD
+// Two
+@enabled
+00000010 0102
+)";
+
+// no cheats, so it can be exported under many names at once
+constexpr auto BATCH_PCHTXT_STR = R"(@title Batch
+
+@flag nsobid 00112233445566778899AABBCCDDEEFF00112233
+// Patch
+@enabled
+00002000 00000000
+)";
+
+constexpr auto IPS_PATH = "atmosphere/exefs_patches/Some_ Game_Mod/0123456789ABCDEF000000000000000000000000.ips";
+constexpr auto NRO_IPS_PATH = "atmosphere/nro_patches/Some_ Game_Mod/ABCD000000000000000000000000000000000000.ips";
+constexpr auto CHEATS_PATH = "atmosphere/contents/0100ABC000000000/cheats/0123456789ABCDEF.txt";
+
+// utils
+
+auto readFile(const fs::path& path) -> std::string {
+    auto fileStream = std::ifstream(path, std::ios::binary);
+    auto fileSs = std::stringstream{};
+    fileSs << fileStream.rdbuf();
+    return fileSs.str();
+}
+
+void writeFile(const fs::path& path, const std::string& content) {
+    fs::create_directories(path.parent_path());
+    auto fileStream = std::ofstream(path, std::ios::binary);
+    fileStream << content;
+}
+
+// files the export leaves behind when it is done, which there should be none of
+auto getLeftoverCount(const fs::path& rootPath) -> size_t {
+    auto leftoverCount = size_t{0};
+    for (auto& entry : fs::recursive_directory_iterator(rootPath)) {
+        auto extension = entry.path().extension();
+        if (extension == ".tmp" or extension == ".bak") leftoverCount++;
+    }
+    return leftoverCount;
+}
+
+// testing
+
+auto check(const std::string& testName, bool isOk) -> bool {
+    std::cout << (isOk ? "ok   " : "FAIL ") << testName << std::endl;
+    return isOk;
+}
+
+auto testLayout(const pchtxt::PatchTextOutput& output, const fs::path& rootPath) -> bool {
+    auto isOk = true;
+    auto logSs = std::stringstream{};
+    isOk &= check("layout export", pchtxt::exportAtmosphere(output, rootPath.string(), logSs));
+
+    auto ipsStr = readFile(rootPath / IPS_PATH);
+    isOk &= check("layout IPS file", ipsStr.compare(0, 5, "IPS32") == 0);
+    isOk &= check("layout NRO IPS file", fs::is_regular_file(rootPath / NRO_IPS_PATH));
+    isOk &= check("layout cheats are enabled only",
+                  readFile(rootPath / CHEATS_PATH) == "[Inf Money]\n04000000 00001000 0000FFFF\n\n");
+    isOk &= check("layout leaves no temp files", getLeftoverCount(rootPath) == 0);
+    return isOk;
+}
+
+auto testDuplicate(const pchtxt::PatchTextOutput& output, const fs::path& rootPath) -> bool {
+    auto logSs = std::stringstream{};
+    auto isExported = pchtxt::exportAtmosphere({{&output, "same"}, {&output, "same"}}, rootPath.string(), logSs);
+    return check("duplicate export is refused", not isExported and not fs::exists(rootPath));
+}
+
+// a directory in place of the cheats file makes its rename fail after the IPS files were renamed
+auto testRollback(const pchtxt::PatchTextOutput& output, const fs::path& rootPath) -> bool {
+    auto isOk = true;
+    writeFile(rootPath / IPS_PATH, "old");
+    fs::create_directories(rootPath / CHEATS_PATH);
+
+    auto logSs = std::stringstream{};
+    isOk &= check("rollback export fails", not pchtxt::exportAtmosphere(output, rootPath.string(), logSs));
+    isOk &= check("rollback restores replaced file", readFile(rootPath / IPS_PATH) == "old");
+    isOk &= check("rollback removes added file", not fs::exists(rootPath / NRO_IPS_PATH));
+    isOk &= check("rollback leaves no temp files", getLeftoverCount(rootPath) == 0);
+    return isOk;
+}
+
+auto testBatch(const pchtxt::PatchTextOutput& output, const fs::path& rootPath) -> bool {
+    auto exports = std::vector<pchtxt::AtmosphereExport>{};
+    for (auto exportIdx = 0; exportIdx < 20; exportIdx++) {
+        exports.push_back({&output, "mod" + std::to_string(exportIdx)});
+    }
+
+    auto logSs = std::stringstream{};
+    auto isOk = check("batch export", pchtxt::exportAtmosphere(exports, rootPath.string(), logSs, 4));
+    if (not isOk) return false;
+    auto ipsCount = size_t{0};
+    for (auto& entry : fs::recursive_directory_iterator(rootPath)) ipsCount += entry.path().extension() == ".ips";
+    isOk &= check("batch writes every IPS file", ipsCount == exports.size());
+    return isOk;
+}
+
+int main() {
+    auto pchtxtInput = std::istringstream{PCHTXT_STR};
+    auto output = pchtxt::parsePchtxt(pchtxtInput);
+    auto testPath = fs::temp_directory_path() / "pchtxt_atmosphere_test";
+    fs::remove_all(testPath);
+
+    auto isOk = true;
+    isOk &= testLayout(output, testPath / "layout");
+    isOk &= testDuplicate(output, testPath / "duplicate");
+    isOk &= testRollback(output, testPath / "rollback");
+
+    auto batchInput = std::istringstream{BATCH_PCHTXT_STR};
+    isOk &= testBatch(pchtxt::parsePchtxt(batchInput), testPath / "batch");
+
+    fs::remove_all(testPath);
+    std::cout << (isOk ? "all atmosphere tests pass" : "atmosphere tests failed") << std::endl;
+    return isOk ? 0 : 1;
+}
@@ -0,0 +1,170 @@
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../pchtxt_catalog.hpp"
+
+namespace fs = std::filesystem;
+
+// corpus
+
+// tags are whole tokens in any case, comments are only outside strings, and nothing after @stop counts
+constexpr auto BUILDS_PCHTXT_STR = R"(@title "Builds // not a comment"
+@program 0100ABC000000000
+
+@flag nsobid 1111  // comment
+// First
+@enabled
+0010 "/* @flag nsobid 9999 */"
+
+@FLAG NROBID 2222
+@flagfoo nsobid 9999
+@flag nsobidx 9999
+@flag nsobid 1111
+@flag nsobid not hex
+@nsobid-3333
+@stopx
+@flag nsobid 4444
+@stop
+@flag nsobid 9999
+)";
+
+constexpr auto OTHER_PCHTXT_STR = R"(@title Other
+@program 0100000000020000
+
+@flag nsobid 4444
+// Patch
+@enabled
+0010 00
+)";
+
+// utils
+
+// reads a string, but cannot seek, like a pipe
+class StreamingBuf : public std::streambuf {
+   public:
+    explicit StreamingBuf(std::string str) : str(std::move(str)) { setg(this->str.data(), this->str.data(), end()); }
+
+   private:
+    auto end() -> char* { return str.data() + str.size(); }
+
+    std::string str;
+};
+
+auto getBuildIdStrs(const std::vector<pchtxt::CatalogBuild>& builds) -> std::string {
+    auto result = std::string{};
+    for (auto& build : builds) result += build.buildId.toString() + (build.targetType == pchtxt::NRO ? "r " : "s ");
+    return result;
+}
+
+auto getPaths(const std::vector<pchtxt::CatalogFileView>& fileViews) -> std::string {
+    auto result = std::string{};
+    for (auto& fileView : fileViews) result += std::string(fileView.path) + " ";
+    return result;
+}
+
+void writeFile(const fs::path& path, const std::string& content) {
+    auto fileStream = std::ofstream(path, std::ios::binary);
+    fileStream << content;
+}
+
+// testing
+
+auto check(const std::string& testName, bool isOk) -> bool {
+    std::cout << (isOk ? "ok   " : "FAIL ") << testName << std::endl;
+    return isOk;
+}
+
+auto testBuilds() -> bool {
+    auto pchtxtInput = std::istringstream{BUILDS_PCHTXT_STR};
+    return check("builds match whole tags and flags", getBuildIdStrs(pchtxt::getPchtxtBuilds(pchtxtInput)) ==
+                                                          "1111s 2222r 3333s 4444s ");
+}
+
+auto testAddFile() -> bool {
+    auto isOk = true;
+    auto catalogBuilder = pchtxt::CatalogIndexBuilder{};
+    auto streamingBuf = StreamingBuf{BUILDS_PCHTXT_STR};
+    auto pchtxtInput = std::istream{&streamingBuf};
+    catalogBuilder.addFile("builds.pchtxt", pchtxtInput, 1, 2);
+
+    auto& file = catalogBuilder.getFiles().at("builds.pchtxt");
+    isOk &= check("add file from a stream that cannot seek", file.title == "Builds // not a comment");
+    isOk &= check("add file program id", file.programId == 0x0100ABC000000000);
+    isOk &= check("add file builds", getBuildIdStrs(file.builds) == "1111s 2222r 3333s 4444s ");
+    return isOk;
+}
+
+auto testIndex() -> bool {
+    auto isOk = true;
+    auto catalogBuilder = pchtxt::CatalogIndexBuilder{};
+    for (auto& [path, pchtxtStr] : std::vector<std::pair<std::string, const char*>>{
+             {"b/builds.pchtxt", BUILDS_PCHTXT_STR}, {"a/other.pchtxt", OTHER_PCHTXT_STR}}) {
+        auto pchtxtInput = std::istringstream{pchtxtStr};
+        catalogBuilder.addFile(path, pchtxtInput, 1, 2);
+    }
+
+    auto indexSs = std::stringstream{};
+    catalogBuilder.write(indexSs);
+    auto indexStr = indexSs.str();
+    auto indexData = reinterpret_cast<const uint8_t*>(indexStr.data());
+    auto index = pchtxt::CatalogIndex::fromData(indexData, indexStr.size());
+    isOk &= check("index reads back", index.has_value() and index->getFileCount() == 2);
+    if (not isOk) return false;
+
+    isOk &= check("index by program id", getPaths(index->findByProgramId(0x0100000000020000)) == "a/other.pchtxt ");
+    isOk &= check("index by missing program id", index->findByProgramId(0x0100000000030000).empty());
+    isOk &= check("index by build id in path order",
+                  getPaths(index->findByBuildId(*pchtxt::BuildId::fromHex("4444"))) ==
+                      "a/other.pchtxt b/builds.pchtxt ");
+    isOk &= check("index by padded build id",
+                  getPaths(index->findByBuildId(*pchtxt::BuildId::fromHex("22220000"))) == "b/builds.pchtxt ");
+    auto fileView = index->findByPath("b/builds.pchtxt");
+    isOk &= check("index by path", fileView and fileView->title == "Builds // not a comment" and
+                                       fileView->modifiedTime == 1 and fileView->fileSize == 2);
+    isOk &= check("index by missing path", not index->findByPath("c.pchtxt"));
+    isOk &= check("index truncated is refused", not pchtxt::CatalogIndex::fromData(indexData, indexStr.size() - 1));
+
+    auto rebuiltIndexSs = std::stringstream{};
+    pchtxt::CatalogIndexBuilder{*index}.write(rebuiltIndexSs);
+    isOk &= check("index rebuilt from itself is the same", rebuiltIndexSs.str() == indexStr);
+    return isOk;
+}
+
+auto testUpdate(const fs::path& rootPath) -> bool {
+    auto isOk = true;
+    fs::create_directories(rootPath);
+    auto path = (rootPath / "other.pchtxt").string();
+    writeFile(path, OTHER_PCHTXT_STR);
+
+    auto catalogBuilder = pchtxt::CatalogIndexBuilder{};
+    isOk &= check("update reads a new file", catalogBuilder.updateFile(path));
+    isOk &= check("update skips an unchanged file", not catalogBuilder.updateFile(path));
+
+    writeFile(path, std::string(OTHER_PCHTXT_STR) + "\n@flag nsobid 5555\n");
+    isOk &= check("update reads a changed file",
+                  catalogBuilder.updateFile(path) and catalogBuilder.getFiles().at(path).builds.size() == 2);
+
+    fs::remove(path);
+    isOk &= check("update removes missing files",
+                  catalogBuilder.removeMissingFiles() == 1 and catalogBuilder.getFiles().empty());
+    return isOk;
+}
+
+int main() {
+    auto testPath = fs::temp_directory_path() / "pchtxt_catalog_test";
+    fs::remove_all(testPath);
+
+    auto isOk = true;
+    isOk &= testBuilds();
+    isOk &= testAddFile();
+    isOk &= testIndex();
+    isOk &= testUpdate(testPath);
+
+    fs::remove_all(testPath);
+    std::cout << (isOk ? "all catalog tests pass" : "catalog tests failed") << std::endl;
+    return isOk ? 0 : 1;
+}
@@ -0,0 +1,292 @@
+#include <zlib.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../pchtxt_bundle.hpp"
+#include "../pchtxt_gzip.hpp"
+
+// compressed input is read in blocks of this size
+constexpr auto COMPRESSED_BLOCK_SIZE = size_t{0x10000};
+
+// corpus
+
+constexpr auto FIRST_MEMBER_STR = R"(@title "Compressed"
+@program 0100000000010000
+
+@flag nsobid 0123456789ABCDEF0123456789ABCDEF01234567
+// First [me]
+@enabled
+00001234 1F2003D5 E0031F2A
+)";
+
+constexpr auto SECOND_MEMBER_STR = R"(
+// Second
+@enabled
+00002000 00000000
+)";
+
+// utils
+
+// one gzip member, with a file name of a size to pad it with
+auto getGzipMember(const std::string& content, size_t nameSize = 0) -> std::string {
+    auto stream = z_stream{};
+    deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    auto name = std::string(nameSize, 'n');
+    auto header = gz_header{};
+    header.name = reinterpret_cast<Bytef*>(name.data());
+    if (nameSize > 0) deflateSetHeader(&stream, &header);
+
+    auto result = std::string(deflateBound(&stream, content.size()) + nameSize + 1, '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(content.data()));
+    stream.avail_in = static_cast<uInt>(content.size());
+    stream.next_out = reinterpret_cast<Bytef*>(result.data());
+    stream.avail_out = static_cast<uInt>(result.size());
+    deflate(&stream, Z_FINISH);
+    result.resize(stream.total_out);
+    deflateEnd(&stream);
+    return result;
+}
+
+// a gzip member padded to end exactly at the end of a compressed block
+auto getBlockSizedGzipMember(const std::string& content) -> std::string {
+    auto unpaddedSize = getGzipMember(content).size();
+    return getGzipMember(content, COMPRESSED_BLOCK_SIZE - unpaddedSize - 1);  // the name is null terminated
+}
+
+auto getRawDeflate(const std::string& content) -> std::string {
+    auto stream = z_stream{};
+    deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    auto result = std::string(deflateBound(&stream, content.size()), '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(content.data()));
+    stream.avail_in = static_cast<uInt>(content.size());
+    stream.next_out = reinterpret_cast<Bytef*>(result.data());
+    stream.avail_out = static_cast<uInt>(result.size());
+    deflate(&stream, Z_FINISH);
+    result.resize(stream.total_out);
+    deflateEnd(&stream);
+    return result;
+}
+
+void appendU16(std::string& str, uint32_t value) {
+    str.push_back(static_cast<char>(value & 0xFF));
+    str.push_back(static_cast<char>(value >> 8 & 0xFF));
+}
+
+void appendU32(std::string& str, uint32_t value) {
+    appendU16(str, value & 0xFFFF);
+    appendU16(str, value >> 16);
+}
+
+struct BundleFile {
+    std::string path;
+    std::string content;
+    bool isDeflated;
+    std::string localExtra;  // only in the local header, which can differ from the central one
+    uint32_t flags = 0;
+    size_t declaredSize = 0;  // the size of the content when 0
+};
+
+auto getZip(const std::vector<BundleFile>& files) -> std::string {
+    auto result = std::string{};
+    auto centralDir = std::string{};
+    for (auto& file : files) {
+        auto data = file.isDeflated ? getRawDeflate(file.content) : file.content;
+        auto crc = static_cast<uint32_t>(
+            crc32(0, reinterpret_cast<const Bytef*>(file.content.data()), static_cast<uInt>(file.content.size())));
+        auto localHeaderOffset = static_cast<uint32_t>(result.size());
+        auto declaredSize = static_cast<uint32_t>(file.declaredSize == 0 ? file.content.size() : file.declaredSize);
+
+        appendU32(result, 0x04034b50);
+        appendU16(result, 20);
+        appendU16(result, file.flags);
+        appendU16(result, file.isDeflated ? 8 : 0);
+        appendU32(result, 0);  // time and date
+        appendU32(result, crc);
+        appendU32(result, static_cast<uint32_t>(data.size()));
+        appendU32(result, declaredSize);
+        appendU16(result, static_cast<uint32_t>(file.path.size()));
+        appendU16(result, static_cast<uint32_t>(file.localExtra.size()));
+        result += file.path + file.localExtra + data;
+
+        appendU32(centralDir, 0x02014b50);
+        appendU16(centralDir, 20);
+        appendU16(centralDir, 20);
+        appendU16(centralDir, file.flags);
+        appendU16(centralDir, file.isDeflated ? 8 : 0);
+        appendU32(centralDir, 0);
+        appendU32(centralDir, crc);
+        appendU32(centralDir, static_cast<uint32_t>(data.size()));
+        appendU32(centralDir, declaredSize);
+        appendU16(centralDir, static_cast<uint32_t>(file.path.size()));
+        appendU32(centralDir, 0);  // extra and comment sizes
+        appendU32(centralDir, 0);  // disk and internal attributes
+        appendU32(centralDir, 0);  // external attributes
+        appendU32(centralDir, localHeaderOffset);
+        centralDir += file.path;
+    }
+
+    auto centralDirOffset = static_cast<uint32_t>(result.size());
+    result += centralDir;
+    appendU32(result, 0x06054b50);
+    appendU32(result, 0);  // disk numbers
+    appendU16(result, static_cast<uint32_t>(files.size()));
+    appendU16(result, static_cast<uint32_t>(files.size()));
+    appendU32(result, static_cast<uint32_t>(centralDir.size()));
+    appendU32(result, centralDirOffset);
+    appendU16(result, 7);
+    result += "comment";
+    return result;
+}
+
+void appendTarEntry(std::string& tarStr, const std::string& name, const std::string& content, char type,
+                    const std::string& prefix = {}) {
+    auto header = std::string(512, '\0');
+    header.replace(0, name.size(), name);
+    auto sizeSs = std::ostringstream{};
+    sizeSs.width(11);
+    sizeSs.fill('0');
+    sizeSs << std::oct << content.size();
+    header.replace(124, 11, sizeSs.str());
+    header[156] = type;
+    header.replace(257, 8, std::string("ustar\0" "00", 8));
+    header.replace(345, prefix.size(), prefix);
+
+    tarStr += header + content;
+    tarStr.append((512 - content.size() % 512) % 512, '\0');
+}
+
+auto parse(const std::string& compressedStr) -> std::string {
+    auto compressedInput = std::istringstream{compressedStr};
+    return pchtxt::formatPchtxt(pchtxt::parseCompressedPchtxt(compressedInput));
+}
+
+auto parsePlain(const std::string& pchtxtStr) -> std::string {
+    auto pchtxtInput = std::istringstream{pchtxtStr};
+    return pchtxt::formatPchtxt(pchtxt::parsePchtxt(pchtxtInput));
+}
+
+// testing
+
+auto check(const std::string& testName, bool isOk) -> bool {
+    std::cout << (isOk ? "ok   " : "FAIL ") << testName << std::endl;
+    return isOk;
+}
+
+auto testGzip() -> bool {
+    auto isOk = true;
+    auto bothStr = std::string(FIRST_MEMBER_STR) + SECOND_MEMBER_STR;
+    auto expectedStr = parsePlain(bothStr);
+
+    isOk &= check("gzip one member", parse(getGzipMember(bothStr)) == expectedStr);
+    isOk &= check("gzip two members", parse(getGzipMember(FIRST_MEMBER_STR) + getGzipMember(SECOND_MEMBER_STR)) ==
+                                          expectedStr);
+
+    auto blockSizedMember = getBlockSizedGzipMember(FIRST_MEMBER_STR);
+    isOk &= check("gzip member padded to the block size", blockSizedMember.size() == COMPRESSED_BLOCK_SIZE);
+    isOk &= check("gzip two members split at the block boundary",
+                  parse(blockSizedMember + getGzipMember(SECOND_MEMBER_STR)) == expectedStr);
+
+    auto truncatedStr = getGzipMember(bothStr);
+    truncatedStr.resize(truncatedStr.size() / 2);
+    auto truncatedInput = std::istringstream{truncatedStr};
+    auto builder = pchtxt::PatchTextOutputBuilder{};
+    isOk &= check("gzip truncated is an error", not pchtxt::parseCompressedPchtxt(truncatedInput, builder));
+    return isOk;
+}
+
+auto testZlib() -> bool {
+    auto pchtxtStr = std::string(FIRST_MEMBER_STR);
+    auto compressedStr = std::string(compressBound(pchtxtStr.size()), '\0');
+    auto compressedSize = static_cast<uLongf>(compressedStr.size());
+    compress(reinterpret_cast<Bytef*>(compressedStr.data()), &compressedSize,
+             reinterpret_cast<const Bytef*>(pchtxtStr.data()), pchtxtStr.size());
+    compressedStr.resize(compressedSize);
+    return check("zlib", parse(compressedStr) == parsePlain(pchtxtStr));
+}
+
+auto getBundleOutputStrs(const std::string& bundleStr, std::ostream& logOs) -> std::vector<std::string> {
+    auto result = std::vector<std::string>{};
+    auto bundleData = reinterpret_cast<const uint8_t*>(bundleStr.data());
+    for (auto& bundleOutput : pchtxt::parseBundle(bundleData, bundleStr.size(), logOs, 2)) {
+        result.push_back(bundleOutput.path + (bundleOutput.isParsedOk ? " ok\n" : " error\n") +
+                         pchtxt::formatPchtxt(bundleOutput.output));
+    }
+    return result;
+}
+
+auto getBundleOutputStrs(const std::string& bundleStr) -> std::vector<std::string> {
+    auto throwAwaySs = std::stringstream{};
+    return getBundleOutputStrs(bundleStr, throwAwaySs);
+}
+
+auto testZip() -> bool {
+    auto isOk = true;
+    auto bothStr = std::string(FIRST_MEMBER_STR) + SECOND_MEMBER_STR;
+    auto zipStr = getZip({
+        {"mods/first.pchtxt", FIRST_MEMBER_STR, true, {}},
+        {"readme.txt", "not a pchtxt", false, {}},
+        {"mods/SECOND.PCHTXT", bothStr, false, std::string(9, 'x')},
+    });
+
+    auto outputStrs = getBundleOutputStrs(zipStr);
+    isOk &= check("zip skips other files", outputStrs.size() == 2);
+    if (not isOk) return false;
+    isOk &= check("zip deflated entry", outputStrs[0] == "mods/first.pchtxt ok\n" + parsePlain(FIRST_MEMBER_STR));
+    isOk &= check("zip stored entry with local extra field",
+                  outputStrs[1] == "mods/SECOND.PCHTXT ok\n" + parsePlain(bothStr));
+
+    // entries that cannot be read are reported, in the listing log and as outputs that are not ok
+    auto unreadableZipStr = getZip({
+        {"encrypted.pchtxt", FIRST_MEMBER_STR, false, {}, 0x1},
+        {"longer.pchtxt", FIRST_MEMBER_STR, true, {}, 0, std::string(FIRST_MEMBER_STR).size() + 1},
+        {"shorter.pchtxt", FIRST_MEMBER_STR, true, {}, 0, 10},
+        {"stored.pchtxt", FIRST_MEMBER_STR, false, {}, 0, 10},
+    });
+    auto logSs = std::stringstream{};
+    auto unreadableStrs = getBundleOutputStrs(unreadableZipStr, logSs);
+    isOk &= check("zip skipped entry is logged", logSs.str().find("encrypted.pchtxt: WARNING skipped encrypted") !=
+                                                     std::string::npos);
+    isOk &= check("zip unreadable entries are not ok",
+                  unreadableStrs == std::vector<std::string>{"encrypted.pchtxt error\n\n", "longer.pchtxt error\n\n",
+                                                             "shorter.pchtxt error\n\n", "stored.pchtxt error\n\n"});
+
+    auto truncatedStr = zipStr.substr(0, 10);
+    isOk &= check("zip truncated has no entries",
+                  pchtxt::getBundlePchtxtEntries(reinterpret_cast<const uint8_t*>(truncatedStr.data()),
+                                                 truncatedStr.size())
+                      .empty());
+    return isOk;
+}
+
+auto testTar() -> bool {
+    auto isOk = true;
+    auto bothStr = std::string(FIRST_MEMBER_STR) + SECOND_MEMBER_STR;
+    auto longName = "mods/" + std::string(120, 'l') + ".pchtxt";
+    auto tarStr = std::string{};
+    appendTarEntry(tarStr, "first.pchtxt", FIRST_MEMBER_STR, '0', "mods");
+    appendTarEntry(tarStr, "dir.pchtxt", {}, '5');
+    appendTarEntry(tarStr, "././@LongLink", longName + '\0', 'L');
+    appendTarEntry(tarStr, "replaced_by_long_name", bothStr, '0');
+    tarStr.append(1024, '\0');
+
+    auto outputStrs = getBundleOutputStrs(tarStr);
+    isOk &= check("tar skips directories", outputStrs.size() == 2);
+    if (not isOk) return false;
+    isOk &= check("tar entry with prefix", outputStrs[0] == "mods/first.pchtxt ok\n" + parsePlain(FIRST_MEMBER_STR));
+    isOk &= check("tar entry with long name", outputStrs[1] == longName + " ok\n" + parsePlain(bothStr));
+    return isOk;
+}
+
+int main() {
+    auto isOk = true;
+    isOk &= testGzip();
+    isOk &= testZlib();
+    isOk &= testZip();
+    isOk &= testTar();
+
+    std::cout << (isOk ? "all compressed input tests pass" : "compressed input tests failed") << std::endl;
+    return isOk ? 0 : 1;
+}
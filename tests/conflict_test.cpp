@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../pchtxt_conflict.hpp"
+
+// corpus
+
+constexpr auto BUILD_ID_STR = "0123456789ABCDEF0123456789ABCDEF01234567";
+constexpr auto OTHER_BUILD_ID_STR = "00112233445566778899AABBCCDDEEFF00112233";
+
+// random patches in a small area, so they overlap often. Some are disabled or heap patches, some are long
+auto getRandomPchtxt(std::mt19937& random, size_t patchCount, const char* buildIdStr, uint32_t areaSize) {
+    auto pchtxtSs = std::stringstream{};
+    pchtxtSs << "@title Random\n\n@flag nsobid " << buildIdStr << "\n";
+    for (auto patchIdx = size_t{0}; patchIdx < patchCount; patchIdx++) {
+        pchtxtSs << "\n// Patch " << patchIdx << "\n";
+        pchtxtSs << (random() % 4 == 0 ? "@disabled" : "@enabled") << (random() % 8 == 0 ? " heap\n" : "\n");
+
+        auto contentCount = 1 + random() % 3;
+        for (auto contentIdx = 0u; contentIdx < contentCount; contentIdx++) {
+            auto valueSize = random() % 16 == 0 ? 64 + random() % 256 : 1 + random() % 8;
+            pchtxtSs << std::hex << random() % areaSize << std::dec << ' ' << std::string(valueSize * 2, 'A') << "\n";
+        }
+    }
+    return pchtxtSs.str();
+}
+
+auto parse(const std::string& pchtxtStr) -> pchtxt::PatchTextOutput {
+    auto pchtxtInput = std::istringstream{pchtxtStr};
+    return pchtxt::parsePchtxt(pchtxtInput);
+}
+
+// brute force
+
+auto isWritingAt(const pchtxt::Patch& patch, uint32_t offset) {
+    return patch.type == pchtxt::BIN and
+           std::any_of(begin(patch.contents), end(patch.contents), [offset](const pchtxt::PatchContent& content) {
+               return content.offset <= offset and offset < uint64_t{content.offset} + content.value.size();
+           });
+}
+
+// the first overlapping range of two patches, with every size a range starting there can have
+struct Overlap {
+    uint64_t offset = UINT64_MAX;
+    std::vector<uint32_t> sizes{};
+};
+
+auto getOverlap(const pchtxt::Patch& patch, const pchtxt::Patch& otherPatch) -> Overlap {
+    auto result = Overlap{};
+    if (patch.type != pchtxt::BIN or otherPatch.type != pchtxt::BIN) return result;
+    for (auto& content : patch.contents) {
+        for (auto& otherContent : otherPatch.contents) {
+            auto overlapBegin = uint64_t{std::max(content.offset, otherContent.offset)};
+            auto overlapEnd = std::min(uint64_t{content.offset} + content.value.size(),
+                                       uint64_t{otherContent.offset} + otherContent.value.size());
+            if (overlapBegin >= overlapEnd or overlapBegin > result.offset) continue;
+            if (overlapBegin < result.offset) result.sizes.clear();
+            result.offset = overlapBegin;
+            result.sizes.push_back(static_cast<uint32_t>(overlapEnd - overlapBegin));
+        }
+    }
+    return result;
+}
+
+// testing
+
+auto check(const std::string& testName, bool isOk) -> bool {
+    std::cout << (isOk ? "ok   " : "FAIL ") << testName << std::endl;
+    return isOk;
+}
+
+auto isMatchingBruteForce(const pchtxt::PatchCollection& patchCollection, const pchtxt::PatchEnabledSet& enabledSet,
+                          const std::vector<pchtxt::PatchConflict>& conflicts) -> bool {
+    auto patches = std::vector<const pchtxt::Patch*>{};
+    for (auto& patch : patchCollection.patches) patches.push_back(&patch);
+
+    auto conflictIdx = size_t{0};
+    for (auto patchIdx = size_t{0}; patchIdx < patches.size(); patchIdx++) {
+        for (auto otherPatchIdx = patchIdx + 1; otherPatchIdx < patches.size(); otherPatchIdx++) {
+            if (not enabledSet.isEnabled(patchIdx) or not enabledSet.isEnabled(otherPatchIdx)) continue;
+            auto overlap = getOverlap(*patches[patchIdx], *patches[otherPatchIdx]);
+            if (overlap.sizes.empty()) continue;
+
+            if (conflictIdx >= conflicts.size()) return false;
+            auto& conflict = conflicts[conflictIdx++];
+            if (conflict.patch != patches[patchIdx] or conflict.otherPatch != patches[otherPatchIdx] or
+                conflict.offset != overlap.offset or
+                std::find(begin(overlap.sizes), end(overlap.sizes), conflict.size) == end(overlap.sizes)) {
+                return false;
+            }
+        }
+    }
+    return conflictIdx == conflicts.size();
+}
+
+auto isPatchesAtMatchingBruteForce(const pchtxt::PatchCollection& patchCollection,
+                                   const pchtxt::PatchConflictIndex& conflictIndex, uint32_t areaSize) -> bool {
+    for (auto offset = uint32_t{0}; offset < areaSize + 512; offset++) {
+        auto expectedPatches = std::vector<const pchtxt::Patch*>{};
+        for (auto& patch : patchCollection.patches) {
+            if (isWritingAt(patch, offset)) expectedPatches.push_back(&patch);
+        }
+        if (conflictIndex.getPatchesAt(offset) != expectedPatches) return false;
+    }
+    return true;
+}
+
+// collection sizes around every tree height, so partial subtrees past the end are covered
+auto testIndex(std::mt19937& random) -> bool {
+    auto isOk = true;
+    for (auto patchCount : {0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 100, 500}) {
+        for (auto areaSize : {uint32_t{64}, uint32_t{4096}}) {
+            auto output = parse(getRandomPchtxt(random, patchCount, BUILD_ID_STR, areaSize));
+            if (output.collections.empty()) continue;
+            auto& patchCollection = output.collections.front();
+            auto testName = std::to_string(patchCount) + " patches in " + std::to_string(areaSize) + " bytes";
+
+            auto enabledSet = pchtxt::PatchEnabledSet{patchCollection};
+            auto conflictIndex = pchtxt::PatchConflictIndex{patchCollection};
+            isOk &= check("index conflicts of " + testName,
+                          isMatchingBruteForce(patchCollection, enabledSet, conflictIndex.getConflicts()));
+            isOk &= check("index patches at offsets of " + testName,
+                          isPatchesAtMatchingBruteForce(patchCollection, conflictIndex, areaSize));
+
+            auto patchIdx = size_t{0};
+            for (auto& patch : patchCollection.patches) {
+                if (random() % 2 == 0) {
+                    auto isEnabled = not enabledSet.isEnabled(patchIdx);
+                    enabledSet.setEnabled(patchIdx, isEnabled);
+                    conflictIndex.updateEnabled(patch, isEnabled);
+                }
+                patchIdx++;
+            }
+            isOk &= check("index conflicts after toggling of " + testName,
+                          isMatchingBruteForce(patchCollection, enabledSet, conflictIndex.getConflicts()));
+            isOk &= check("index built with an enabled set of " + testName,
+                          isMatchingBruteForce(patchCollection, enabledSet,
+                                               pchtxt::getPatchConflicts(patchCollection, enabledSet)));
+        }
+    }
+    return isOk;
+}
+
+auto isModConflictingBruteForce(const pchtxt::PatchTextOutput& mod, const pchtxt::PatchTextOutput& otherMod) -> bool {
+    for (auto& patchCollection : mod.collections) {
+        for (auto& otherPatchCollection : otherMod.collections) {
+            if (patchCollection.buildId != otherPatchCollection.buildId) continue;
+            for (auto& patch : patchCollection.patches) {
+                for (auto& otherPatch : otherPatchCollection.patches) {
+                    if (patch.enabled and otherPatch.enabled and not getOverlap(patch, otherPatch).sizes.empty()) {
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+    return false;
+}
+
+auto testMatrix(std::mt19937& random) -> bool {
+    auto isOk = true;
+    auto mods = std::vector<pchtxt::PatchTextOutput>{};
+    for (auto modIdx = 0; modIdx < 12; modIdx++) {
+        auto buildIdStr = modIdx % 3 == 0 ? OTHER_BUILD_ID_STR : BUILD_ID_STR;
+        mods.push_back(parse(getRandomPchtxt(random, 1 + random() % 4, buildIdStr, 0x2000)));
+    }
+    auto modPtrs = std::vector<const pchtxt::PatchTextOutput*>{};
+    for (auto& mod : mods) modPtrs.push_back(&mod);
+
+    for (auto threadCount : {1u, 4u}) {
+        auto matrix = pchtxt::getModConflictMatrix(modPtrs, threadCount);
+        auto isMatching = matrix.modCount == mods.size();
+        for (auto modIdx = size_t{0}; modIdx < mods.size(); modIdx++) {
+            for (auto otherModIdx = modIdx + 1; otherModIdx < mods.size(); otherModIdx++) {
+                isMatching &= matrix.isConflicting(otherModIdx, modIdx) ==
+                              isModConflictingBruteForce(mods[modIdx], mods[otherModIdx]);
+            }
+        }
+        isOk &= check("matrix with " + std::to_string(threadCount) + " threads", isMatching);
+    }
+    return isOk;
+}
+
+// more ranges than one sweep chunk, all of one mod under its first range, with the only conflict between that range
+// and a range of another mod sorted into a later chunk
+auto testMatrixAcrossChunks() -> bool {
+    auto longPchtxtSs = std::stringstream{};
+    longPchtxtSs << "@title Long\n\n@flag nsobid " << BUILD_ID_STR << "\n// Long\n@enabled\n0 "
+                 << std::string(0x1000 * 2, 'A') << "\n// Small\n@enabled\n";
+    for (auto rangeIdx = 0; rangeIdx < 0x11000; rangeIdx++) {
+        longPchtxtSs << std::hex << 1 + rangeIdx % 0xF00 << std::dec << " AA\n";
+    }
+    auto longMod = parse(longPchtxtSs.str());
+    auto lateMod = parse(std::string("@title Late\n\n@flag nsobid ") + BUILD_ID_STR + "\n// Late\n@enabled\nF80 AA\n");
+    auto nextMod = parse(std::string("@title Next\n\n@flag nsobid ") + BUILD_ID_STR + "\n// Next\n@enabled\n1000 AA\n");
+
+    auto matrix = pchtxt::getModConflictMatrix({&longMod, &lateMod, &nextMod}, 4);
+    auto expectedPairs = std::vector<std::pair<size_t, size_t>>{{0, 1}};
+    return check("matrix across sweep chunks", matrix.conflictingPairs == expectedPairs);
+}
+
+int main() {
+    auto random = std::mt19937{3096};
+    auto isOk = true;
+    isOk &= testIndex(random);
+    isOk &= testMatrix(random);
+    isOk &= testMatrixAcrossChunks();
+
+    std::cout << (isOk ? "all conflict tests pass" : "conflict tests failed") << std::endl;
+    return isOk ? 0 : 1;
+}
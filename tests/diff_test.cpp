@@ -0,0 +1,144 @@
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../pchtxt_diff.hpp"
+
+constexpr auto MAX_CONTENT_SIZE = size_t{0xFFFF};
+
+// utils
+
+auto getRandomImage(std::mt19937& random, size_t imageSize) -> std::vector<uint8_t> {
+    auto result = std::vector<uint8_t>(imageSize);
+    for (auto& imageByte : result) imageByte = static_cast<uint8_t>(random());
+    return result;
+}
+
+auto applyContents(std::vector<uint8_t> image, const std::pmr::list<pchtxt::PatchContent>& contents) {
+    for (auto& content : contents) {
+        std::memcpy(image.data() + content.offset, content.value.data(), content.value.size());
+    }
+    return image;
+}
+
+// testing
+
+auto check(const std::string& testName, bool isOk) -> bool {
+    std::cout << (isOk ? "ok   " : "FAIL ") << testName << std::endl;
+    return isOk;
+}
+
+// contents that turn the original into the modified image, sorted, each starting and ending on a difference, and only
+// apart by less than the merge distance when the one before is as long as a content can be
+auto isValidDiff(const std::vector<uint8_t>& original, const std::vector<uint8_t>& modified,
+                 const std::pmr::list<pchtxt::PatchContent>& contents, size_t mergeDistance) -> bool {
+    if (applyContents(original, contents) != modified) return false;
+
+    auto lastEnd = size_t{0};
+    auto isLastFull = true;
+    for (auto& content : contents) {
+        auto contentEnd = content.offset + content.value.size();
+        if (content.value.empty() or content.value.size() > MAX_CONTENT_SIZE) return false;
+        if (content.offset < lastEnd or (not isLastFull and content.offset - lastEnd <= mergeDistance)) return false;
+        if (original[content.offset] == modified[content.offset]) return false;
+        if (original[contentEnd - 1] == modified[contentEnd - 1]) return false;
+        lastEnd = contentEnd;
+        isLastFull = content.value.size() == MAX_CONTENT_SIZE;
+    }
+    return true;
+}
+
+auto testDiffImages(std::mt19937& random) -> bool {
+    auto isOk = true;
+    auto original = getRandomImage(random, 0x30000);
+
+    auto noContents = pchtxt::diffImages(original.data(), original.data(), original.size());
+    isOk &= check("identical images have no differences", noContents.empty());
+
+    // at the edges of the image and of the compared blocks
+    auto modified = original;
+    for (auto pos : {size_t{0}, size_t{0xFFF}, size_t{0x1000}, size_t{0x2FFFF}}) modified[pos] ^= 0xFF;
+    auto edgeContents = pchtxt::diffImages(original.data(), modified.data(), original.size());
+    isOk &= check("differences at edges",
+                  edgeContents.size() == 3 and isValidDiff(original, modified, edgeContents, 8));
+
+    // differences exactly the merge distance apart are merged, one more byte apart they are not
+    modified = original;
+    modified[0x100] ^= 1;
+    modified[0x100 + 9] ^= 1;
+    modified[0x200] ^= 1;
+    modified[0x200 + 10] ^= 1;
+    auto mergedContents = pchtxt::diffImages(original.data(), modified.data(), original.size(), 8);
+    isOk &= check("merge distance", mergedContents.size() == 3 and mergedContents.front().value.size() == 10 and
+                                        isValidDiff(original, modified, mergedContents, 8));
+
+    // a run longer than an IPS record can hold
+    modified = original;
+    for (auto pos = size_t{0x1000}; pos < 0x28000; pos++) modified[pos] ^= 1;
+    auto longContents = pchtxt::diffImages(original.data(), modified.data(), original.size());
+    isOk &= check("long run is split", longContents.size() == 3 and isValidDiff(original, modified, longContents, 8));
+
+    for (auto mergeDistance : {size_t{0}, size_t{3}, size_t{8}, size_t{64}}) {
+        modified = original;
+        for (auto diffIdx = 0; diffIdx < 2000; diffIdx++) modified[random() % modified.size()] ^= 1 + random() % 0xFF;
+        auto contents = pchtxt::diffImages(original.data(), modified.data(), original.size(), mergeDistance);
+        isOk &= check("random differences with merge distance " + std::to_string(mergeDistance),
+                      isValidDiff(original, modified, contents, mergeDistance));
+    }
+    return isOk;
+}
+
+auto testDiffBinaries(std::mt19937& random) -> bool {
+    auto isOk = true;
+    auto original = getRandomImage(random, 0x8000);
+    for (auto idx = 0; idx < 0x20; idx++) original[0x40 + idx] = static_cast<uint8_t>(idx < 20 ? idx + 1 : 0);
+    auto modified = original;
+    for (auto pos : {size_t{0x1234}, size_t{0x5000}, size_t{0x5001}}) modified[pos] ^= 0xFF;
+
+    auto getDiff = [&](const std::vector<uint8_t>& originalImage, const std::vector<uint8_t>& modifiedImage) {
+        return pchtxt::diffBinaries(originalImage.data(), originalImage.size(), modifiedImage.data(),
+                                    modifiedImage.size(), "Diff");
+    };
+
+    std::memcpy(original.data(), "NSO0", 4);
+    auto nsoCollection = getDiff(original, modified);
+    isOk &= check("NSO target type", nsoCollection.targetType == pchtxt::NSO);
+    isOk &= check("NSO build id from the module id",
+                  nsoCollection.buildId == *pchtxt::BuildId::fromHex("0102030405060708090A0B0C0D0E0F1011121314"));
+
+    // written and parsed back, the patch turns the original into the modified image
+    auto pchtxtSs = std::stringstream{};
+    pchtxt::writePchtxt(nsoCollection, pchtxtSs);
+    auto output = pchtxt::parsePchtxt(pchtxtSs);
+    auto isRoundTripped = output.collections.size() == 1 and output.collections.front().patches.size() == 1;
+    if (isRoundTripped) {
+        auto& patch = output.collections.front().patches.front();
+        isRoundTripped = patch.name.str() == "Diff" and applyContents(original, patch.contents) == modified;
+    }
+    isOk &= check("NSO diff round trips", isRoundTripped);
+
+    std::memset(original.data(), 0, 4);
+    std::memcpy(original.data() + 0x10, "NRO0", 4);
+    auto nroCollection = getDiff(original, modified);
+    isOk &= check("NRO target type", nroCollection.targetType == pchtxt::NRO and nroCollection.patches.size() == 1);
+
+    std::memset(original.data() + 0x10, 0, 4);
+    isOk &= check("unknown format has no patches", getDiff(original, modified).patches.empty());
+
+    std::memcpy(original.data() + 0x10, "NRO0", 4);
+    isOk &= check("identical binaries have no patches", getDiff(original, original).patches.empty());
+    return isOk;
+}
+
+int main() {
+    auto random = std::mt19937{3096};
+    auto isOk = true;
+    isOk &= testDiffImages(random);
+    isOk &= testDiffBinaries(random);
+
+    std::cout << (isOk ? "all diff tests pass" : "diff tests failed") << std::endl;
+    return isOk ? 0 : 1;
+}
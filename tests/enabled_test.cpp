@@ -0,0 +1,137 @@
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../pchtxt.hpp"
+
+// corpus
+
+// more patches than fit the inline word, in two collections
+auto getPchtxt(std::mt19937& random) -> std::string {
+    auto pchtxtSs = std::stringstream{};
+    pchtxtSs << "@title Enabled\n";
+    for (auto buildIdStr : {"AAAA", "BBBB"}) {
+        pchtxtSs << "\n@flag nsobid " << buildIdStr << "\n";
+        for (auto patchIdx = 0; patchIdx < 150; patchIdx++) {
+            pchtxtSs << "// Patch " << patchIdx << "\n" << (random() % 2 == 0 ? "@enabled" : "@disabled") << "\n";
+            pchtxtSs << std::hex << patchIdx * 0x10 << std::dec << " " << std::hex << 0x10 + patchIdx % 0xF0
+                     << std::dec << "\n";
+        }
+    }
+    return pchtxtSs.str();
+}
+
+// testing
+
+auto check(const std::string& testName, bool isOk) -> bool {
+    std::cout << (isOk ? "ok   " : "FAIL ") << testName << std::endl;
+    return isOk;
+}
+
+auto isMatchingModel(const pchtxt::PatchEnabledSet& enabledSet, const std::vector<bool>& model) -> bool {
+    for (auto patchIdx = size_t{0}; patchIdx < model.size() + 200; patchIdx++) {
+        if (enabledSet.isEnabled(patchIdx) != (patchIdx < model.size() and model[patchIdx])) return false;
+    }
+    return true;
+}
+
+auto testSet(std::mt19937& random) -> bool {
+    auto isOk = true;
+    auto enabledSet = pchtxt::PatchEnabledSet{};
+    auto model = std::vector<bool>(300);
+    for (auto toggleIdx = 0; toggleIdx < 2000; toggleIdx++) {
+        auto patchIdx = random() % model.size();
+        auto isEnabled = random() % 2 == 0;
+        enabledSet.setEnabled(patchIdx, isEnabled);
+        model[patchIdx] = isEnabled;
+    }
+    isOk &= check("set matches a model", isMatchingModel(enabledSet, model));
+
+    // disabling past the end changes nothing, so it is equal to a set that never had those patches
+    auto shortSet = pchtxt::PatchEnabledSet{};
+    shortSet.setEnabled(3, true);
+    auto longSet = shortSet;
+    longSet.setEnabled(1000, false);
+    isOk &= check("set disabling past the end", longSet == shortSet);
+    longSet.setEnabled(1000, true);
+    longSet.setEnabled(1000, false);
+    isOk &= check("set trailing disabled words are equal", longSet == shortSet and shortSet == longSet);
+    longSet.setEnabled(200, true);
+    isOk &= check("set differing past the inline word", longSet != shortSet and shortSet != longSet);
+    shortSet.setEnabled(2, true);
+    longSet.setEnabled(200, false);
+    isOk &= check("set differing in the inline word", longSet != shortSet);
+    return isOk;
+}
+
+auto testOverlay(std::mt19937& random) -> bool {
+    auto isOk = true;
+    auto pchtxtInput = std::istringstream{getPchtxt(random)};
+    auto output = pchtxt::parsePchtxt(pchtxtInput);
+    auto originalStr = pchtxt::formatPchtxt(output);
+
+    auto enabledOverlay = pchtxt::PatchEnabledOverlay{output};
+    auto isMatchingFlags = true;
+    auto collectionIdx = size_t{0};
+    for (auto& patchCollection : output.collections) {
+        auto patchIdx = size_t{0};
+        for (auto& patch : patchCollection.patches) {
+            isMatchingFlags &= enabledOverlay.isEnabled(collectionIdx, patchIdx++) == patch.enabled;
+        }
+        collectionIdx++;
+    }
+    isOk &= check("overlay takes the enabled flags", isMatchingFlags);
+    isOk &= check("overlay has no collection past the end",
+                  std::as_const(enabledOverlay).getCollection(5) == pchtxt::PatchEnabledSet{} and
+                      not enabledOverlay.isEnabled(5, 0));
+
+    // the same toggles on the overlay and on a copy of the output give the same Patch Text and IPS files
+    auto toggledOutput = output;
+    collectionIdx = 0;
+    for (auto& patchCollection : toggledOutput.collections) {
+        auto patchIdx = size_t{0};
+        for (auto& patch : patchCollection.patches) {
+            if (random() % 3 == 0) {
+                patch.enabled = not patch.enabled;
+                enabledOverlay.setEnabled(collectionIdx, patchIdx, patch.enabled);
+            }
+            patchIdx++;
+        }
+        collectionIdx++;
+    }
+    isOk &= check("overlay formats like toggled flags",
+                  pchtxt::formatPchtxt(output, enabledOverlay) == pchtxt::formatPchtxt(toggledOutput));
+    isOk &= check("overlay leaves the shared output alone", pchtxt::formatPchtxt(output) == originalStr);
+
+    auto isMatchingIps = true;
+    auto toggledCollection = begin(toggledOutput.collections);
+    collectionIdx = 0;
+    for (auto& patchCollection : output.collections) {
+        auto ipsSs = std::stringstream{};
+        pchtxt::writeIps(patchCollection, std::as_const(enabledOverlay).getCollection(collectionIdx++), ipsSs);
+        auto toggledIpsSs = std::stringstream{};
+        pchtxt::writeIps(*toggledCollection++, toggledIpsSs);
+        isMatchingIps &= ipsSs.str() == toggledIpsSs.str();
+    }
+    isOk &= check("overlay writes IPS like toggled flags", isMatchingIps);
+
+    auto memoryUsage = pchtxt::getMemoryUsage(enabledOverlay);
+    enabledOverlay.setEnabled(7, 0, false);
+    isOk &= check("overlay disabling past the end adds nothing", pchtxt::getMemoryUsage(enabledOverlay) == memoryUsage);
+    enabledOverlay.setEnabled(7, 0, true);
+    isOk &= check("overlay enabling past the end adds a collection", enabledOverlay.isEnabled(7, 0));
+    return isOk;
+}
+
+int main() {
+    auto random = std::mt19937{3096};
+    auto isOk = true;
+    isOk &= testSet(random);
+    isOk &= testOverlay(random);
+
+    std::cout << (isOk ? "all enabled state tests pass" : "enabled state tests failed") << std::endl;
+    return isOk ? 0 : 1;
+}
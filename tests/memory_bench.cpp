@@ -0,0 +1,62 @@
+#if defined(__linux__) or defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../pchtxt.hpp"
+
+// peak resident set size of the process so far, in bytes, or nothing where it is not measured
+auto getPeakRss() -> std::optional<size_t> {
+#if defined(__linux__)
+    auto usage = rusage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;  // kilobytes on linux
+#elif defined(__APPLE__)
+    auto usage = rusage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<size_t>(usage.ru_maxrss);  // bytes on macOS
+#else
+    return {};
+#endif
+}
+
+int main(int argc, char const* argv[]) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <pchtxt file> [copies to keep parsed]" << std::endl;
+        return 1;
+    }
+    auto copyCount = argc > 2 ? std::stoul(argv[2]) : 100ul;
+
+    auto pchtxtInStream = std::ifstream(argv[1], std::ios::binary);
+    auto pchtxtSs = std::stringstream{};
+    pchtxtSs << pchtxtInStream.rdbuf();
+    auto pchtxtStr = pchtxtSs.str();
+
+    // parsed copies are kept, the way a cache keeps them
+    auto peakRssBefore = getPeakRss();
+    auto outputs = std::vector<pchtxt::PatchTextOutput>{};
+    auto memoryUsage = size_t{0};
+    for (auto copyIdx = 0ul; copyIdx < copyCount; copyIdx++) {
+        auto inputSs = std::istringstream{pchtxtStr};
+        outputs.push_back(pchtxt::parsePchtxt(inputSs));
+        memoryUsage += pchtxt::getMemoryUsage(outputs.back());
+    }
+    auto peakRssAfter = getPeakRss();
+
+    auto inputMb = static_cast<double>(pchtxtStr.size()) * copyCount / (1024 * 1024);
+    std::cout << "input:             " << inputMb << " MB in " << copyCount << " copies" << std::endl;
+    std::cout << "getMemoryUsage:    " << memoryUsage / inputMb / (1024 * 1024) << " MB per MB of input" << std::endl;
+    if (peakRssBefore and peakRssAfter) {
+        std::cout << "peak RSS growth:   " << (*peakRssAfter - *peakRssBefore) / inputMb / (1024 * 1024)
+                  << " MB per MB of input" << std::endl;
+    } else {
+        std::cout << "peak RSS growth:   not measured on this platform" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../pchtxt_nso.hpp"
+
+// corpus
+
+constexpr auto MODULE_ID_STR = "0102030405060708090A0B0C0D0E0F1011121314";
+
+// the text segment starts the module, rodata follows it, and data is apart from both
+constexpr auto TEXT_SIZE = size_t{0x1000};
+constexpr auto RODATA_MEMORY_OFFSET = uint32_t{0x1000};
+constexpr auto RODATA_SIZE = size_t{0x100};
+constexpr auto DATA_MEMORY_OFFSET = uint32_t{0x2000};
+constexpr auto DATA_SIZE = size_t{0x80};
+
+// a patch at the start of text, one from the end of rodata into the gap before data, and one in data
+constexpr auto PCHTXT_STR = R"(@title NSO
+
+@flag nsobid 0102030405060708090A0B0C0D0E0F1011121314
+// Text start
+@enabled
+00000100 11223344
+// Rodata end
+@enabled
+000011FE AABBCCDD
+// Data
+@enabled
+00002110 5566
+// Disabled
+@disabled
+00000200 77777777
+)";
+
+// a heap patch before the binary patches, and flags the overlay turns around
+constexpr auto HEAP_FIRST_PCHTXT_STR = R"(@title NSO heap first
+
+@flag nsobid 0102030405060708090A0B0C0D0E0F1011121314
+// Heap
+@enabled heap
+00000000 99
+// Disabled by flag
+@disabled
+00000100 11223344
+// Enabled by flag
+@enabled
+00000104 55667788
+)";
+
+// utils
+
+void writeU32(std::vector<uint8_t>& data, size_t pos, uint32_t value) {
+    for (auto byteIdx = 0; byteIdx < 4; byteIdx++) data[pos + byteIdx] = (value >> byteIdx * 8) & 0xFF;
+}
+
+void appendLz4Length(std::vector<uint8_t>& block, size_t length) {
+    if (length < 0xF) return;
+    for (length -= 0xF; length >= 0xFF; length -= 0xFF) block.push_back(0xFF);
+    block.push_back(static_cast<uint8_t>(length));
+}
+
+// one LZ4 sequence of literals and a match, or only literals when the match is empty
+void appendLz4Sequence(std::vector<uint8_t>& block, const std::vector<uint8_t>& literals, size_t matchDistance,
+                       size_t matchSize) {
+    auto matchLength = matchSize == 0 ? 0 : matchSize - 4;
+    auto token = std::min<size_t>(literals.size(), 0xF) << 4 | std::min<size_t>(matchLength, 0xF);
+    block.push_back(static_cast<uint8_t>(token));
+    appendLz4Length(block, literals.size());
+    block.insert(end(block), begin(literals), end(literals));
+    if (matchSize == 0) return;
+    block.push_back(static_cast<uint8_t>(matchDistance & 0xFF));
+    block.push_back(static_cast<uint8_t>(matchDistance >> 8));
+    appendLz4Length(block, matchLength);
+}
+
+auto getTextSegment() -> std::vector<uint8_t> {
+    auto result = std::vector<uint8_t>(TEXT_SIZE);
+    for (auto byteIdx = size_t{0}; byteIdx < TEXT_SIZE; byteIdx++) result[byteIdx] = static_cast<uint8_t>(byteIdx % 3);
+    return result;
+}
+
+// three bytes repeated by one match that overlaps what it produces
+auto getCompressedTextSegment() -> std::vector<uint8_t> {
+    auto result = std::vector<uint8_t>{};
+    appendLz4Sequence(result, {0, 1, 2}, 3, TEXT_SIZE - 4);
+    appendLz4Sequence(result, {static_cast<uint8_t>((TEXT_SIZE - 1) % 3)}, 0, 0);
+    return result;
+}
+
+auto getRodataSegment() -> std::vector<uint8_t> {
+    auto result = std::vector<uint8_t>(RODATA_SIZE);
+    for (auto byteIdx = size_t{0}; byteIdx < RODATA_SIZE; byteIdx++) result[byteIdx] = static_cast<uint8_t>(byteIdx);
+    return result;
+}
+
+auto getDataSegment() -> std::vector<uint8_t> { return std::vector<uint8_t>(DATA_SIZE, 0xDA); }
+
+// only literals, longer than a token can hold
+auto getCompressedDataSegment() -> std::vector<uint8_t> {
+    auto result = std::vector<uint8_t>{};
+    appendLz4Sequence(result, getDataSegment(), 0, 0);
+    return result;
+}
+
+// an NSO with compressed text and data, and stored rodata
+auto getNso(const std::vector<uint8_t>& compressedText) -> std::vector<uint8_t> {
+    auto result = std::vector<uint8_t>(pchtxt::NSO_HEADER_SIZE);
+    std::copy_n("NSO0", 4, begin(result));
+    writeU32(result, 0x0C, 1 | 4 | 0x38);  // text and data compressed, hash checks on
+
+    auto segmentFiles =
+        std::vector<std::vector<uint8_t>>{compressedText, getRodataSegment(), getCompressedDataSegment()};
+    auto memoryOffsets = std::vector<uint32_t>{0, RODATA_MEMORY_OFFSET, DATA_MEMORY_OFFSET};
+    auto sizes = std::vector<size_t>{TEXT_SIZE, RODATA_SIZE, DATA_SIZE};
+    for (auto segmentIdx = size_t{0}; segmentIdx < segmentFiles.size(); segmentIdx++) {
+        auto segmentHeaderPos = 0x10 + segmentIdx * 0x10;
+        writeU32(result, segmentHeaderPos, static_cast<uint32_t>(result.size()));
+        writeU32(result, segmentHeaderPos + 4, memoryOffsets[segmentIdx]);
+        writeU32(result, segmentHeaderPos + 8, static_cast<uint32_t>(sizes[segmentIdx]));
+        writeU32(result, 0x60 + segmentIdx * 4, static_cast<uint32_t>(segmentFiles[segmentIdx].size()));
+        result.insert(end(result), begin(segmentFiles[segmentIdx]), end(segmentFiles[segmentIdx]));
+    }
+
+    auto moduleId = pchtxt::BuildId::fromHex(MODULE_ID_STR)->getBytes();
+    std::copy(begin(moduleId), end(moduleId), begin(result) + 0x40);
+    return result;
+}
+
+auto getCollection(const char* pchtxtStr = PCHTXT_STR) -> pchtxt::PatchTextOutput {
+    auto pchtxtInput = std::istringstream{pchtxtStr};
+    return pchtxt::parsePchtxt(pchtxtInput);
+}
+
+// testing
+
+auto check(const std::string& testName, bool isOk) -> bool {
+    std::cout << (isOk ? "ok   " : "FAIL ") << testName << std::endl;
+    return isOk;
+}
+
+auto testRead() -> bool {
+    auto isOk = true;
+    auto nsoData = getNso(getCompressedTextSegment());
+    auto nsoFile = pchtxt::readNso(nsoData.data(), nsoData.size());
+    isOk &= check("read NSO", nsoFile.has_value());
+    if (not isOk) return false;
+
+    isOk &= check("read module id", nsoFile->moduleId == *pchtxt::BuildId::fromHex(MODULE_ID_STR));
+    isOk &= check("read text with an overlapping match", nsoFile->segments[pchtxt::NSO_TEXT].data == getTextSegment());
+    isOk &= check("read stored rodata", nsoFile->segments[pchtxt::NSO_RODATA].data == getRodataSegment());
+    isOk &= check("read data with long literals", nsoFile->segments[pchtxt::NSO_DATA].data == getDataSegment());
+    auto& segments = nsoFile->segments;
+    isOk &= check("read segment memory offsets", segments[pchtxt::NSO_RODATA].memoryOffset == RODATA_MEMORY_OFFSET and
+                                                     segments[pchtxt::NSO_DATA].memoryOffset == DATA_MEMORY_OFFSET);
+
+    auto truncatedSize = nsoData.size() - 1;
+    isOk &= check("read truncated NSO fails", not pchtxt::readNso(nsoData.data(), truncatedSize));
+
+    auto badMatchText = std::vector<uint8_t>{};
+    appendLz4Sequence(badMatchText, {0, 1, 2}, 4, TEXT_SIZE - 3);
+    auto badMatchData = getNso(badMatchText);
+    isOk &= check("read match before the segment start fails",
+                  not pchtxt::readNso(badMatchData.data(), badMatchData.size()));
+
+    auto notNsoData = nsoData;
+    notNsoData[0] = 'X';
+    isOk &= check("read other file fails", not pchtxt::readNso(notNsoData.data(), notNsoData.size()));
+    return isOk;
+}
+
+auto testApply() -> bool {
+    auto isOk = true;
+    auto nsoData = getNso(getCompressedTextSegment());
+    auto output = getCollection();
+    auto& patchCollection = output.collections.front();
+
+    auto nsoFile = *pchtxt::readNso(nsoData.data(), nsoData.size());
+    auto logSs = std::stringstream{};
+    isOk &= check("apply patches", pchtxt::applyNsoPatches(nsoFile, patchCollection, logSs));
+
+    auto expectedText = getTextSegment();
+    std::copy_n("\x11\x22\x33\x44", 4, begin(expectedText));
+    auto expectedRodata = getRodataSegment();
+    std::copy_n("\xAA\xBB", 2, end(expectedRodata) - 2);
+    auto expectedData = getDataSegment();
+    std::copy_n("\x55\x66", 2, begin(expectedData) + 0x10);
+    isOk &= check("apply patch counting the header", nsoFile.segments[pchtxt::NSO_TEXT].data == expectedText);
+    isOk &= check("apply patch cut at the segment end", nsoFile.segments[pchtxt::NSO_RODATA].data == expectedRodata);
+    isOk &= check("apply patch in a later segment", nsoFile.segments[pchtxt::NSO_DATA].data == expectedData);
+    isOk &= check("apply warns about skipped bytes", logSs.str().find("WARNING: 2 bytes") != std::string::npos);
+
+    auto otherNsoData = nsoData;
+    otherNsoData[0x40] ^= 0xFF;
+    auto otherNsoFile = *pchtxt::readNso(otherNsoData.data(), otherNsoData.size());
+    isOk &= check("apply to another build id fails", not pchtxt::applyNsoPatches(otherNsoFile, patchCollection));
+    return isOk;
+}
+
+// the overlay has one bit per patch of any type, so a heap patch moves the bits of the binary patches after it
+auto testApplyOverlay() -> bool {
+    auto nsoData = getNso(getCompressedTextSegment());
+    auto output = getCollection(HEAP_FIRST_PCHTXT_STR);
+    auto& patchCollection = output.collections.front();
+    auto enabledSet = pchtxt::PatchEnabledSet{};
+    enabledSet.setEnabled(1, true);
+
+    auto nsoFile = *pchtxt::readNso(nsoData.data(), nsoData.size());
+    pchtxt::applyNsoPatches(nsoFile, patchCollection, enabledSet);
+    auto expectedText = getTextSegment();
+    std::copy_n("\x11\x22\x33\x44", 4, begin(expectedText));
+    return check("apply overlay after a heap patch", nsoFile.segments[pchtxt::NSO_TEXT].data == expectedText);
+}
+
+auto testWrite() -> bool {
+    auto isOk = true;
+    auto nsoData = getNso(getCompressedTextSegment());
+    auto output = getCollection();
+
+    auto patchedNsoSs = std::stringstream{};
+    isOk &= check("patch NSO", pchtxt::patchNso(nsoData.data(), nsoData.size(), output.collections.front(),
+                                                  patchedNsoSs));
+    auto patchedNsoStr = patchedNsoSs.str();
+    auto patchedNsoData = std::vector<uint8_t>(begin(patchedNsoStr), end(patchedNsoStr));
+    isOk &= check("patched NSO is uncompressed",
+                  patchedNsoData.size() == pchtxt::NSO_HEADER_SIZE + TEXT_SIZE + RODATA_SIZE + DATA_SIZE and
+                      (patchedNsoData[0x0C] & 0x3F) == 0);
+
+    auto nsoFile = *pchtxt::readNso(nsoData.data(), nsoData.size());
+    pchtxt::applyNsoPatches(nsoFile, output.collections.front());
+    auto patchedNsoFile = pchtxt::readNso(patchedNsoData.data(), patchedNsoData.size());
+    auto isReadBack = patchedNsoFile.has_value() and patchedNsoFile->moduleId == nsoFile.moduleId;
+    for (auto segmentIdx = size_t{0}; isReadBack and segmentIdx < pchtxt::NSO_SEGMENT_COUNT; segmentIdx++) {
+        isReadBack = patchedNsoFile->segments[segmentIdx].data == nsoFile.segments[segmentIdx].data;
+    }
+    isOk &= check("patched NSO reads back", isReadBack);
+
+    auto image = pchtxt::getNsoImage(nsoFile);
+    isOk &= check("image lays out segments at their memory offsets",
+                  image.size() == pchtxt::NSO_HEADER_SIZE + DATA_MEMORY_OFFSET + DATA_SIZE and
+                      image[pchtxt::NSO_HEADER_SIZE] == 0x11 and
+                      image[pchtxt::NSO_HEADER_SIZE + RODATA_MEMORY_OFFSET] == 0 and
+                      image[pchtxt::NSO_HEADER_SIZE + RODATA_MEMORY_OFFSET + RODATA_SIZE] == 0);
+
+    auto otherOutputSs = std::stringstream{};
+    auto notNsoData = std::vector<uint8_t>(0x10);
+    isOk &= check("patch other file writes nothing",
+                  not pchtxt::patchNso(notNsoData.data(), notNsoData.size(), output.collections.front(),
+                                       otherOutputSs) and
+                      otherOutputSs.str().empty());
+    return isOk;
+}
+
+int main() {
+    auto isOk = true;
+    isOk &= testRead();
+    isOk &= testApply();
+    isOk &= testApplyOverlay();
+    isOk &= testWrite();
+
+    std::cout << (isOk ? "all NSO tests pass" : "NSO tests failed") << std::endl;
+    return isOk ? 0 : 1;
+}
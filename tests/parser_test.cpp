@@ -0,0 +1,189 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+#include "../pchtxt.hpp"
+
+// corpus
+
+// the legacy tag relabels the section being read, with the patches already read and the one being read
+constexpr auto LEGACY_RELABEL_STR = R"(@title Legacy
+
+@flag nsobid AAAA
+// First
+@enabled
+0010 00
+@nsobid-BBBB
+0020 11
+
+// Second
+@enabled
+0030 22
+)";
+
+// relabeled to a build id with an earlier section, which takes the patches
+constexpr auto LEGACY_MERGE_STR = R"(@title Legacy
+
+@flag nsobid AAAA
+// First
+@enabled
+0010 00
+@flag nsobid CCCC
+// Second
+@enabled
+0020 11
+@nsobid AAAA
+)";
+
+// the meta section is not ended by an empty line, so it only ends with the Patch Text
+constexpr auto UNENDED_META_STR = R"(@title Unended
+@flag nsobid AAAA
+// First
+@enabled
+0010 00
+// Second
+@enabled
+0020 11
+@url "https://example.com"
+)";
+
+// CRLF line breaks, a string value and no line break at the end
+constexpr auto PUSH_STR = "@title \"Push\"\r\n@program 0100000000010000\r\n\r\n"
+                          "@flag nsobid 0123456789ABCDEF0123456789ABCDEF01234567\r\n// First [me]\r\n@enabled\r\n"
+                          "00001234 1F2003D5 E0031F2A\r\n00001238 \"hello\\n world\"  // comment\r\n\r\n"
+                          "@flag be\r\n// Second\r\n@disabled\r\n00002000 12345678";
+
+// a null terminated value with a quote and a comment identifier, which is written as an escaped string
+constexpr auto ESCAPED_QUOTE_STR = "@title Quote\n\n@flag nsobid AAAA\n// First\n@enabled\n0010 61222F6200 // a\"/b\n";
+
+constexpr auto PUSH_STOP_STR = "@title Stop\n\n@flag nsobid AAAA\n// First\n@enabled\n0010 00\n@stop\n0020 11\n";
+
+// testing
+
+auto check(const std::string& testName, bool isOk) -> bool {
+    std::cout << (isOk ? "ok   " : "FAIL ") << testName << std::endl;
+    return isOk;
+}
+
+auto parse(const char* pchtxtStr) -> pchtxt::PatchTextOutput {
+    auto pchtxtInput = std::istringstream{pchtxtStr};
+    return pchtxt::parsePchtxt(pchtxtInput);
+}
+
+// the output of feeding a Patch Text in chunks of a size
+auto feedInChunks(std::string_view pchtxtStr, size_t chunkSize, bool& isExpectingMore) -> std::string {
+    auto builder = pchtxt::PatchTextOutputBuilder{};
+    auto parser = pchtxt::PatchTextParser{builder};
+    isExpectingMore = true;
+    for (auto chunkPos = size_t{0}; chunkPos < pchtxtStr.size() and isExpectingMore; chunkPos += chunkSize) {
+        isExpectingMore = parser.feed(pchtxtStr.substr(chunkPos, chunkSize));
+    }
+    parser.finish();
+    return pchtxt::formatPchtxt(builder.output);
+}
+
+auto testPush() -> bool {
+    auto isOk = true;
+    auto expectedStr = pchtxt::formatPchtxt(parse(PUSH_STR));
+    isOk &= check("push corpus has patches", expectedStr.find("Second") != std::string::npos);
+
+    auto isExpectingMore = true;
+    for (auto chunkSize : {size_t{1}, size_t{2}, size_t{3}, size_t{7}, size_t{64}, std::string_view(PUSH_STR).size()}) {
+        isOk &= check("push in chunks of " + std::to_string(chunkSize),
+                      feedInChunks(PUSH_STR, chunkSize, isExpectingMore) == expectedStr);
+    }
+
+    auto stopStr = feedInChunks(PUSH_STOP_STR, 5, isExpectingMore);
+    isOk &= check("push stops expecting input at @stop", not isExpectingMore);
+    isOk &= check("push ignores lines after @stop", stopStr == pchtxt::formatPchtxt(parse(PUSH_STOP_STR)));
+    return isOk;
+}
+
+auto testLegacyRelabel() -> bool {
+    auto isOk = true;
+    auto output = parse(LEGACY_RELABEL_STR);
+    isOk &= check("legacy relabel keeps one collection", output.collections.size() == 1);
+    if (not isOk) return false;
+
+    auto& patchCollection = output.collections.front();
+    isOk &= check("legacy relabel changes the build id", patchCollection.buildId == *pchtxt::BuildId::fromHex("BBBB"));
+    isOk &= check("legacy relabel keeps the patches", patchCollection.patches.size() == 2);
+    isOk &= check("legacy relabel continues the patch", patchCollection.patches.front().contents.size() == 2);
+    return isOk;
+}
+
+auto testLegacyMerge() -> bool {
+    auto isOk = true;
+    auto output = parse(LEGACY_MERGE_STR);
+    isOk &= check("legacy merge keeps one collection per build id", output.collections.size() == 1);
+    if (not isOk) return false;
+
+    auto& patchCollection = output.collections.front();
+    isOk &= check("legacy merge build id", patchCollection.buildId == *pchtxt::BuildId::fromHex("AAAA"));
+    isOk &= check("legacy merge keeps the patch order", patchCollection.patches.size() == 2 and
+                                                            patchCollection.patches.front().name.str() == "First" and
+                                                            patchCollection.patches.back().name.str() == "Second");
+    return isOk;
+}
+
+auto testReaderMeta() -> bool {
+    auto isOk = true;
+    auto pchtxtInput = std::istringstream{UNENDED_META_STR};
+    auto reader = pchtxt::PatchReader{pchtxtInput};
+    auto entry = reader.begin();
+    isOk &= check("reader reads the patch", entry != reader.end() and entry->patch.name.str() == "First");
+    isOk &= check("reader meta is complete with the first patch", reader.getMeta().url == "https://example.com");
+    return isOk;
+}
+
+auto testEscapedQuote() -> bool {
+    auto output = parse(ESCAPED_QUOTE_STR);
+    auto formattedStr = pchtxt::formatPchtxt(output);
+    auto pchtxtInput = std::istringstream{formattedStr};
+    auto roundTripOutput = pchtxt::parsePchtxt(pchtxtInput);
+    auto isWrittenAsString = formattedStr.find("\"a\\\"/b\"") != std::string::npos;
+    auto isSameValue = not roundTripOutput.collections.empty() and
+                       roundTripOutput.collections.front().patches.front().contents.front().value ==
+                           output.collections.front().patches.front().contents.front().value;
+    return check("escaped quote round trips", isWrittenAsString and isSameValue and
+                                                  pchtxt::formatPchtxt(roundTripOutput) == formattedStr);
+}
+
+// the same build id given with and without its zero padding, which can also be merged into one collection
+auto testCanonicalBuildId() -> bool {
+    auto isOk = true;
+    auto getCanonical = [](const std::string& pchtxtStr) {
+        auto pchtxtInput = std::istringstream{pchtxtStr};
+        return pchtxt::getCanonicalPchtxt(pchtxtInput);
+    };
+    auto getPchtxtStr = [](const std::string& buildIdStr, const std::string& otherBuildIdStr) {
+        return "@title Canonical\n\n@flag nsobid " + buildIdStr + "\n// First\n@enabled\n0010 00\n\n@flag nsobid " +
+               otherBuildIdStr + "\n// Second\n@enabled\n0020 11\n";
+    };
+
+    auto shortStr = getCanonical(getPchtxtStr("ABCD", "ABCD"));
+    isOk &= check("canonical build id is written with 40 digits",
+                  shortStr.find("ABCD" + std::string(36, '0') + "\n") != std::string::npos);
+    isOk &= check("canonical build id of a padded spelling",
+                  getCanonical(getPchtxtStr("ABCD0000", "ABCD0000")) == shortStr);
+    isOk &= check("canonical build id of mixed spellings", getCanonical(getPchtxtStr("ABCD0000", "abcd")) == shortStr);
+
+    auto longBuildIdStr = std::string(63, '0') + "1";
+    isOk &= check("canonical build id keeps every digit of a long one",
+                  getCanonical(getPchtxtStr(longBuildIdStr, longBuildIdStr)).find(longBuildIdStr) != std::string::npos);
+    return isOk;
+}
+
+int main() {
+    auto isOk = true;
+    isOk &= testPush();
+    isOk &= testLegacyRelabel();
+    isOk &= testLegacyMerge();
+    isOk &= testReaderMeta();
+    isOk &= testCanonicalBuildId();
+    isOk &= testEscapedQuote();
+
+    std::cout << (isOk ? "all parser tests pass" : "parser tests failed") << std::endl;
+    return isOk ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../pchtxt_search.hpp"
+
+// corpus
+
+// few letters in both cases, so random queries match often, and a two byte character that case folding leaves alone
+const auto NAME_CHARS = std::vector<std::string>{"a", "A", "b", "B", "c", "C", " ", "x", "\xC3\xA9"};
+
+auto getRandomText(std::mt19937& random, size_t maxSize) -> std::string {
+    auto result = std::string{};
+    auto size = random() % (maxSize + 1);
+    for (auto charIdx = size_t{0}; charIdx < size; charIdx++) result += NAME_CHARS[random() % NAME_CHARS.size()];
+    return result;
+}
+
+// random names and authors in one or two collections
+auto getRandomPchtxt(std::mt19937& random) -> std::string {
+    auto pchtxtSs = std::stringstream{};
+    pchtxtSs << "@title Random\n";
+    auto collectionCount = 1 + random() % 2;
+    for (auto collectionIdx = 0u; collectionIdx < collectionCount; collectionIdx++) {
+        pchtxtSs << "\n@flag nsobid " << std::hex << 0x1000 + collectionIdx << std::dec << "\n";
+        auto patchCount = random() % 40;
+        for (auto patchIdx = 0u; patchIdx < patchCount; patchIdx++) {
+            pchtxtSs << "// P" << getRandomText(random, 12);
+            if (random() % 2 == 0) pchtxtSs << " [" << getRandomText(random, 6) << "]";
+            pchtxtSs << "\n@enabled\n" << std::hex << patchIdx * 0x10 << std::dec << " 00\n";
+        }
+    }
+    return pchtxtSs.str();
+}
+
+auto parse(const std::string& pchtxtStr) -> pchtxt::PatchTextOutput {
+    auto pchtxtInput = std::istringstream{pchtxtStr};
+    return pchtxt::parsePchtxt(pchtxtInput);
+}
+
+auto getLowerCase(std::string str) -> std::string {
+    for (auto& ch : str) {
+        if (ch >= 'A' and ch <= 'Z') ch = static_cast<char>(ch - 'A' + 'a');
+    }
+    return str;
+}
+
+// brute force, with build ids in canonical form since the index keeps them as bytes
+
+auto getHitStr(std::string_view path, const pchtxt::BuildId& buildId, size_t patchIdx, std::string_view name,
+               std::string_view author) -> std::string {
+    return std::string(path) + " " + buildId.toCanonical().toString() + " " + std::to_string(patchIdx) + " " +
+           std::string(name) + " [" + std::string(author) + "]";
+}
+
+auto getHitStrs(const std::vector<pchtxt::PatchSearchHit>& hits) -> std::vector<std::string> {
+    auto result = std::vector<std::string>{};
+    for (auto& hit : hits) result.push_back(getHitStr(hit.path, hit.buildId, hit.patchIdx, hit.name, hit.author));
+    return result;
+}
+
+auto getBruteForceHitStrs(const std::map<std::string, pchtxt::PatchTextOutput>& outputs, const std::string& query,
+                          pchtxt::PatchSearchField fields, size_t maxHits) -> std::vector<std::string> {
+    auto result = std::vector<std::string>{};
+    auto lowerQuery = getLowerCase(query);
+    for (auto& [path, output] : outputs) {
+        for (auto& patchCollection : output.collections) {
+            auto patchIdx = size_t{0};
+            for (auto& patch : patchCollection.patches) {
+                auto isMatch = ((fields & pchtxt::SEARCH_NAME) != 0 and
+                                getLowerCase(std::string(patch.name)).find(lowerQuery) != std::string::npos) or
+                               ((fields & pchtxt::SEARCH_AUTHOR) != 0 and
+                                getLowerCase(std::string(patch.author)).find(lowerQuery) != std::string::npos);
+                if (isMatch and result.size() < maxHits) {
+                    result.push_back(getHitStr(path, patchCollection.buildId, patchIdx, patch.name.str(),
+                                               patch.author.str()));
+                }
+                patchIdx++;
+            }
+        }
+    }
+    return result;
+}
+
+// testing
+
+auto check(const std::string& testName, bool isOk) -> bool {
+    std::cout << (isOk ? "ok   " : "FAIL ") << testName << std::endl;
+    return isOk;
+}
+
+auto getIndexStr(const pchtxt::PatchSearchIndexBuilder& searchBuilder) -> std::string {
+    auto indexSs = std::stringstream{};
+    searchBuilder.write(indexSs);
+    return indexSs.str();
+}
+
+auto getIndex(const std::string& indexStr) -> std::optional<pchtxt::PatchSearchIndex> {
+    return pchtxt::PatchSearchIndex::fromData(reinterpret_cast<const uint8_t*>(indexStr.data()), indexStr.size());
+}
+
+auto isMatchingBruteForce(std::mt19937& random, const pchtxt::PatchSearchIndex& index,
+                          const std::map<std::string, pchtxt::PatchTextOutput>& outputs) -> bool {
+    for (auto queryIdx = 0; queryIdx < 500; queryIdx++) {
+        auto query = getRandomText(random, 5);
+        auto fields = std::vector<pchtxt::PatchSearchField>{pchtxt::SEARCH_NAME, pchtxt::SEARCH_AUTHOR,
+                                                            pchtxt::SEARCH_NAME_OR_AUTHOR}[random() % 3];
+        auto maxHits = random() % 4 == 0 ? size_t{1 + random() % 5} : std::numeric_limits<size_t>::max();
+        if (getHitStrs(index.search(query, fields, maxHits)) != getBruteForceHitStrs(outputs, query, fields, maxHits)) {
+            std::cout << "query \"" << query << "\" fields " << fields << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+auto testSearch(std::mt19937& random) -> bool {
+    auto isOk = true;
+    auto outputs = std::map<std::string, pchtxt::PatchTextOutput>{};
+    auto searchBuilder = pchtxt::PatchSearchIndexBuilder{};
+    for (auto fileIdx = 0; fileIdx < 8; fileIdx++) {
+        auto path = "mods/" + std::to_string(7 - fileIdx) + ".pchtxt";  // added out of path order
+        outputs[path] = parse(getRandomPchtxt(random));
+        searchBuilder.addFile(path, outputs[path]);
+    }
+
+    auto indexStr = getIndexStr(searchBuilder);
+    auto index = getIndex(indexStr);
+    isOk &= check("search index reads back", index.has_value());
+    if (not isOk) return false;
+    isOk &= check("search matches brute force", isMatchingBruteForce(random, *index, outputs));
+    isOk &= check("search truncated index is refused", not getIndex(indexStr.substr(0, indexStr.size() - 1)));
+
+    isOk &= check("search index rebuilt from itself is the same",
+                  getIndexStr(pchtxt::PatchSearchIndexBuilder{*index}) == indexStr);
+
+    // replacing and removing files
+    outputs["mods/3.pchtxt"] = parse(getRandomPchtxt(random));
+    searchBuilder.addFile("mods/3.pchtxt", outputs["mods/3.pchtxt"]);
+    outputs.erase("mods/5.pchtxt");
+    isOk &= check("search remove file", searchBuilder.removeFile("mods/5.pchtxt"));
+    isOk &= check("search remove missing file", not searchBuilder.removeFile("mods/5.pchtxt"));
+    auto updatedIndexStr = getIndexStr(searchBuilder);
+    auto updatedIndex = getIndex(updatedIndexStr);
+    isOk &= check("search updated index matches brute force",
+                  updatedIndex and isMatchingBruteForce(random, *updatedIndex, outputs));
+
+    auto emptyIndexStr = getIndexStr(pchtxt::PatchSearchIndexBuilder{});
+    auto emptyIndex = getIndex(emptyIndexStr);
+    isOk &= check("search empty index", emptyIndex and emptyIndex->search("abc").empty() and
+                                            emptyIndex->search("").empty());
+    return isOk;
+}
+
+int main() {
+    auto random = std::mt19937{3096};
+    auto isOk = true;
+    isOk &= testSearch(random);
+
+    std::cout << (isOk ? "all search tests pass" : "search tests failed") << std::endl;
+    return isOk ? 0 : 1;
+}
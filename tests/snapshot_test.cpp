@@ -0,0 +1,135 @@
+#include <atomic>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../pchtxt_snapshot.hpp"
+
+// corpus
+
+constexpr auto INVALID_PCHTXT_STR = "@title Invalid\n\n@flag nsobid XYZ\n// Patch\n@enabled\n0010 00\n";
+
+// a version of a Patch Text whose title tells how many patches it has, so readers can check they see whole versions.
+// Every collection keeps a patch, since the parser leaves out empty ones
+auto getVersionPchtxt(int version) -> std::string {
+    auto pchtxtSs = std::stringstream{};
+    pchtxtSs << "@title " << version << "\n\n@flag nsobid ABCD\n";
+    for (auto patchIdx = 0; patchIdx < version % 50 + 1; patchIdx++) {
+        pchtxtSs << "// Patch " << patchIdx << "\n@enabled\n" << std::hex << patchIdx * 0x10 << std::dec
+                 << " 0011223344556677889900112233445566778899\n";
+    }
+    pchtxtSs << "\n@flag nrobid 1234\n// Other\n@enabled\n0010 00\n";
+    return pchtxtSs.str();
+}
+
+auto parseSnapshot(const std::string& pchtxtStr) -> std::shared_ptr<const pchtxt::PatchTextSnapshot> {
+    auto pchtxtInput = std::istringstream{pchtxtStr};
+    return pchtxt::PatchTextSnapshot::parse(pchtxtInput);
+}
+
+// utils
+
+auto isWholeVersion(const pchtxt::PatchTextSnapshot& snapshot) -> bool {
+    auto version = std::stoi(snapshot.getMeta().title);
+    auto collection = snapshot.findCollection(*pchtxt::BuildId::fromHex("ABCD"));
+    return snapshot.getCollectionCount() == 2 and collection != nullptr and
+           collection->patches.size() == static_cast<size_t>(version % 50 + 1);
+}
+
+// testing
+
+auto check(const std::string& testName, bool isOk) -> bool {
+    std::cout << (isOk ? "ok   " : "FAIL ") << testName << std::endl;
+    return isOk;
+}
+
+auto testSnapshot() -> bool {
+    auto isOk = true;
+    auto snapshot = parseSnapshot(getVersionPchtxt(3));
+    isOk &= check("snapshot parse", snapshot != nullptr and isWholeVersion(*snapshot));
+    if (not isOk) return false;
+
+    isOk &= check("snapshot finds padded build id",
+                  snapshot->findCollectionIdx(*pchtxt::BuildId::fromHex("ABCD0000")) == size_t{0} and
+                      snapshot->findCollection(*pchtxt::BuildId::fromHex("1234")) == &snapshot->getCollection(1));
+    auto otherBuildId = *pchtxt::BuildId::fromHex("5678");
+    isOk &= check("snapshot misses other build id",
+                  not snapshot->findCollectionIdx(otherBuildId) and snapshot->findCollection(otherBuildId) == nullptr);
+    isOk &= check("snapshot parse error", parseSnapshot(INVALID_PCHTXT_STR) == nullptr);
+
+    // collections for the same binary are only apart when frozen from an output that was built so
+    auto output = pchtxt::PatchTextOutput{};
+    output.collections.push_back({*pchtxt::BuildId::fromHex("ABCD"), pchtxt::NSO, {}});
+    output.collections.push_back({*pchtxt::BuildId::fromHex("ABCD"), pchtxt::NSO, {}});
+    auto frozenSnapshot = pchtxt::PatchTextSnapshot::freeze(std::move(output));
+    isOk &= check("snapshot finds the first collection for a binary",
+                  frozenSnapshot->findCollectionIdx(*pchtxt::BuildId::fromHex("ABCD")) == size_t{0});
+    return isOk;
+}
+
+auto testPublish() -> bool {
+    auto isOk = true;
+    auto sharedPatchText = pchtxt::SharedPatchText{};
+    isOk &= check("publish nothing loaded yet", sharedPatchText.load() == nullptr);
+
+    auto firstInput = std::istringstream{getVersionPchtxt(1)};
+    isOk &= check("publish reload", sharedPatchText.reload(firstInput));
+    auto firstSnapshot = sharedPatchText.load();
+
+    auto invalidInput = std::istringstream{INVALID_PCHTXT_STR};
+    isOk &= check("publish reload error keeps the current version",
+                  not sharedPatchText.reload(invalidInput) and sharedPatchText.load() == firstSnapshot);
+
+    auto secondSnapshot = parseSnapshot(getVersionPchtxt(2));
+    isOk &= check("publish returns the old version", sharedPatchText.publish(secondSnapshot) == firstSnapshot);
+    isOk &= check("publish old version stays whole for its reader", isWholeVersion(*firstSnapshot));
+
+    auto expected = firstSnapshot;
+    isOk &= check("publish compare with a stale version fails",
+                  not sharedPatchText.compareAndPublish(expected, parseSnapshot(getVersionPchtxt(3))) and
+                      expected == secondSnapshot);
+    isOk &= check("publish compare with the current version",
+                  sharedPatchText.compareAndPublish(expected, parseSnapshot(getVersionPchtxt(4))) and
+                      std::stoi(sharedPatchText.load()->getMeta().title) == 4);
+    return isOk;
+}
+
+// readers keep loading while a reloader publishes new versions, and must only ever see whole versions
+auto testConcurrentReload() -> bool {
+    auto sharedPatchText = pchtxt::SharedPatchText{parseSnapshot(getVersionPchtxt(0))};
+    auto isReloading = std::atomic<bool>{true};
+    auto isWholeEverywhere = std::atomic<bool>{true};
+
+    auto readers = std::vector<std::thread>{};
+    for (auto readerIdx = 0; readerIdx < 4; readerIdx++) {
+        readers.emplace_back([&]() {
+            while (isReloading) {
+                auto snapshot = sharedPatchText.load();
+                if (not isWholeVersion(*snapshot)) isWholeEverywhere = false;
+            }
+        });
+    }
+
+    auto isReloaded = true;
+    for (auto version = 1; version < 300; version++) {
+        auto pchtxtInput = std::istringstream{getVersionPchtxt(version)};
+        isReloaded &= sharedPatchText.reload(pchtxtInput);
+    }
+    isReloading = false;
+    for (auto& reader : readers) reader.join();
+
+    return check("concurrent reload", isReloaded and isWholeEverywhere and
+                                          std::stoi(sharedPatchText.load()->getMeta().title) == 299);
+}
+
+int main() {
+    auto isOk = true;
+    isOk &= testSnapshot();
+    isOk &= testPublish();
+    isOk &= testConcurrentReload();
+
+    std::cout << (isOk ? "all snapshot tests pass" : "snapshot tests failed") << std::endl;
+    return isOk ? 0 : 1;
+}